@@ -10,4 +10,124 @@
 #define CREATE_USER_ASSET_SQL_CMD "INSERT INTO `wkr_server_schema`.`user_asset` (`chip`, `_id`) VALUES ('{0}', LAST_INSERT_ID);"
 
 // toggle for sql debug
-#define ENABLE_SQL_DEBUG
\ No newline at end of file
+#define ENABLE_SQL_DEBUG
+
+// toggle for the subsystem reports (db queue, settlements, hasher, teardown, shards, front, executors)
+// printed about once a minute
+//#define ENABLE_DEBUG_REPORT
+
+// toggle for the embedded sqlite storage backend (needs the sqlite3 amalgamation under ThirdParty/sqlite)
+//#define ENABLE_SQLITE_STORAGE
+
+// when the sqlite backend is enabled the server uses it instead of MySQL
+#define SQLITE_STORAGE_PATH "wkr_server.db"
+
+// toggle for the postgresql storage backend (needs libpq >= 14 under ThirdParty/postgresql)
+//#define ENABLE_POSTGRESQL_STORAGE
+
+// libpq connection string, point it at a local instance for testing
+#define POSTGRESQL_CONN_INFO "host=127.0.0.1 port=5432 dbname=wkr_server user=postgres password=1QAZ2wsx"
+
+// how many queued requests the postgresql pipeline thread sends before reading results
+#define PG_PIPELINE_MAX_BATCH 64
+
+// db request queue: worker threads, per type capacity and deadline
+#define DB_QUEUE_WORKER_COUNT 2
+#define DB_QUEUE_READ_CAPACITY 256
+#define DB_QUEUE_WRITE_CAPACITY 1024
+#define DB_QUEUE_READ_TIMEOUT_MS 2000
+#define DB_QUEUE_WRITE_TIMEOUT_MS 10000
+
+// db circuit breaker: consecutive failures before opening, and how long it stays open before probing
+#define DB_BREAKER_FAILURE_THRESHOLD 5
+#define DB_BREAKER_OPEN_MS 5000
+
+// after an asset or profile write, that player's reads stay on the mysql primary for this long
+#define MYSQL_REPLICA_AFFINITY_MS 3000
+
+// a replica that failed a connect or a read gets no reads for this long, they go to the primary meanwhile
+#define MYSQL_REPLICA_RETRY_MS 10000
+
+// chip settlements waiting for the same db write are committed together, at most this many per transaction
+#define DB_SETTLEMENT_MAX_GROUP 64
+
+// password hashing: scrypt cost (N = 2^LOG_N, 128 * N * R bytes of memory per hash), salt size,
+// and the dedicated hasher pool so login bursts cannot take more than this many cores
+#define PASSWORD_SCRYPT_LOG_N 14
+#define PASSWORD_SCRYPT_R 8
+#define PASSWORD_SCRYPT_P 1
+#define PASSWORD_SALT_BYTES 16
+#define PASSWORD_HASH_WORKER_COUNT 2
+#define PASSWORD_HASH_QUEUE_CAPACITY 64
+
+// PlayerMgr registry shards, must be a power of two
+#define PLAYER_REGISTRY_SHARD_COUNT 16
+
+// player handles: low PLAYER_HANDLE_INDEX_BITS select a connection slot, the rest is the slot's generation
+#define PLAYER_HANDLE_INDEX_BITS 16
+#define PLAYER_SLOT_CAPACITY (1 << PLAYER_HANDLE_INDEX_BITS)
+
+// room ids: low ROOM_ID_INDEX_BITS select a RoomSlotTable slot, the rest is the slot's generation
+#define ROOM_ID_INDEX_BITS 16
+#define ROOM_SLOT_CAPACITY (1 << ROOM_ID_INDEX_BITS)
+
+// room shard processes on one host, see RoomShard: how many, where shard k listens for the gateway,
+// and how long the gateway waits before reconnecting a lost shard
+#define ROOM_SHARD_COUNT 1
+#define ROOM_SHARD_SOCKET_PATH "wkr_room_shard_{}.sock"
+#define ROOM_SHARD_RECONNECT_MS 1000
+
+// a gateway link opens with the secret in this environment variable, start the gateway and all of its shards
+// with the same value; a shard without it refuses every link
+#define ROOM_SHARD_SECRET_ENV "WKR_SHARD_SECRET"
+
+// session resume: a logged in player whose connection drops keeps its rooms and seats this long,
+// and how long the resume token handed out at login stays valid
+#define SESSION_RESUME_GRACE_MS 60000
+#define SESSION_TOKEN_TTL_SECONDS 86400
+
+// listing rpcs (print room / print user): page size when the client does not ask for one, and the most it may ask for
+#define LISTING_DEFAULT_PAGE_SIZE 50
+#define LISTING_MAX_PAGE_SIZE 500
+
+// lobby subscriptions: how often subscribers get a diff, and how many room changes are kept to build diffs from
+// a subscriber that falls further behind than the log gets a full snapshot instead
+#define LOBBY_PUSH_INTERVAL_MS 500
+#define LOBBY_CHANGE_LOG_CAPACITY 4096
+
+// poker tables with no hand, no joins, exits or packets for this long are written to ROOM_HIBERNATE_DIR,
+// dropped from memory and skipped by the tick until someone touches the room again
+#define ROOM_HIBERNATE_AFTER_MS (5 * 60 * 1000)
+#define ROOM_HIBERNATE_DIR "hibernate"
+
+// gateway/logic split: "--front" owns every client socket on FRONT_WORKER_COUNT poll threads and exchanges packs
+// with "--logic" through two ShmRing per worker (FRONT_RING_NAME of worker and direction), the logic process runs
+// the game. how long a side waits on a full ring before it gives up on a packet, and how often the front retries
+// opening rings the logic process has not created yet
+#define FRONT_WORKER_COUNT 2
+#define FRONT_RING_BYTES (4 * 1024 * 1024)
+#define FRONT_RING_NAME "Local\\wkr_front_{}_{}"
+#define FRONT_RING_FULL_WAIT_MS 100
+#define FRONT_RING_OPEN_RETRY_MS 1000
+#define FRONT_POLL_TIMEOUT_MS 1
+
+// front sockets never block a worker: what a client does not take right away waits in its connection's buffer,
+// and a client that lets more than this pile up is closed alone
+#define FRONT_CONN_MAX_PENDING_BYTES (1024 * 1024)
+
+// rooms run on ROOM_EXECUTOR_COUNT threads, see RoomExecutor. every ROOM_REBALANCE_INTERVAL_TICKS up to
+// ROOM_REBALANCE_MAX_MOVES rooms leave the busiest executor, as long as it spent ROOM_REBALANCE_THRESHOLD_PERCENT
+// more time in rooms than the idlest one
+#define ROOM_EXECUTOR_COUNT 4
+#define ROOM_REBALANCE_INTERVAL_TICKS 25
+#define ROOM_REBALANCE_MAX_MOVES 4
+#define ROOM_REBALANCE_THRESHOLD_PERCENT 25
+
+// poker tables: players without a seat get the table at most this often, as one pack shared by all of them
+#define POKER_SPECTATOR_UPDATE_MS 1000
+
+// a player's outbox is written out early once it holds this much, instead of waiting for the end of the tick
+#define PLAYER_OUTBOX_FLUSH_BYTES (64 * 1024)
+
+// chat rooms send their texts once per tick as one batch, a text is never held back longer than this
+#define CHAT_BATCH_MAX_DELAY_MS 200
@@ -0,0 +1,121 @@
+#include "pch.h"
+#include "ChipSettlementMgr.h"
+#include "StorageMgr.h"
+#include "DbRequestQueue.h"
+#include "Const.h"
+
+ChipSettlementMgr& ChipSettlementMgr::Instance()
+{
+	static ChipSettlementMgr instance;
+	return instance;
+}
+
+void ChipSettlementMgr::Settle(std::vector<ChipDelta> deltas, std::function<void(bool)> callback)
+{
+	std::erase_if(deltas, [](const ChipDelta& d) { return d.delta == 0; });
+	if (deltas.empty())
+	{
+		if (callback)
+			callback(true);
+		return;
+	}
+
+	auto& mgr = Instance();
+	bool needSchedule = false;
+	{
+		std::unique_lock<std::mutex> lock(mgr._mutex);
+		mgr._pending.push_back(PendingSettlement{ std::move(deltas), std::move(callback) });
+		needSchedule = !mgr._flushScheduled;
+		mgr._flushScheduled = true;
+	}
+	if (needSchedule)
+		mgr.ScheduleFlush();
+}
+
+void ChipSettlementMgr::ScheduleFlush()
+{
+	DbRequestQueue::Submit(DbRequestQueue::RequestType::Write, [this]() { Flush(); },
+		[this](RpcError err)
+		{
+			std::cerr << "[ChipSettlementMgr] CRITICAL: settlement flush dropped (err " << err << ")" << std::endl;
+			FailAllPending();
+		});
+}
+
+void ChipSettlementMgr::Flush()
+{
+	// only one group is in flight at a time, settlements arriving meanwhile make up the next one
+	std::vector<PendingSettlement> group{};
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		size_t count = std::min(_pending.size(), (size_t)DB_SETTLEMENT_MAX_GROUP);
+		group.assign(std::make_move_iterator(_pending.begin()), std::make_move_iterator(_pending.begin() + count));
+		_pending.erase(_pending.begin(), _pending.begin() + count);
+	}
+
+	std::vector<bool> applied(group.size(), false);
+	if (!group.empty())
+	{
+		std::vector<std::vector<ChipDelta>> settlements{};
+		settlements.reserve(group.size());
+		for (auto& pending : group)
+			settlements.push_back(pending.deltas);
+
+		try
+		{
+			if (!StorageMgr::Backend().SettleChips(settlements, applied))
+				applied.assign(group.size(), false);
+		}
+		catch (const std::exception& e)
+		{
+			std::cout << "STD ERROR: " << e.what() << std::endl;
+			DbRequestQueue::ReportDbError();
+			applied.assign(group.size(), false);
+		}
+		_commits++;
+		_settlements += group.size();
+	}
+
+	bool more = false;
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		more = !_pending.empty();
+		_flushScheduled = more;
+	}
+	if (more)
+		ScheduleFlush();
+
+	for (size_t i = 0; i < group.size(); i++)
+	{
+		if (group[i].callback)
+			group[i].callback(applied[i]);
+	}
+}
+
+void ChipSettlementMgr::FailAllPending()
+{
+	std::vector<PendingSettlement> dropped{};
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		dropped.swap(_pending);
+		_flushScheduled = false;
+	}
+	for (auto& pending : dropped)
+	{
+		if (pending.callback)
+			pending.callback(false);
+	}
+}
+
+void ChipSettlementMgr::DebugPrint()
+{
+	auto& mgr = Instance();
+	size_t pending = 0;
+	{
+		std::unique_lock<std::mutex> lock(mgr._mutex);
+		pending = mgr._pending.size();
+	}
+	std::cout << "[CHIP SETTLEMENT REPORT] commits: " << mgr._commits.load()
+		<< "; settlements: " << mgr._settlements.load()
+		<< "; pending: " << pending << std::endl;
+}
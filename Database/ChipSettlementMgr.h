@@ -0,0 +1,46 @@
+#pragma once
+#include "CppServerAPI.h"
+#include "StorageBackend.h"
+#include <functional>
+#include <vector>
+#include <mutex>
+#include <atomic>
+
+// group commit for chip settlements
+// a settlement is every (playerId, delta) pair of one hand or table event and is applied atomically.
+// the first settlement that arrives schedules one write on DbRequestQueue, everything that arrives
+// from any room before that write starts running is committed in the same transaction.
+class CPPSERVER_API ChipSettlementMgr
+{
+	struct PendingSettlement
+	{
+		std::vector<ChipDelta> deltas{};
+		std::function<void(bool)> callback = nullptr;
+	};
+
+	static ChipSettlementMgr& Instance();
+
+	std::vector<PendingSettlement> _pending{};
+	bool _flushScheduled = false;
+	std::mutex _mutex;
+
+	std::atomic<uint64_t> _commits{ 0 };
+	std::atomic<uint64_t> _settlements{ 0 };
+
+	// caller already set _flushScheduled
+	void ScheduleFlush();
+	void Flush();
+	void FailAllPending();
+
+	ChipSettlementMgr() = default;
+	ChipSettlementMgr(const ChipSettlementMgr&) = delete;
+	ChipSettlementMgr& operator=(const ChipSettlementMgr&) = delete;
+
+public:
+	~ChipSettlementMgr() = default;
+
+	// callback(true) once the whole settlement is committed, callback(false) if none of it was applied
+	// runs on a db worker thread
+	static void Settle(std::vector<ChipDelta> deltas, std::function<void(bool)> callback);
+	static void DebugPrint();
+};
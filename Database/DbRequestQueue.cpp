@@ -0,0 +1,224 @@
+#include "pch.h"
+#include "DbRequestQueue.h"
+#include "Const.h"
+
+namespace
+{
+	// set while a db worker runs a request, so an error is charged to the request that hit it and not to
+	// whatever the other workers happen to be running at the time
+	thread_local bool* t_requestFailed = nullptr;
+}
+
+DbRequestQueue::DbRequestQueue(size_t workerCount)
+{
+	for (size_t i = 0; i < workerCount; i++)
+		_workers.emplace_back(std::thread(&DbRequestQueue::WorkerJob, this));
+}
+
+DbRequestQueue::~DbRequestQueue()
+{
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		_isDead = true;
+	}
+	_cond.notify_all();
+	for (auto& t : _workers) t.join();
+}
+
+DbRequestQueue& DbRequestQueue::Instance()
+{
+	static DbRequestQueue instance(DB_QUEUE_WORKER_COUNT);
+	return instance;
+}
+
+void DbRequestQueue::Submit(RequestType type, std::function<void()> job, std::function<void(RpcError)> onFail, int timeoutMs)
+{
+	auto& q = Instance();
+	if (timeoutMs < 0)
+		timeoutMs = type == RequestType::Read ? DB_QUEUE_READ_TIMEOUT_MS : DB_QUEUE_WRITE_TIMEOUT_MS;
+
+	bool admitted = false;
+	bool breakerRejected = false;
+	{
+		std::unique_lock<std::mutex> lock(q._mutex);
+		auto& list = type == RequestType::Read ? q._reads : q._writes;
+		size_t capacity = type == RequestType::Read ? DB_QUEUE_READ_CAPACITY : DB_QUEUE_WRITE_CAPACITY;
+		if (q._isDead)
+			admitted = false;
+		else if (!q.BreakerAllows())
+			breakerRejected = true;
+		else if (list.size() < capacity)
+		{
+			DbRequest req{};
+			req.job = std::move(job);
+			req.onFail = onFail;
+			req.deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+			list.push_back(std::move(req));
+			admitted = true;
+		}
+	}
+
+	if (admitted)
+	{
+		q._cond.notify_one();
+		return;
+	}
+	if (breakerRejected)
+		q._rejectedBreaker++;
+	else
+		q._rejectedFull++;
+	if (onFail)
+		onFail(RpcError::DATABASE_ERROR);
+}
+
+void DbRequestQueue::ReportDbError()
+{
+	Instance()._dbErrors++;
+	if (t_requestFailed != nullptr)
+		*t_requestFailed = true;
+}
+
+void DbRequestQueue::Pause()
+{
+	auto& q = Instance();
+	std::unique_lock<std::mutex> lock(q._mutex);
+	q._paused = true;
+}
+
+void DbRequestQueue::Resume()
+{
+	auto& q = Instance();
+	{
+		std::unique_lock<std::mutex> lock(q._mutex);
+		q._paused = false;
+	}
+	q._cond.notify_all();
+}
+
+bool DbRequestQueue::IsHealthy()
+{
+	auto& q = Instance();
+	std::unique_lock<std::mutex> lock(q._mutex);
+	return q._breakerState == BreakerState::Closed;
+}
+
+size_t DbRequestQueue::GetQueueDepth(RequestType type)
+{
+	auto& q = Instance();
+	std::unique_lock<std::mutex> lock(q._mutex);
+	return type == RequestType::Read ? q._reads.size() : q._writes.size();
+}
+
+void DbRequestQueue::DebugPrint()
+{
+	auto& q = Instance();
+	size_t reads = 0, writes = 0;
+	BreakerState state = BreakerState::Closed;
+	{
+		std::unique_lock<std::mutex> lock(q._mutex);
+		reads = q._reads.size();
+		writes = q._writes.size();
+		state = q._breakerState;
+	}
+	std::cout << "[DB QUEUE REPORT] reads: " << reads << "/" << DB_QUEUE_READ_CAPACITY
+		<< "; writes: " << writes << "/" << DB_QUEUE_WRITE_CAPACITY
+		<< "; breaker: " << (int)state
+		<< "; completed: " << q._completed.load()
+		<< "; failed: " << q._failed.load()
+		<< "; rejected(full): " << q._rejectedFull.load()
+		<< "; rejected(breaker): " << q._rejectedBreaker.load()
+		<< "; expired: " << q._expired.load()
+		<< "; db errors: " << q._dbErrors.load() << std::endl;
+}
+
+// caller holds _mutex
+bool DbRequestQueue::BreakerAllows()
+{
+	if (_breakerState == BreakerState::Closed)
+		return true;
+	if (_breakerState == BreakerState::Open)
+	{
+		if (std::chrono::steady_clock::now() < _breakerOpenUntil)
+			return false;
+		_breakerState = BreakerState::HalfOpen;
+		_probeInFlight = false;
+	}
+	// half open: let exactly one probe through, its outcome decides the next state
+	if (_probeInFlight)
+		return false;
+	_probeInFlight = true;
+	return true;
+}
+
+void DbRequestQueue::OnRequestFinished(bool success)
+{
+	std::unique_lock<std::mutex> lock(_mutex);
+	_probeInFlight = false;
+	if (success)
+	{
+		_consecutiveFailures = 0;
+		if (_breakerState != BreakerState::Closed)
+		{
+			_breakerState = BreakerState::Closed;
+			std::cout << "DbRequestQueue: database recovered, circuit breaker closed" << std::endl;
+		}
+		return;
+	}
+
+	_consecutiveFailures++;
+	if (_breakerState == BreakerState::HalfOpen || _consecutiveFailures >= DB_BREAKER_FAILURE_THRESHOLD)
+	{
+		if (_breakerState != BreakerState::Open)
+			std::cout << "DbRequestQueue: database unhealthy, circuit breaker open" << std::endl;
+		_breakerState = BreakerState::Open;
+		_breakerOpenUntil = std::chrono::steady_clock::now() + std::chrono::milliseconds(DB_BREAKER_OPEN_MS);
+	}
+}
+
+void DbRequestQueue::WorkerJob()
+{
+	while (true)
+	{
+		DbRequest req{};
+		bool breakerOpen = false;
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_cond.wait(lock, [this]() { return _isDead || (!_paused && (!_reads.empty() || !_writes.empty())); });
+			if (_isDead && _reads.empty() && _writes.empty()) return;
+
+			// alternate between the two lists so a burst of one kind cannot starve the other
+			bool takeWrite = !_writes.empty() && (_reads.empty() || _preferWrite);
+			_preferWrite = !_preferWrite;
+			auto& list = takeWrite ? _writes : _reads;
+			req = std::move(list.front());
+			list.pop_front();
+			breakerOpen = _breakerState == BreakerState::Open;
+		}
+
+		if (breakerOpen || std::chrono::steady_clock::now() > req.deadline)
+		{
+			if (breakerOpen) _rejectedBreaker++;
+			else _expired++;
+			if (req.onFail)
+				req.onFail(RpcError::DATABASE_ERROR);
+			continue;
+		}
+
+		bool failed = false;
+		t_requestFailed = &failed;
+		try
+		{
+			req.job();
+		}
+		catch (const std::exception& e)
+		{
+			std::cout << "STD ERROR: " << e.what() << std::endl;
+			ReportDbError();
+		}
+		t_requestFailed = nullptr;
+		bool success = !failed;
+		if (success) _completed++;
+		else _failed++;
+		OnRequestFinished(success);
+	}
+}
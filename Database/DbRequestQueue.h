@@ -0,0 +1,95 @@
+#pragma once
+#include "CppServerAPI.h"
+#include "Net/RpcError.h"
+#include <functional>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+
+// bounded queue in front of the storage layer
+// all persistence work is submitted here and runs on a few dedicated db worker threads,
+// so the tick thread never blocks on the database.
+// reads and writes have separate capacities and deadlines; a request that cannot be admitted,
+// or that waited past its deadline, is shed and its onFail gets RpcError::DATABASE_ERROR.
+// a circuit breaker opens after repeated db errors and rejects everything until a probe succeeds.
+class CPPSERVER_API DbRequestQueue
+{
+public:
+	enum class RequestType : uint8_t
+	{
+		Read = 0,
+		Write = 1,
+	};
+
+	enum class BreakerState : uint8_t
+	{
+		Closed = 0,
+		Open = 1,
+		HalfOpen = 2,
+	};
+
+private:
+	struct DbRequest
+	{
+		std::function<void()> job = nullptr;
+		std::function<void(RpcError)> onFail = nullptr;
+		std::chrono::steady_clock::time_point deadline{};
+	};
+
+	static DbRequestQueue& Instance();
+
+	std::deque<DbRequest> _reads{};
+	std::deque<DbRequest> _writes{};
+	std::vector<std::thread> _workers{};
+	std::mutex _mutex;
+	std::condition_variable _cond;
+	bool _isDead = false;
+	bool _paused = false;
+	bool _preferWrite = false;
+
+	BreakerState _breakerState = BreakerState::Closed;
+	int _consecutiveFailures = 0;
+	bool _probeInFlight = false;
+	std::chrono::steady_clock::time_point _breakerOpenUntil{};
+
+	// every driver level error, also those reported outside a request, only for the report
+	std::atomic<uint64_t> _dbErrors{ 0 };
+
+	std::atomic<uint64_t> _completed{ 0 };
+	std::atomic<uint64_t> _failed{ 0 };
+	std::atomic<uint64_t> _rejectedFull{ 0 };
+	std::atomic<uint64_t> _rejectedBreaker{ 0 };
+	std::atomic<uint64_t> _expired{ 0 };
+
+	void WorkerJob();
+	bool BreakerAllows();
+	void OnRequestFinished(bool success);
+
+	DbRequestQueue(size_t workerCount);
+	DbRequestQueue(const DbRequestQueue&) = delete;
+	DbRequestQueue& operator=(const DbRequestQueue&) = delete;
+
+public:
+	~DbRequestQueue();
+
+	// job runs on a db worker; onFail runs instead if the request is shed, possibly on the calling thread
+	// timeoutMs < 0 uses the default deadline of the request type
+	static void Submit(RequestType type, std::function<void()> job, std::function<void(RpcError)> onFail = nullptr, int timeoutMs = -1);
+
+	// called by MySqlMgr / PostgreSqlMgr / SqliteStorage whenever the driver reports an error
+	// fails the request the calling db worker is running, on any other thread it only counts for the report
+	static void ReportDbError();
+
+	// while paused requests are still admitted but workers hold them, deadlines keep running
+	// used during startup so players can connect before the backend is ready
+	static void Pause();
+	static void Resume();
+
+	static bool IsHealthy();
+	static size_t GetQueueDepth(RequestType type);
+	static void DebugPrint();
+};
@@ -4,6 +4,7 @@
 #include <functional>
 #include <iostream>
 #include "Utils/Utils.h"
+#include "DbRequestQueue.h"
 #include "Const.h"
 
 MySqlMgr::MySqlMgr() : _sqlSession(nullptr) {}
@@ -14,82 +15,195 @@ MySqlMgr& MySqlMgr::Instance()
 	return instance;
 }
 
-void MySqlMgr::EnsureConnection(bool forceUpdate)
+mysqlx::Session* MySqlMgr::CreateSession(const std::string& url, unsigned int port)
 {
-	if (_sqlSession && !forceUpdate)
-		return;
-
 	try
 	{
 		auto setting = mysqlx::SessionSettings(
 			mysqlx::SessionOption::USER, _user,
 			mysqlx::SessionOption::PWD, _pass,
-			mysqlx::SessionOption::HOST, _url,
-			mysqlx::SessionOption::PORT, _port,
+			mysqlx::SessionOption::HOST, url,
+			mysqlx::SessionOption::PORT, port,
 			mysqlx::SessionOption::DB, _schema,
 			mysqlx::SessionOption::SSL_MODE, mysqlx::SSLMode::REQUIRED
 		);
-		//_sqlSession = std::make_unique<mysqlx::Session>(setting);
-		_sqlSession = new mysqlx::Session(setting);
+		return new mysqlx::Session(setting);
 	}
 	catch (sql::SQLException& e)
 	{
 		std::cout << "MYSQL ERROR: " << e.getErrorCode() << std::endl;
-		return;
 	}
 	catch (std::exception& e)
 	{
 		std::cout << "STD ERROR: " << e.what() << std::endl;
+	}
+	return nullptr;
+}
+void MySqlMgr::EnsureConnection(bool forceUpdate)
+{
+	if (_sqlSession && !forceUpdate)
 		return;
+
+	//_sqlSession = std::make_unique<mysqlx::Session>(setting);
+	_sqlSession = CreateSession(_url, _port);
+	// callers run inside their own try block, fail the statement instead of dereferencing a null session
+	if (_sqlSession == nullptr)
+	{
+		DbRequestQueue::ReportDbError();
+		throw std::runtime_error("MySqlMgr: no database session");
 	}
 }
-int MySqlMgr::DebugDatabaseInit()
+bool MySqlMgr::HasPrimaryAffinity(int playerId)
+{
+	if (playerId < 0)
+		return false;
+	std::lock_guard<std::mutex> lock(_affinityMutex);
+	auto it = _primaryAffinityUntil.find(playerId);
+	if (it == _primaryAffinityUntil.end())
+		return false;
+	if (std::chrono::steady_clock::now() < it->second)
+		return true;
+	_primaryAffinityUntil.erase(it);
+	return false;
+}
+void MySqlMgr::MarkPlayerWrite(int playerId)
 {
 	auto& db = Instance();
-	db.EnsureConnection();
-
+	if (db._replicas.empty() || playerId < 0)
+		return;
+	auto now = std::chrono::steady_clock::now();
+	std::lock_guard<std::mutex> lock(db._affinityMutex);
+	db._primaryAffinityUntil[playerId] = now + std::chrono::milliseconds(MYSQL_REPLICA_AFFINITY_MS);
+	// players that never read again would otherwise stay here forever
+	if (db._primaryAffinityUntil.size() > 4096)
+		std::erase_if(db._primaryAffinityUntil, [now](const auto& item) { return item.second <= now; });
+}
+bool MySqlMgr::TrySelectOnReplica(const std::string& sqlCmd, mysqlx::SqlResult& result)
+{
+	auto now = std::chrono::steady_clock::now().time_since_epoch().count();
+	ReplicaSession* picked = nullptr;
+	size_t start = _replicaCursor.fetch_add(1);
+	for (size_t i = 0; i < _replicas.size() && picked == nullptr; i++)
+	{
+		auto& candidate = *_replicas[(start + i) % _replicas.size()];
+		if (candidate.unhealthyUntil.load() <= now)
+			picked = &candidate;
+	}
+	if (picked == nullptr)
+		return false;
+	auto& replica = *picked;
+	auto lock = replica.lock.OnWrite();
+	// another read may have failed on it while this one waited for the lock
+	if (replica.unhealthyUntil.load() > now)
+		return false;
 	try
 	{
-		std::string selectCols = "*";
-		MySqlMgr::Select("`wkr_server_schema`.`v_user_info_with_asset`", selectCols, "", [](mysqlx::SqlResult&& selectRes)
-			{
-				while (auto resultElement = selectRes.fetchOne()) {
-					// Process the row data
-					std::cout << "ID: " << resultElement.get(2) << ", Name: " << resultElement.get(0) << ", Chips: " << resultElement.get(3) << std::endl;
-				}
-			});
-		std::cout << "Sql Module Init Check Passed!" << std::endl;
+		if (replica.session == nullptr)
+			replica.session = CreateSession(replica.endpoint.url, replica.endpoint.port);
+		if (replica.session == nullptr)
+		{
+			MarkReplicaUnhealthy(replica);
+			return false;
+		}
+#ifdef ENABLE_SQL_DEBUG
+		std::cout << "SQL DEBUG MSG: Select(replica " << replica.endpoint.url << ":" << replica.endpoint.port << ") - " << sqlCmd << std::endl;
+#endif
+		result = replica.session->sql(sqlCmd).execute();
+		return true;
 	}
-	catch (sql::SQLException& e)
+	catch (const mysqlx::Error& e)
 	{
-		std::cout << "MYSQL ERROR: " << e.getErrorCode() << std::endl;
-		return EXIT_FAILURE;
+		std::cout << "MYSQL ERROR (replica " << replica.endpoint.url << "): " << e << std::endl;
 	}
-	catch (std::exception& e)
+	catch (const std::exception& e)
 	{
-		std::cout << "STD ERROR: " << e.what() << std::endl;
-		return EXIT_FAILURE;
+		std::cout << "STD ERROR (replica " << replica.endpoint.url << "): " << e.what() << std::endl;
 	}
+	// drop the session so the first read after the cooldown reconnects
+	delete replica.session;
+	replica.session = nullptr;
+	MarkReplicaUnhealthy(replica);
+	return false;
+}
+void MySqlMgr::MarkReplicaUnhealthy(ReplicaSession& replica)
+{
+	auto until = std::chrono::steady_clock::now() + std::chrono::milliseconds(MYSQL_REPLICA_RETRY_MS);
+	replica.unhealthyUntil.store(until.time_since_epoch().count());
+	std::cout << "MySqlMgr: replica " << replica.endpoint.url << ":" << replica.endpoint.port
+		<< " unhealthy, its reads go to the primary for " << MYSQL_REPLICA_RETRY_MS << " ms" << std::endl;
+}
+int MySqlMgr::Ping()
+{
+	// constant-time health probe, touches no table
+	bool ok = false;
+	DoSql("SELECT 1;", [&ok](mysqlx::SqlResult&& res)
+		{
+			try
+			{
+				ok = res.hasData() && !res.fetchOne().isNull();
+			}
+			catch (const std::exception& e)
+			{
+				std::cout << "STD ERROR: " << e.what() << std::endl;
+			}
+		});
+	if (!ok)
+		return EXIT_FAILURE;
+	std::cout << "Sql Module Init Check Passed!" << std::endl;
 	return EXIT_SUCCESS;
 }
+void MySqlMgr::WarmReplicas()
+{
+	auto& db = Instance();
+	// connect every replica at once instead of paying the handshakes one after another on first reads
+	std::vector<std::thread> connectThreads{};
+	for (auto& replicaPtr : db._replicas)
+	{
+		auto* replica = replicaPtr.get();
+		connectThreads.emplace_back([&db, replica]()
+			{
+				auto lock = replica->lock.OnWrite();
+				if (replica->session == nullptr)
+					replica->session = db.CreateSession(replica->endpoint.url, replica->endpoint.port);
+				if (replica->session == nullptr)
+					db.MarkReplicaUnhealthy(*replica);
+			});
+	}
+	for (auto& t : connectThreads) t.join();
+}
 int MySqlMgr::Init(
 	const std::string& url,
 	const unsigned int port,
 	const std::string& user,
 	const std::string& pass,
-	const std::string& schema)
+	const std::string& schema,
+	const std::vector<MySqlEndpoint>& readReplicas)
 {
 	{
 		auto& db = Instance();
 		auto lock = db._lock.OnWrite();
+		db._replicas.clear();
+		for (const auto& endpoint : readReplicas)
+		{
+			auto replica = std::make_unique<ReplicaSession>();
+			replica->endpoint = endpoint;
+			db._replicas.push_back(std::move(replica));
+		}
 		db._url = url;
 		db._port = port;
 		db._user = user;
 		db._pass = pass;
 		db._schema = schema;
-		db.EnsureConnection(true);
+		try
+		{
+			db.EnsureConnection(true);
+		}
+		catch (const std::exception& e)
+		{
+			std::cout << "STD ERROR: " << e.what() << std::endl;
+			return EXIT_FAILURE;
+		}
 	}
-	DebugDatabaseInit();
 	return EXIT_SUCCESS;
 }
 
@@ -110,10 +224,12 @@ void MySqlMgr::DoSql(const std::string& sqlCmd, std::function<void(mysqlx::SqlRe
 	catch (const mysqlx::Error& e)
 	{
 		std::cout << "MYSQL ERROR: " << e << std::endl;
+		DbRequestQueue::ReportDbError();
 	}
 	catch (const std::exception& e)
 	{
 		std::cout << "STD ERROR: " << e.what() << std::endl;
+		DbRequestQueue::ReportDbError();
 	}
 	func(std::move(result));
 }
@@ -148,10 +264,12 @@ void MySqlMgr::DoSql(const std::vector<std::string>& sqlCmds, std::function<void
 	catch (const mysqlx::Error& e)
 	{
 		std::cout << "MYSQL ERROR: " << e << std::endl;
+		DbRequestQueue::ReportDbError();
 		try
 		{
 			auto& db = Instance();
-			db._sqlSession->rollback();
+			if (db._sqlSession)
+				db._sqlSession->rollback();
 		}
 		catch (const std::exception& rollbackEx)
 		{
@@ -162,10 +280,12 @@ void MySqlMgr::DoSql(const std::vector<std::string>& sqlCmds, std::function<void
 	catch (const std::exception& e)
 	{
 		std::cout << "STD ERROR: " << e.what() << std::endl;
+		DbRequestQueue::ReportDbError();
 		try
 		{
 			auto& db = Instance();
-			db._sqlSession->rollback();
+			if (db._sqlSession)
+				db._sqlSession->rollback();
 		}
 		catch (const std::exception& rollbackEx)
 		{
@@ -176,6 +296,39 @@ void MySqlMgr::DoSql(const std::vector<std::string>& sqlCmds, std::function<void
 	func(std::move(results));
 }
 
+bool MySqlMgr::DoTransaction(std::function<void(mysqlx::Session&)> body)
+{
+	auto& db = Instance();
+	auto lock = db._lock.OnWrite();
+	try
+	{
+		db.EnsureConnection();
+		db._sqlSession->startTransaction();
+		body(*db._sqlSession);
+		db._sqlSession->commit();
+		return true;
+	}
+	catch (const mysqlx::Error& e)
+	{
+		std::cout << "MYSQL ERROR: " << e << std::endl;
+	}
+	catch (const std::exception& e)
+	{
+		std::cout << "STD ERROR: " << e.what() << std::endl;
+	}
+	DbRequestQueue::ReportDbError();
+	try
+	{
+		if (db._sqlSession)
+			db._sqlSession->rollback();
+	}
+	catch (const std::exception& rollbackEx)
+	{
+		std::cout << "ROLLBACK ERROR: " << rollbackEx.what() << std::endl;
+	}
+	return false;
+}
+
 void MySqlMgr::Select(const std::string& table, const std::string& columns, const std::string& where, std::function<void(mysqlx::SqlResult&&)> func)
 {
 	mysqlx::SqlResult result;
@@ -197,14 +350,40 @@ void MySqlMgr::Select(const std::string& table, const std::string& columns, cons
 	catch (const mysqlx::Error& e)
 	{
 		std::cout << "MYSQL ERROR: " << e << std::endl;
+		DbRequestQueue::ReportDbError();
 	}
 	catch (const std::exception& e)
 	{
 		std::cout << "STD ERROR: " << e.what() << std::endl;
+		DbRequestQueue::ReportDbError();
 	}
 	func(std::move(result));
 }
 
+void MySqlMgr::Select(const std::string& table, const std::string& columns, const std::string& where, std::function<void(mysqlx::SqlResult&&)> func,
+	ReadConsistency consistency, int affinityPlayerId)
+{
+	auto& db = Instance();
+	if (consistency == ReadConsistency::Primary || db._replicas.empty() || db.HasPrimaryAffinity(affinityPlayerId))
+	{
+		Select(table, columns, where, func);
+		return;
+	}
+
+	std::ostringstream ss;
+	ss << "SELECT " << (columns.empty() ? "*" : columns) << " FROM " << table;
+	if (!where.empty())
+		ss << " WHERE " << where;
+	mysqlx::SqlResult result;
+	if (db.TrySelectOnReplica(ss.str(), result))
+	{
+		func(std::move(result));
+		return;
+	}
+	// replica unavailable, the primary can always serve the read
+	Select(table, columns, where, func);
+}
+
 void MySqlMgr::Update(const std::string& table, const std::string& setClause, const std::string& where, std::function<void(mysqlx::SqlResult&&)> func)
 {
 	mysqlx::SqlResult result;
@@ -226,10 +405,12 @@ void MySqlMgr::Update(const std::string& table, const std::string& setClause, co
 	catch (const mysqlx::Error& e)
 	{
 		std::cout << "MYSQL ERROR: " << e << std::endl;
+		DbRequestQueue::ReportDbError();
 	}
 	catch (const std::exception& e)
 	{
 		std::cout << "STD ERROR: " << e.what() << std::endl;
+		DbRequestQueue::ReportDbError();
 	}
 	func(std::move(result));
 }
@@ -255,10 +436,12 @@ void MySqlMgr::Delete(const std::string& table, const std::string& where, std::f
 	catch (const mysqlx::Error& e)
 	{
 		std::cout << "MYSQL ERROR: " << e << std::endl;
+		DbRequestQueue::ReportDbError();
 	}
 	catch (const std::exception& e)
 	{
 		std::cout << "STD ERROR: " << e.what() << std::endl;
+		DbRequestQueue::ReportDbError();
 	}
 	func(std::move(result));
 }
@@ -284,10 +467,12 @@ void MySqlMgr::Upsert(const std::string& table, const std::string& columns, cons
 	catch (const mysqlx::Error& e)
 	{
 		std::cout << "MYSQL ERROR: " << e << std::endl;
+		DbRequestQueue::ReportDbError();
 	}
 	catch (const std::exception& e)
 	{
 		std::cout << "STD ERROR: " << e.what() << std::endl;
+		DbRequestQueue::ReportDbError();
 	}
 	func(std::move(result));
 }
@@ -9,11 +9,31 @@
 #include <functional>
 #include <sstream>
 #include <vector>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <unordered_map>
+
+struct CPPSERVER_API MySqlEndpoint
+{
+	std::string url;
+	unsigned int port;
+};
 
 class CPPSERVER_API MySqlMgr
 {
+	// read-only connection to a replica, each one has its own lock so reads never wait on the primary
+	struct ReplicaSession
+	{
+		MySqlEndpoint endpoint{};
+		mysqlx::Session* session = nullptr;
+		ReadWriteLock lock;
+		// steady_clock ticks, until then reads skip this replica; checked without the lock so a read never
+		// waits behind another read's connect timeout
+		std::atomic<int64_t> unhealthyUntil{ 0 };
+	};
+
 	static MySqlMgr& Instance();
-	static int DebugDatabaseInit();
 
 	//std::unique_ptr<mysqlx::Session> _sqlSession;
 	mysqlx::Session* _sqlSession;
@@ -24,13 +44,30 @@ class CPPSERVER_API MySqlMgr
 	unsigned int _port;
 	ReadWriteLock _lock;
 
+	std::vector<std::unique_ptr<ReplicaSession>> _replicas{};
+	std::atomic<size_t> _replicaCursor{ 0 };
+	// player id -> until when their reads must go to the primary
+	std::unordered_map<int, std::chrono::steady_clock::time_point> _primaryAffinityUntil{};
+	std::mutex _affinityMutex;
+
 	void EnsureConnection(bool forceUpdate = false);
+	mysqlx::Session* CreateSession(const std::string& url, unsigned int port);
+	bool HasPrimaryAffinity(int playerId);
+	// false if every replica is cooling down after a failure or this one failed now, the read then goes to the primary
+	bool TrySelectOnReplica(const std::string& sqlCmd, mysqlx::SqlResult& result);
+	void MarkReplicaUnhealthy(ReplicaSession& replica);
 
 	MySqlMgr();
 	MySqlMgr(const MySqlMgr&) = delete;
 	MySqlMgr& operator=(const MySqlMgr&) = delete;
 
 public:
+	enum class ReadConsistency : uint8_t
+	{
+		Primary = 0,
+		// may be served by a replica and lag behind the primary by a little
+		AllowStale = 1,
+	};
 
 	~MySqlMgr() = default;
 
@@ -40,16 +77,32 @@ public:
 	// "root"
 	// "1QAZ2wsx"
 	// "wkr_server_schema"
+	// replicas share the user, password and schema of the primary
 	static int Init(
 		const std::string& url,
 		const unsigned int port,
 		const std::string& user,
 		const std::string& pass,
-		const std::string& schema);
+		const std::string& schema,
+		const std::vector<MySqlEndpoint>& readReplicas = {});
+
+	// SELECT 1 on the primary
+	static int Ping();
+	// opens all replica sessions in parallel
+	static void WarmReplicas();
 
 	static void DoSql(const std::string& sqlCmd, std::function<void(mysqlx::SqlResult&&)> func);
 	static void DoSql(const std::vector<std::string>& sqlCmds, std::function<void(std::vector<mysqlx::SqlResult>&&)> func, bool enableLastIdReplace);
+	// runs body between startTransaction and commit on the primary, rolls back if it throws
+	// returns true when the commit went through
+	static bool DoTransaction(std::function<void(mysqlx::Session&)> body);
 	static void Select(const std::string& table, const std::string& columns, const std::string& where, std::function<void(mysqlx::SqlResult&&)> func);
+	// AllowStale reads go to the replicas round-robin, unless affinityPlayerId wrote recently (read-your-writes)
+	// a replica that just failed is skipped for MYSQL_REPLICA_RETRY_MS, with none left the primary serves the read
+	static void Select(const std::string& table, const std::string& columns, const std::string& where, std::function<void(mysqlx::SqlResult&&)> func,
+		ReadConsistency consistency, int affinityPlayerId = -1);
+	// pins the player's reads to the primary for MYSQL_REPLICA_AFFINITY_MS
+	static void MarkPlayerWrite(int playerId);
 	static void Update(const std::string& table, const std::string& setClause, const std::string& where, std::function<void(mysqlx::SqlResult&&)> func);
 	static void Delete(const std::string& table, const std::string& where, std::function<void(mysqlx::SqlResult&&)> func);
 	static void Upsert(const std::string& table, const std::string& columns, const std::string& values, const std::string& onDuplicateClause, std::function<void(mysqlx::SqlResult&&)> func);
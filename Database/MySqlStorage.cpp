@@ -0,0 +1,186 @@
+#include "pch.h"
+#include "MySqlStorage.h"
+#include "Const.h"
+
+MySqlStorage::MySqlStorage(
+	const std::string& url,
+	const unsigned int port,
+	const std::string& user,
+	const std::string& pass,
+	const std::string& schema,
+	const std::vector<MySqlEndpoint>& readReplicas)
+	: _url(url), _port(port), _user(user), _pass(pass), _schema(schema), _readReplicas(readReplicas)
+{
+}
+
+std::string MySqlStorage::EscapeSqlString(const std::string& input)
+{
+	std::string output;
+	output.reserve(input.size() * 2);
+	for (char c : input)
+	{
+		switch (c)
+		{
+		case '\'': output += "''"; break;
+		case '\\': output += "\\\\"; break;
+		case '"': output += "\\\""; break;
+		case '\0': break;
+		default: output += c; break;
+		}
+	}
+	return output;
+}
+
+int MySqlStorage::Init()
+{
+	return MySqlMgr::Init(_url, _port, _user, _pass, _schema, _readReplicas);
+}
+
+RpcError MySqlStorage::CreateUser(const std::string& name, const std::string& passwordHash, Language lang, int startChips, PlayerInfo& outInfo)
+{
+	std::vector<std::string> insertCommand = std::vector<std::string>();
+	insertCommand.emplace_back(std::format(CREATE_USER_ACCOUNT_SQL_CMD,
+		EscapeSqlString(name), EscapeSqlString(passwordHash), std::to_string((int)lang)));
+	insertCommand.emplace_back(std::format(CREATE_USER_ASSET_SQL_CMD, std::to_string(startChips)));
+
+	int newId = -1;
+	MySqlMgr::DoSql(insertCommand, [&newId](std::vector<mysqlx::SqlResult>&& resultList)
+		{
+			if (!resultList.empty())
+				newId = static_cast<int>(resultList[0].getAutoIncrementValue());
+		}, true);
+	if (newId < 0)
+		return RpcError::REGISTER_FAILED;
+
+	// the new row may not have reached the replicas yet
+	MySqlMgr::MarkPlayerWrite(newId);
+	return LoadUserInfo(newId, outInfo) ? RpcError::SUCCESS : RpcError::REGISTER_FAILED;
+}
+
+bool MySqlStorage::LoadPasswordHash(int id, std::string& outHash)
+{
+	bool found = false;
+	MySqlMgr::Select("`wkr_server_schema`.`user`", "pswd", "`_id`=" + std::to_string(id), [&found, &outHash](mysqlx::SqlResult&& result)
+		{
+			if (!result.hasData()) return;
+			auto row = result.fetchOne();
+			if (row.isNull()) return;
+			outHash = row.get(0).get<std::string>();
+			found = true;
+		}, MySqlMgr::ReadConsistency::AllowStale, id);
+	return found;
+}
+
+bool MySqlStorage::WritePasswordHash(int id, const std::string& passwordHash)
+{
+	MySqlMgr::MarkPlayerWrite(id);
+	std::string sqlCmd = std::format("UPDATE wkr_server_schema.user SET pswd='{}' WHERE _id={};",
+		EscapeSqlString(passwordHash), std::to_string(id));
+	bool success = false;
+	MySqlMgr::DoSql(sqlCmd, [&success](mysqlx::SqlResult&& res) { success = res.getAffectedItemsCount() > 0; });
+	return success;
+}
+
+bool MySqlStorage::LoadUserInfo(int id, PlayerInfo& outInfo)
+{
+	bool found = false;
+	MySqlMgr::Select("`wkr_server_schema`.`v_user_info_with_asset`", "*", "`_id`=" + std::to_string(id), [&found, &outInfo](mysqlx::SqlResult&& result)
+		{
+			if (!result.hasData()) return;
+			auto row = result.fetchOne();
+			if (row.isNull()) return;
+			outInfo = PlayerInfo(row);
+			found = true;
+		}, MySqlMgr::ReadConsistency::AllowStale, id);
+	return found;
+}
+
+bool MySqlStorage::WriteUserInfo(const PlayerInfo& info)
+{
+	MySqlMgr::MarkPlayerWrite(info.GetID());
+	std::string sqlCmd = std::format("UPDATE wkr_server_schema.user SET _name='{}',lang={} WHERE _id={};",
+		EscapeSqlString(info.GetName()), std::to_string((int)info.GetLanguage()), std::to_string(info.GetID()));
+	bool success = false;
+	MySqlMgr::DoSql(sqlCmd, [&success](mysqlx::SqlResult&& res) { success = res.getAffectedItemsCount() > 0; });
+	return success;
+}
+
+bool MySqlStorage::LoadUserChips(int id, int& outChips)
+{
+	bool found = false;
+	MySqlMgr::Select("wkr_server_schema.user_asset", "chip", "_id=" + std::to_string(id), [&found, &outChips](mysqlx::SqlResult&& result)
+		{
+			if (!result.hasData()) return;
+			auto row = result.fetchOne();
+			if (row.isNull()) return;
+			outChips = static_cast<int>(row.get(0));
+			found = true;
+		}, MySqlMgr::ReadConsistency::AllowStale, id);
+	return found;
+}
+
+bool MySqlStorage::WriteUserChips(int id, int chips)
+{
+	MySqlMgr::MarkPlayerWrite(id);
+	std::string sqlCmd = std::format("UPDATE wkr_server_schema.user_asset SET chip={} WHERE _id={};",
+		std::to_string(chips), std::to_string(id));
+	bool success = false;
+	MySqlMgr::DoSql(sqlCmd, [&success](mysqlx::SqlResult&& res) { success = res.getAffectedItemsCount() > 0; });
+	return success;
+}
+
+std::string MySqlStorage::AddChipsSql(int id, int delta)
+{
+	if (delta < 0)
+	{
+		return std::format(
+			"UPDATE wkr_server_schema.user_asset SET chip = chip + {} WHERE _id = {} AND chip >= {};",
+			delta, id, -delta);
+	}
+	return std::format(
+		"UPDATE wkr_server_schema.user_asset SET chip = chip + {} WHERE _id = {};",
+		delta, id);
+}
+
+bool MySqlStorage::AddChips(int id, int delta)
+{
+	MySqlMgr::MarkPlayerWrite(id);
+	bool success = false;
+	MySqlMgr::DoSql(AddChipsSql(id, delta), [&success](mysqlx::SqlResult&& res) { success = res.getAffectedItemsCount() > 0; });
+	return success;
+}
+
+bool MySqlStorage::SettleChips(const std::vector<std::vector<ChipDelta>>& settlements, std::vector<bool>& outApplied)
+{
+	outApplied.assign(settlements.size(), false);
+	std::vector<bool> applied(settlements.size(), false);
+	bool committed = MySqlMgr::DoTransaction([&settlements, &applied](mysqlx::Session& session)
+		{
+			for (size_t i = 0; i < settlements.size(); i++)
+			{
+				auto savepoint = session.setSavepoint();
+				bool ok = true;
+				for (const auto& d : settlements[i])
+				{
+					if (session.sql(AddChipsSql(d.playerId, d.delta)).execute().getAffectedItemsCount() == 0)
+					{
+						ok = false;
+						break;
+					}
+				}
+				if (ok)
+					session.releaseSavepoint(savepoint);
+				else
+					session.rollbackTo(savepoint);
+				applied[i] = ok;
+			}
+		});
+	if (!committed)
+		return false;
+
+	for (const auto& settlement : settlements)
+		for (const auto& d : settlement)
+			MySqlMgr::MarkPlayerWrite(d.playerId);
+	outApplied = std::move(applied);
+	return true;
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include "StorageBackend.h"
+
+// StorageBackend on top of MySqlMgr, owns all the raw MySQL statements
+class CPPSERVER_API MySqlStorage : public StorageBackend
+{
+	std::string _url;
+	unsigned int _port;
+	std::string _user;
+	std::string _pass;
+	std::string _schema;
+	std::vector<MySqlEndpoint> _readReplicas;
+
+	static std::string EscapeSqlString(const std::string& input);
+	static std::string AddChipsSql(int id, int delta);
+
+public:
+	MySqlStorage(
+		const std::string& url,
+		const unsigned int port,
+		const std::string& user,
+		const std::string& pass,
+		const std::string& schema,
+		const std::vector<MySqlEndpoint>& readReplicas = {});
+
+	int Init() override;
+	int Probe() override { return MySqlMgr::Ping(); }
+	void Warmup() override { MySqlMgr::WarmReplicas(); }
+	const char* GetName() const override { return "MySQL"; }
+
+	RpcError CreateUser(const std::string& name, const std::string& passwordHash, Language lang, int startChips, PlayerInfo& outInfo) override;
+	bool LoadPasswordHash(int id, std::string& outHash) override;
+	bool WritePasswordHash(int id, const std::string& passwordHash) override;
+
+	bool LoadUserInfo(int id, PlayerInfo& outInfo) override;
+	bool WriteUserInfo(const PlayerInfo& info) override;
+
+	bool LoadUserChips(int id, int& outChips) override;
+	bool WriteUserChips(int id, int chips) override;
+	bool AddChips(int id, int delta) override;
+	bool SettleChips(const std::vector<std::vector<ChipDelta>>& settlements, std::vector<bool>& outApplied) override;
+};
@@ -0,0 +1,482 @@
+#include "pch.h"
+#include "PostgreSqlMgr.h"
+#include "DbRequestQueue.h"
+
+#ifdef ENABLE_POSTGRESQL_STORAGE
+#include <future>
+#include <sstream>
+
+PgResult::PgResult(PGresult* res) : _res(res) {}
+PgResult::PgResult(PgResult&& other) noexcept : _res(other._res) { other._res = nullptr; }
+PgResult& PgResult::operator=(PgResult&& other) noexcept
+{
+	if (this != &other)
+	{
+		if (_res) PQclear(_res);
+		_res = other._res;
+		other._res = nullptr;
+	}
+	return *this;
+}
+PgResult::~PgResult()
+{
+	if (_res) PQclear(_res);
+}
+bool PgResult::Ok() const
+{
+	if (!_res) return false;
+	auto status = PQresultStatus(_res);
+	return status == PGRES_COMMAND_OK || status == PGRES_TUPLES_OK || status == PGRES_SINGLE_TUPLE;
+}
+int PgResult::Rows() const { return _res ? PQntuples(_res) : 0; }
+int PgResult::Cols() const { return _res ? PQnfields(_res) : 0; }
+bool PgResult::IsNull(int row, int col) const
+{
+	if (row >= Rows() || col >= Cols()) return true;
+	return PQgetisnull(_res, row, col) != 0;
+}
+std::string PgResult::GetString(int row, int col) const
+{
+	if (IsNull(row, col)) return "";
+	return std::string(PQgetvalue(_res, row, col), PQgetlength(_res, row, col));
+}
+int PgResult::GetInt(int row, int col) const
+{
+	if (IsNull(row, col)) return 0;
+	return std::atoi(PQgetvalue(_res, row, col));
+}
+long long PgResult::AffectedRows() const
+{
+	if (!_res) return 0;
+	const char* tuples = PQcmdTuples(_res);
+	return (tuples && *tuples) ? std::atoll(tuples) : 0;
+}
+std::string PgResult::Error() const
+{
+	return _res ? PQresultErrorMessage(_res) : "no result";
+}
+
+PostgreSqlMgr::PostgreSqlMgr() = default;
+PostgreSqlMgr::~PostgreSqlMgr()
+{
+	Shutdown();
+}
+
+PostgreSqlMgr& PostgreSqlMgr::Instance()
+{
+	static PostgreSqlMgr instance;
+	return instance;
+}
+
+int PostgreSqlMgr::Init(const std::string& connInfo)
+{
+	auto& db = Instance();
+	{
+		std::unique_lock<std::mutex> lock(db._mutex);
+		if (db._pipelineThread.joinable())
+			return EXIT_SUCCESS;
+		db._connInfo = connInfo;
+		db._isDead = false;
+	}
+	db._pipelineThread = std::thread(&PostgreSqlMgr::PipelineJob, &db);
+	return EXIT_SUCCESS;
+}
+
+int PostgreSqlMgr::Ping()
+{
+	bool ok = false;
+	DoSql("SELECT 1;", [&ok](PgResult&& res) { ok = res.Ok(); });
+	if (!ok)
+	{
+		std::cout << "POSTGRESQL ERROR: init check failed" << std::endl;
+		return EXIT_FAILURE;
+	}
+	std::cout << "PostgreSql Module Init Check Passed!" << std::endl;
+	return EXIT_SUCCESS;
+}
+
+void PostgreSqlMgr::Shutdown()
+{
+	auto& db = Instance();
+	{
+		std::unique_lock<std::mutex> lock(db._mutex);
+		db._isDead = true;
+	}
+	db._cond.notify_all();
+	if (db._pipelineThread.joinable())
+		db._pipelineThread.join();
+	db.DropConnection();
+}
+
+bool PostgreSqlMgr::EnsureConnection()
+{
+	if (_conn && PQstatus(_conn) == CONNECTION_OK)
+		return true;
+	DropConnection();
+
+	_conn = PQconnectdb(_connInfo.c_str());
+	if (PQstatus(_conn) != CONNECTION_OK)
+	{
+		std::cout << "POSTGRESQL ERROR: " << PQerrorMessage(_conn) << std::endl;
+		DropConnection();
+		return false;
+	}
+
+	// prepared statements live on the connection, so bring them back before entering pipeline mode
+	std::unordered_map<std::string, std::string> prepared{};
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		prepared = _preparedSql;
+	}
+	for (const auto& [name, sql] : prepared)
+	{
+		PgResult res{ PQprepare(_conn, name.c_str(), sql.c_str(), 0, nullptr) };
+		if (!res.Ok())
+			std::cout << "POSTGRESQL ERROR: re-prepare " << name << " failed: " << res.Error() << std::endl;
+	}
+
+	if (PQenterPipelineMode(_conn) != 1 || PQsetnonblocking(_conn, 1) != 0)
+	{
+		std::cout << "POSTGRESQL ERROR: cannot enter pipeline mode: " << PQerrorMessage(_conn) << std::endl;
+		DropConnection();
+		return false;
+	}
+	return true;
+}
+
+void PostgreSqlMgr::DropConnection()
+{
+	if (_conn)
+		PQfinish(_conn);
+	_conn = nullptr;
+}
+
+void PostgreSqlMgr::PipelineJob()
+{
+	while (true)
+	{
+		std::vector<PgRequest> batch{};
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_cond.wait(lock, [this]() { return _isDead || !_pending.empty(); });
+			if (_isDead && _pending.empty()) return;
+			while (!_pending.empty() && batch.size() < PG_PIPELINE_MAX_BATCH)
+			{
+				batch.push_back(std::move(_pending.front()));
+				_pending.pop_front();
+			}
+		}
+		RunBatch(batch);
+	}
+}
+
+void PostgreSqlMgr::RunBatch(std::vector<PgRequest>& batch)
+{
+	std::vector<std::vector<PgResult>> results(batch.size());
+	if (EnsureConnection())
+	{
+		size_t sent = 0;
+		while (sent < batch.size() && SendRequest(batch[sent]))
+			sent++;
+
+		// the requests before the failed one are complete with their sync points and still get their results
+		bool connOk = Flush();
+		for (size_t i = 0; i < sent && connOk; i++)
+			results[i] = ReadRequest(batch[i], connOk);
+
+		// the failed one left statements in the pipeline without a sync, whatever is read next on this connection
+		// would belong to them, so the connection goes and the rest of the batch fails. dropping it before the
+		// sync also rolls the half sent request back.
+		if (sent < batch.size() || !connOk || PQstatus(_conn) != CONNECTION_OK)
+		{
+			std::cout << "POSTGRESQL ERROR: pipeline broken after " << sent << "/" << batch.size() << " requests: " << PQerrorMessage(_conn) << std::endl;
+			DropConnection();
+		}
+	}
+
+	for (size_t i = 0; i < batch.size(); i++)
+	{
+		if (batch[i].onComplete)
+			batch[i].onComplete(std::move(results[i]));
+	}
+}
+
+bool PostgreSqlMgr::SendRequest(const PgRequest& req)
+{
+	for (const auto& stmt : req.statements)
+	{
+#ifdef ENABLE_SQL_DEBUG
+		std::cout << "SQL DEBUG MSG: Pipeline - " << stmt.sql << std::endl;
+#endif
+		std::vector<const char*> values{};
+		values.reserve(stmt.params.size());
+		for (const auto& p : stmt.params)
+			values.push_back(p.c_str());
+
+		int ok = 0;
+		if (req.kind == RequestKind::Prepare)
+			ok = PQsendPrepare(_conn, req.prepareName.c_str(), stmt.sql.c_str(), 0, nullptr);
+		else if (stmt.prepared)
+			ok = PQsendQueryPrepared(_conn, stmt.sql.c_str(), (int)values.size(), values.data(), nullptr, nullptr, 0);
+		else
+			ok = PQsendQueryParams(_conn, stmt.sql.c_str(), (int)values.size(), nullptr, values.data(), nullptr, nullptr, 0);
+		if (ok != 1)
+		{
+			std::cout << "POSTGRESQL ERROR: " << PQerrorMessage(_conn) << std::endl;
+			return false;
+		}
+	}
+	return PQpipelineSync(_conn) == 1;
+}
+
+bool PostgreSqlMgr::Flush()
+{
+	while (true)
+	{
+		int ret = PQflush(_conn);
+		if (ret == 0) return true;
+		if (ret < 0) return false;
+		// the server may be blocked writing results back to us, drain them so it can keep reading
+		if (PQconsumeInput(_conn) != 1) return false;
+		std::this_thread::yield();
+	}
+}
+
+std::vector<PgResult> PostgreSqlMgr::ReadRequest(const PgRequest& req, bool& connOk)
+{
+	std::vector<PgResult> results{};
+	bool failed = false;
+	for (size_t i = 0; i < req.statements.size(); i++)
+	{
+		PGresult* res = PQgetResult(_conn);
+		if (res == nullptr)
+		{
+			connOk = false;
+			return {};
+		}
+		PgResult pgRes{ res };
+		if (!pgRes.Ok())
+		{
+			failed = true;
+			if (PQresultStatus(res) != PGRES_PIPELINE_ABORTED)
+				std::cout << "POSTGRESQL ERROR: " << pgRes.Error() << std::endl;
+		}
+		results.push_back(std::move(pgRes));
+		// every statement's results are terminated by a null result
+		while (PGresult* extra = PQgetResult(_conn))
+			PQclear(extra);
+	}
+
+	PGresult* sync = PQgetResult(_conn);
+	if (sync == nullptr || PQresultStatus(sync) != PGRES_PIPELINE_SYNC)
+		connOk = false;
+	if (sync)
+		PQclear(sync);
+
+	// the implicit transaction was rolled back, report it the same way MySqlMgr does
+	if (failed)
+		results.clear();
+	return results;
+}
+
+void PostgreSqlMgr::Enqueue(PgRequest&& req)
+{
+	auto& db = Instance();
+	{
+		std::unique_lock<std::mutex> lock(db._mutex);
+		if (!db._isDead && db._pipelineThread.joinable())
+		{
+			db._pending.push_back(std::move(req));
+			db._cond.notify_one();
+			return;
+		}
+	}
+	std::cout << "POSTGRESQL ERROR: PostgreSqlMgr is not running" << std::endl;
+	if (req.onComplete)
+		req.onComplete({});
+}
+
+std::vector<PgResult> PostgreSqlMgr::EnqueueAndWait(PgRequest&& req)
+{
+	assert(std::this_thread::get_id() != Instance()._pipelineThread.get_id());
+	auto done = std::make_shared<std::promise<std::vector<PgResult>>>();
+	auto fut = done->get_future();
+	req.onComplete = [done](std::vector<PgResult>&& res) { done->set_value(std::move(res)); };
+	Enqueue(std::move(req));
+	auto res = fut.get();
+	// the pipeline thread runs no db request of its own, a failure is charged to the one waiting for it
+	if (res.empty())
+		DbRequestQueue::ReportDbError();
+	return res;
+}
+
+bool PostgreSqlMgr::Prepare(const std::string& name, const std::string& sql)
+{
+	PgRequest req{};
+	req.kind = RequestKind::Prepare;
+	req.prepareName = name;
+	req.statements.push_back(PgStatement{ sql, {}, false });
+	if (EnqueueAndWait(std::move(req)).empty())
+		return false;
+
+	// only remember it once the server accepted it, otherwise a reconnect would prepare it twice
+	auto& db = Instance();
+	std::unique_lock<std::mutex> lock(db._mutex);
+	db._preparedSql[name] = sql;
+	return true;
+}
+
+void PostgreSqlMgr::DoSqlAsync(const std::string& sqlCmd, const std::vector<std::string>& params, std::function<void(PgResult&&)> func)
+{
+	PgRequest req{};
+	req.statements.push_back(PgStatement{ sqlCmd, params, false });
+	req.onComplete = [func](std::vector<PgResult>&& res)
+		{
+			if (func) func(res.empty() ? PgResult() : std::move(res[0]));
+		};
+	Enqueue(std::move(req));
+}
+
+void PostgreSqlMgr::DoPreparedAsync(const std::string& name, const std::vector<std::string>& params, std::function<void(PgResult&&)> func)
+{
+	PgRequest req{};
+	req.statements.push_back(PgStatement{ name, params, true });
+	req.onComplete = [func](std::vector<PgResult>&& res)
+		{
+			if (func) func(res.empty() ? PgResult() : std::move(res[0]));
+		};
+	Enqueue(std::move(req));
+}
+
+void PostgreSqlMgr::DoTransactionAsync(std::vector<PgStatement> statements, std::function<void(std::vector<PgResult>&&)> func)
+{
+	PgRequest req{};
+	req.statements = std::move(statements);
+	req.onComplete = std::move(func);
+	Enqueue(std::move(req));
+}
+
+void PostgreSqlMgr::DoSql(const std::string& sqlCmd, std::function<void(PgResult&&)> func)
+{
+	PgRequest req{};
+	req.statements.push_back(PgStatement{ sqlCmd, {}, false });
+	auto res = EnqueueAndWait(std::move(req));
+	func(res.empty() ? PgResult() : std::move(res[0]));
+}
+
+void PostgreSqlMgr::DoSql(const std::vector<std::string>& sqlCmds, std::function<void(std::vector<PgResult>&&)> func)
+{
+	PgRequest req{};
+	for (const auto& sqlCmd : sqlCmds)
+		req.statements.push_back(PgStatement{ sqlCmd, {}, false });
+	func(EnqueueAndWait(std::move(req)));
+}
+
+void PostgreSqlMgr::DoPrepared(const std::string& name, const std::vector<std::string>& params, std::function<void(PgResult&&)> func)
+{
+	PgRequest req{};
+	req.statements.push_back(PgStatement{ name, params, true });
+	auto res = EnqueueAndWait(std::move(req));
+	func(res.empty() ? PgResult() : std::move(res[0]));
+}
+
+void PostgreSqlMgr::DoTransaction(std::vector<PgStatement> statements, std::function<void(std::vector<PgResult>&&)> func)
+{
+	PgRequest req{};
+	req.statements = std::move(statements);
+	func(EnqueueAndWait(std::move(req)));
+}
+
+void PostgreSqlMgr::Select(const std::string& table, const std::string& columns, const std::string& where, std::function<void(PgResult&&)> func)
+{
+	std::ostringstream ss;
+	ss << "SELECT " << (columns.empty() ? "*" : columns) << " FROM " << table;
+	if (!where.empty())
+		ss << " WHERE " << where;
+	DoSql(ss.str(), func);
+}
+
+void PostgreSqlMgr::Update(const std::string& table, const std::string& setClause, const std::string& where, std::function<void(PgResult&&)> func)
+{
+	std::ostringstream ss;
+	ss << "UPDATE " << table << " SET " << setClause;
+	if (!where.empty())
+		ss << " WHERE " << where;
+	DoSql(ss.str(), func);
+}
+
+void PostgreSqlMgr::Delete(const std::string& table, const std::string& where, std::function<void(PgResult&&)> func)
+{
+	std::ostringstream ss;
+	ss << "DELETE FROM " << table;
+	if (!where.empty())
+		ss << " WHERE " << where;
+	DoSql(ss.str(), func);
+}
+
+void PostgreSqlMgr::Upsert(const std::string& table, const std::string& columns, const std::string& values, const std::string& onConflictClause, std::function<void(PgResult&&)> func)
+{
+	std::ostringstream ss;
+	ss << "INSERT INTO " << table << " (" << columns << ") VALUES (" << values << ")";
+	if (!onConflictClause.empty())
+		ss << " ON CONFLICT " << onConflictClause;
+	DoSql(ss.str(), func);
+}
+
+int PostgreSqlMgr::RunPipelineCheck(const std::string& connInfo)
+{
+	if (Init(connInfo) != EXIT_SUCCESS || Ping() != EXIT_SUCCESS)
+		return 1;
+	int failures = 0;
+	auto expect = [&failures](bool ok, const std::string& what)
+		{
+			std::cout << (ok ? "  ok    " : "  FAIL  ") << what << std::endl;
+			if (!ok) failures++;
+		};
+
+	// a burst of async requests goes out as one or a few batches, every 10th fails on purpose
+	constexpr int BURST = 200;
+	std::vector<int> answers(BURST, -1);
+	for (int i = 0; i < BURST; i++)
+	{
+		std::string sql = i % 10 == 9 ? "SELECT 1 / ($1::integer - $1::integer);" : "SELECT $1::integer;";
+		DoSqlAsync(sql, { std::to_string(i) }, [&answers, i](PgResult&& res) { answers[i] = res.Ok() ? res.GetInt(0, 0) : -2; });
+	}
+	// callbacks run in queue order on the pipeline thread, once this one returns the burst is done
+	DoSql("SELECT 1;", [](PgResult&&) {});
+	bool burstOk = true;
+	for (int i = 0; i < BURST; i++)
+		burstOk = burstOk && answers[i] == (i % 10 == 9 ? -2 : i);
+	expect(burstOk, "burst of " + std::to_string(BURST) + " requests, each failure stays in its own request");
+
+	// a failing statement rolls back the statements before it in the same request
+	DoSql("CREATE TABLE IF NOT EXISTS pg_pipeline_check (v INTEGER);", [](PgResult&&) {});
+	DoSql("TRUNCATE pg_pipeline_check;", [](PgResult&&) {});
+	bool rolledBack = false;
+	DoTransaction({ PgStatement{ "INSERT INTO pg_pipeline_check (v) VALUES (1);" }, PgStatement{ "SELECT 1 / 0;" } },
+		[&rolledBack](std::vector<PgResult>&& res) { rolledBack = res.empty(); });
+	int rows = -1;
+	DoSql("SELECT COUNT(*) FROM pg_pipeline_check;", [&rows](PgResult&& res) { rows = res.Ok() ? res.GetInt(0, 0) : -1; });
+	expect(rolledBack && rows == 0, "failed transaction reported and rolled back");
+
+	// the server drops the connection in the middle of a batch, the rest of that batch fails and the next one reconnects
+	std::vector<int> afterKill(3, -1);
+	DoSqlAsync("SELECT pg_terminate_backend(pg_backend_pid());", {}, [](PgResult&&) {});
+	for (int i = 0; i < 3; i++)
+		DoSqlAsync("SELECT $1::integer;", { std::to_string(i) }, [&afterKill, i](PgResult&& res) { afterKill[i] = res.Ok() ? res.GetInt(0, 0) : -2; });
+	DoSql("SELECT 1;", [](PgResult&&) {});
+	int reconnected = -1;
+	DoSql("SELECT 42;", [&reconnected](PgResult&& res) { reconnected = res.Ok() ? res.GetInt(0, 0) : -1; });
+	// whether they shared the killed batch or got a fresh connection, none of them may see another request's result
+	bool ownOrFailed = true;
+	for (int i = 0; i < 3; i++)
+		ownOrFailed = ownOrFailed && (afterKill[i] == i || afterKill[i] == -2);
+	expect(ownOrFailed, "requests behind a killed connection fail or get their own results");
+	expect(reconnected == 42, "next request reconnects");
+
+	DoSql("DROP TABLE IF EXISTS pg_pipeline_check;", [](PgResult&&) {});
+	Shutdown();
+	std::cout << "[PG PIPELINE CHECK] " << (failures == 0 ? "passed" : std::to_string(failures) + " failed") << std::endl;
+	return failures == 0 ? 0 : 1;
+}
+#endif
@@ -0,0 +1,132 @@
+#pragma once
+#include "CppServerAPI.h"
+#include "Const.h"
+
+#ifdef ENABLE_POSTGRESQL_STORAGE
+#include "postgresql/libpq-fe.h"
+#include <memory>
+#include <string>
+#include <functional>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// owns one PGresult, handed to sql callbacks
+class CPPSERVER_API PgResult
+{
+	PGresult* _res = nullptr;
+public:
+	PgResult() = default;
+	explicit PgResult(PGresult* res);
+	PgResult(PgResult&& other) noexcept;
+	PgResult& operator=(PgResult&& other) noexcept;
+	PgResult(const PgResult&) = delete;
+	PgResult& operator=(const PgResult&) = delete;
+	~PgResult();
+
+	bool Ok() const;
+	int Rows() const;
+	int Cols() const;
+	bool IsNull(int row, int col) const;
+	std::string GetString(int row, int col) const;
+	int GetInt(int row, int col) const;
+	long long AffectedRows() const;
+	std::string Error() const;
+};
+
+// one statement inside a request, sql is the statement name when prepared is true
+struct CPPSERVER_API PgStatement
+{
+	std::string sql;
+	std::vector<std::string> params{};
+	bool prepared = false;
+};
+
+// PostgreSQL counterpart of MySqlMgr
+// every request goes to a single pipeline thread which keeps the connection in libpq pipeline mode:
+// all requests queued while the previous batch was in flight are sent back to back and only then
+// are the results read, so N independent statements cost one round-trip instead of N.
+// each request is closed by its own sync point, which makes it an implicit transaction:
+// if one statement fails the earlier ones are rolled back and the later ones are skipped.
+class CPPSERVER_API PostgreSqlMgr
+{
+	enum class RequestKind : uint8_t
+	{
+		Execute = 0,
+		Prepare = 1,
+	};
+
+	struct PgRequest
+	{
+		RequestKind kind = RequestKind::Execute;
+		std::string prepareName{};
+		std::vector<PgStatement> statements{};
+		std::function<void(std::vector<PgResult>&&)> onComplete = nullptr;
+	};
+
+	static PostgreSqlMgr& Instance();
+
+	PGconn* _conn = nullptr;
+	std::string _connInfo{};
+	// statement name -> sql, re-prepared after every reconnect
+	std::unordered_map<std::string, std::string> _preparedSql{};
+
+	std::deque<PgRequest> _pending{};
+	std::mutex _mutex;
+	std::condition_variable _cond;
+	std::thread _pipelineThread;
+	bool _isDead = false;
+
+	bool EnsureConnection();
+	void DropConnection();
+	void PipelineJob();
+	void RunBatch(std::vector<PgRequest>& batch);
+	bool SendRequest(const PgRequest& req);
+	bool Flush();
+	std::vector<PgResult> ReadRequest(const PgRequest& req, bool& connOk);
+
+	static void Enqueue(PgRequest&& req);
+	static std::vector<PgResult> EnqueueAndWait(PgRequest&& req);
+
+	PostgreSqlMgr();
+	PostgreSqlMgr(const PostgreSqlMgr&) = delete;
+	PostgreSqlMgr& operator=(const PostgreSqlMgr&) = delete;
+
+public:
+	~PostgreSqlMgr();
+
+	// connInfo is a libpq connection string, for a local instance:
+	// "host=127.0.0.1 port=5432 dbname=wkr_server user=postgres password=1QAZ2wsx"
+	// only starts the pipeline thread, the connection is made by the first request
+	static int Init(const std::string& connInfo);
+	static void Shutdown();
+	// SELECT 1 through the pipeline
+	static int Ping();
+
+	// blocking, the statement stays valid across reconnects
+	static bool Prepare(const std::string& name, const std::string& sql);
+
+	// async, func runs on the pipeline thread
+	static void DoSqlAsync(const std::string& sqlCmd, const std::vector<std::string>& params, std::function<void(PgResult&&)> func);
+	static void DoPreparedAsync(const std::string& name, const std::vector<std::string>& params, std::function<void(PgResult&&)> func);
+	static void DoTransactionAsync(std::vector<PgStatement> statements, std::function<void(std::vector<PgResult>&&)> func);
+
+	// blocking, func runs on the calling thread
+	static void DoSql(const std::string& sqlCmd, std::function<void(PgResult&&)> func);
+	static void DoSql(const std::vector<std::string>& sqlCmds, std::function<void(std::vector<PgResult>&&)> func);
+	static void DoPrepared(const std::string& name, const std::vector<std::string>& params, std::function<void(PgResult&&)> func);
+	static void DoTransaction(std::vector<PgStatement> statements, std::function<void(std::vector<PgResult>&&)> func);
+	static void Select(const std::string& table, const std::string& columns, const std::string& where, std::function<void(PgResult&&)> func);
+	static void Update(const std::string& table, const std::string& setClause, const std::string& where, std::function<void(PgResult&&)> func);
+	static void Delete(const std::string& table, const std::string& where, std::function<void(PgResult&&)> func);
+	// onConflictClause is everything after ON CONFLICT, e.g. "(_id) DO UPDATE SET chip = EXCLUDED.chip"
+	static void Upsert(const std::string& table, const std::string& columns, const std::string& values, const std::string& onConflictClause, std::function<void(PgResult&&)> func);
+
+	// "--pg-check": runs the pipeline against the server in connInfo and checks that every request gets its own
+	// results back, also around a failing statement, a rolled back transaction and a connection the server killed
+	static int RunPipelineCheck(const std::string& connInfo);
+};
+#endif
@@ -0,0 +1,177 @@
+#include "pch.h"
+#include "PostgreSqlStorage.h"
+
+#ifdef ENABLE_POSTGRESQL_STORAGE
+
+PostgreSqlStorage::PostgreSqlStorage(const std::string& connInfo) : _connInfo(connInfo) {}
+
+int PostgreSqlStorage::Init()
+{
+	if (PostgreSqlMgr::Init(_connInfo) != EXIT_SUCCESS)
+		return EXIT_FAILURE;
+
+	std::vector<std::string> schemaCmds{
+		"CREATE SCHEMA IF NOT EXISTS wkr_server_schema;",
+		"CREATE TABLE IF NOT EXISTS wkr_server_schema.\"user\" ("
+		"_id SERIAL PRIMARY KEY,"
+		"_name TEXT NOT NULL,"
+		"pswd TEXT NOT NULL,"
+		"lang SMALLINT NOT NULL DEFAULT 0);",
+		"CREATE TABLE IF NOT EXISTS wkr_server_schema.user_asset ("
+		"_id INTEGER PRIMARY KEY REFERENCES wkr_server_schema.\"user\"(_id),"
+		"chip INTEGER NOT NULL DEFAULT 0);",
+	};
+	bool schemaOk = false;
+	PostgreSqlMgr::DoSql(schemaCmds, [&schemaOk](std::vector<PgResult>&& res) { schemaOk = !res.empty(); });
+	if (!schemaOk)
+		return EXIT_FAILURE;
+
+	bool ok = PostgreSqlMgr::Prepare("create_user",
+		"WITH u AS (INSERT INTO wkr_server_schema.\"user\" (_name, pswd, lang) VALUES ($1, $2, $3) RETURNING _id) "
+		"INSERT INTO wkr_server_schema.user_asset (_id, chip) SELECT _id, $4::integer FROM u RETURNING _id;")
+		&& PostgreSqlMgr::Prepare("select_password",
+			"SELECT pswd FROM wkr_server_schema.\"user\" WHERE _id = $1;")
+		&& PostgreSqlMgr::Prepare("update_password",
+			"UPDATE wkr_server_schema.\"user\" SET pswd = $1 WHERE _id = $2;")
+		&& PostgreSqlMgr::Prepare("select_user",
+			"SELECT u._name, u.lang, u._id, a.chip FROM wkr_server_schema.\"user\" u "
+			"JOIN wkr_server_schema.user_asset a ON a._id = u._id WHERE u._id = $1;")
+		&& PostgreSqlMgr::Prepare("update_user",
+			"UPDATE wkr_server_schema.\"user\" SET _name = $1, lang = $2 WHERE _id = $3;")
+		&& PostgreSqlMgr::Prepare("select_chip",
+			"SELECT chip FROM wkr_server_schema.user_asset WHERE _id = $1;")
+		&& PostgreSqlMgr::Prepare("update_chip",
+			"UPDATE wkr_server_schema.user_asset SET chip = $1 WHERE _id = $2;")
+		&& PostgreSqlMgr::Prepare("add_chip",
+			"UPDATE wkr_server_schema.user_asset SET chip = chip + $1 WHERE _id = $2 AND chip + $1 >= 0;")
+		// one settlement in one statement: lock the rows, then apply every delta only if none of them goes negative
+		&& PostgreSqlMgr::Prepare("settle_chips",
+			"WITH d AS (SELECT id, SUM(delta) AS delta FROM unnest($1::integer[], $2::integer[]) AS t(id, delta) GROUP BY id), "
+			"locked AS (SELECT a._id, a.chip FROM wkr_server_schema.user_asset a WHERE a._id IN (SELECT id FROM d) FOR UPDATE), "
+			"ok AS (SELECT COUNT(*) = (SELECT COUNT(*) FROM d) AS all_ok FROM d JOIN locked l ON l._id = d.id WHERE l.chip + d.delta >= 0) "
+			"UPDATE wkr_server_schema.user_asset a SET chip = a.chip + d.delta FROM d, ok WHERE a._id = d.id AND ok.all_ok RETURNING a._id;");
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+RpcError PostgreSqlStorage::CreateUser(const std::string& name, const std::string& passwordHash, Language lang, int startChips, PlayerInfo& outInfo)
+{
+	int newId = -1;
+	PostgreSqlMgr::DoPrepared("create_user", { name, passwordHash, std::to_string((int)lang), std::to_string(startChips) },
+		[&newId](PgResult&& res)
+		{
+			if (res.Ok() && res.Rows() > 0)
+				newId = res.GetInt(0, 0);
+		});
+	if (newId < 0)
+		return RpcError::REGISTER_FAILED;
+	return LoadUserInfo(newId, outInfo) ? RpcError::SUCCESS : RpcError::REGISTER_FAILED;
+}
+
+bool PostgreSqlStorage::LoadPasswordHash(int id, std::string& outHash)
+{
+	bool found = false;
+	PostgreSqlMgr::DoPrepared("select_password", { std::to_string(id) },
+		[&found, &outHash](PgResult&& res)
+		{
+			if (!res.Ok() || res.Rows() == 0) return;
+			outHash = res.GetString(0, 0);
+			found = true;
+		});
+	return found;
+}
+
+bool PostgreSqlStorage::WritePasswordHash(int id, const std::string& passwordHash)
+{
+	bool ok = false;
+	PostgreSqlMgr::DoPrepared("update_password", { passwordHash, std::to_string(id) },
+		[&ok](PgResult&& res) { ok = res.AffectedRows() > 0; });
+	return ok;
+}
+
+bool PostgreSqlStorage::LoadUserInfo(int id, PlayerInfo& outInfo)
+{
+	bool found = false;
+	PostgreSqlMgr::DoPrepared("select_user", { std::to_string(id) },
+		[&found, &outInfo](PgResult&& res)
+		{
+			if (!res.Ok() || res.Rows() == 0) return;
+			outInfo = PlayerInfo(res.GetInt(0, 2), res.GetString(0, 0), (Language)res.GetInt(0, 1), res.GetInt(0, 3));
+			found = true;
+		});
+	return found;
+}
+
+bool PostgreSqlStorage::WriteUserInfo(const PlayerInfo& info)
+{
+	bool ok = false;
+	PostgreSqlMgr::DoPrepared("update_user",
+		{ info.GetName(), std::to_string((int)info.GetLanguage()), std::to_string(info.GetID()) },
+		[&ok](PgResult&& res) { ok = res.AffectedRows() > 0; });
+	return ok;
+}
+
+bool PostgreSqlStorage::LoadUserChips(int id, int& outChips)
+{
+	bool found = false;
+	PostgreSqlMgr::DoPrepared("select_chip", { std::to_string(id) },
+		[&found, &outChips](PgResult&& res)
+		{
+			if (!res.Ok() || res.Rows() == 0) return;
+			outChips = res.GetInt(0, 0);
+			found = true;
+		});
+	return found;
+}
+
+bool PostgreSqlStorage::WriteUserChips(int id, int chips)
+{
+	bool ok = false;
+	PostgreSqlMgr::DoPrepared("update_chip", { std::to_string(chips), std::to_string(id) },
+		[&ok](PgResult&& res) { ok = res.AffectedRows() > 0; });
+	return ok;
+}
+
+bool PostgreSqlStorage::AddChips(int id, int delta)
+{
+	bool ok = false;
+	PostgreSqlMgr::DoPrepared("add_chip", { std::to_string(delta), std::to_string(id) },
+		[&ok](PgResult&& res) { ok = res.AffectedRows() > 0; });
+	return ok;
+}
+
+bool PostgreSqlStorage::SettleChips(const std::vector<std::vector<ChipDelta>>& settlements, std::vector<bool>& outApplied)
+{
+	outApplied.assign(settlements.size(), false);
+	// a settlement that cannot be applied updates no row instead of failing,
+	// so all of them can share one pipelined request and therefore one commit
+	std::vector<PgStatement> statements{};
+	for (const auto& settlement : settlements)
+	{
+		std::string ids = "{";
+		std::string deltas = "{";
+		for (size_t i = 0; i < settlement.size(); i++)
+		{
+			if (i > 0)
+			{
+				ids += ",";
+				deltas += ",";
+			}
+			ids += std::to_string(settlement[i].playerId);
+			deltas += std::to_string(settlement[i].delta);
+		}
+		statements.push_back(PgStatement{ "settle_chips", { ids + "}", deltas + "}" }, true });
+	}
+
+	bool committed = false;
+	PostgreSqlMgr::DoTransaction(std::move(statements), [&committed, &outApplied](std::vector<PgResult>&& results)
+		{
+			if (results.size() != outApplied.size())
+				return;
+			for (size_t i = 0; i < results.size(); i++)
+				outApplied[i] = results[i].Ok() && results[i].Rows() > 0;
+			committed = true;
+		});
+	return committed;
+}
+
+#endif
@@ -0,0 +1,31 @@
+#pragma once
+#include "StorageBackend.h"
+#include "PostgreSqlMgr.h"
+
+#ifdef ENABLE_POSTGRESQL_STORAGE
+// StorageBackend on top of PostgreSqlMgr, every statement is prepared once at init
+// concurrent logins and asset writes from different threads share one pipelined round-trip
+class CPPSERVER_API PostgreSqlStorage : public StorageBackend
+{
+	std::string _connInfo;
+
+public:
+	PostgreSqlStorage(const std::string& connInfo);
+
+	int Init() override;
+	int Probe() override { return PostgreSqlMgr::Ping(); }
+	const char* GetName() const override { return "PostgreSQL"; }
+
+	RpcError CreateUser(const std::string& name, const std::string& passwordHash, Language lang, int startChips, PlayerInfo& outInfo) override;
+	bool LoadPasswordHash(int id, std::string& outHash) override;
+	bool WritePasswordHash(int id, const std::string& passwordHash) override;
+
+	bool LoadUserInfo(int id, PlayerInfo& outInfo) override;
+	bool WriteUserInfo(const PlayerInfo& info) override;
+
+	bool LoadUserChips(int id, int& outChips) override;
+	bool WriteUserChips(int id, int chips) override;
+	bool AddChips(int id, int delta) override;
+	bool SettleChips(const std::vector<std::vector<ChipDelta>>& settlements, std::vector<bool>& outApplied) override;
+};
+#endif
@@ -0,0 +1,276 @@
+#include "pch.h"
+#include "SqliteStorage.h"
+#include "DbRequestQueue.h"
+
+#ifdef ENABLE_SQLITE_STORAGE
+
+SqliteStorage::SqliteStorage(const std::string& path) : _path(path) {}
+
+SqliteStorage::~SqliteStorage()
+{
+	auto lock = _lock.OnWrite();
+	FinalizeAll();
+	if (_db)
+		sqlite3_close(_db);
+	_db = nullptr;
+}
+
+bool SqliteStorage::Exec(const char* sql)
+{
+#ifdef ENABLE_SQL_DEBUG
+	std::cout << "SQL DEBUG MSG: Exec - " << sql << std::endl;
+#endif
+	char* errMsg = nullptr;
+	if (sqlite3_exec(_db, sql, nullptr, nullptr, &errMsg) != SQLITE_OK)
+	{
+		std::cout << "SQLITE ERROR: " << (errMsg ? errMsg : "unknown") << std::endl;
+		sqlite3_free(errMsg);
+		DbRequestQueue::ReportDbError();
+		return false;
+	}
+	return true;
+}
+
+bool SqliteStorage::Prepare(const char* sql, sqlite3_stmt** stmt)
+{
+	if (sqlite3_prepare_v3(_db, sql, -1, SQLITE_PREPARE_PERSISTENT, stmt, nullptr) != SQLITE_OK)
+	{
+		std::cout << "SQLITE ERROR: " << sqlite3_errmsg(_db) << std::endl;
+		return false;
+	}
+	return true;
+}
+
+void SqliteStorage::FinalizeAll()
+{
+	for (auto stmt : { &_insertUserStmt, &_insertAssetStmt, &_selectPasswordStmt, &_updatePasswordStmt, &_selectUserStmt,
+		&_updateUserStmt, &_selectChipStmt, &_updateChipStmt, &_addChipStmt, &_subChipStmt })
+	{
+		if (*stmt)
+			sqlite3_finalize(*stmt);
+		*stmt = nullptr;
+	}
+}
+
+int SqliteStorage::Init()
+{
+	auto lock = _lock.OnWrite();
+	int flags = SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_FULLMUTEX;
+	if (sqlite3_open_v2(_path.c_str(), &_db, flags, nullptr) != SQLITE_OK)
+	{
+		std::cout << "SQLITE ERROR: cannot open " << _path << ": " << sqlite3_errmsg(_db) << std::endl;
+		sqlite3_close(_db);
+		_db = nullptr;
+		return EXIT_FAILURE;
+	}
+	sqlite3_busy_timeout(_db, 5000);
+
+	// WAL lets the profile lookups read while a chip write is committing,
+	// synchronous=NORMAL is durable across process crashes, which is all we need here
+	bool ok = Exec("PRAGMA journal_mode=WAL;")
+		&& Exec("PRAGMA synchronous=NORMAL;")
+		&& Exec("PRAGMA foreign_keys=ON;")
+		&& Exec(
+			"CREATE TABLE IF NOT EXISTS user ("
+			"_id INTEGER PRIMARY KEY AUTOINCREMENT,"
+			"_name TEXT NOT NULL,"
+			"pswd TEXT NOT NULL,"
+			"lang INTEGER NOT NULL DEFAULT 0);")
+		&& Exec(
+			"CREATE TABLE IF NOT EXISTS user_asset ("
+			"_id INTEGER PRIMARY KEY REFERENCES user(_id),"
+			"chip INTEGER NOT NULL DEFAULT 0);");
+	if (!ok)
+		return EXIT_FAILURE;
+
+	ok = Prepare("INSERT INTO user (_name, pswd, lang) VALUES (?1, ?2, ?3);", &_insertUserStmt)
+		&& Prepare("INSERT INTO user_asset (_id, chip) VALUES (?1, ?2);", &_insertAssetStmt)
+		&& Prepare("SELECT pswd FROM user WHERE _id = ?1;", &_selectPasswordStmt)
+		&& Prepare("UPDATE user SET pswd = ?1 WHERE _id = ?2;", &_updatePasswordStmt)
+		&& Prepare("SELECT u._name, u.lang, u._id, a.chip FROM user u JOIN user_asset a ON a._id = u._id WHERE u._id = ?1;", &_selectUserStmt)
+		&& Prepare("UPDATE user SET _name = ?1, lang = ?2 WHERE _id = ?3;", &_updateUserStmt)
+		&& Prepare("SELECT chip FROM user_asset WHERE _id = ?1;", &_selectChipStmt)
+		&& Prepare("UPDATE user_asset SET chip = ?1 WHERE _id = ?2;", &_updateChipStmt)
+		&& Prepare("UPDATE user_asset SET chip = chip + ?1 WHERE _id = ?2;", &_addChipStmt)
+		&& Prepare("UPDATE user_asset SET chip = chip + ?1 WHERE _id = ?2 AND chip >= -?1;", &_subChipStmt);
+	if (!ok)
+		return EXIT_FAILURE;
+
+	std::cout << "Sqlite Module Init Check Passed! (" << _path << ")" << std::endl;
+	return EXIT_SUCCESS;
+}
+
+int SqliteStorage::Probe()
+{
+	auto lock = _lock.OnWrite();
+	return _db && Exec("SELECT 1;") ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+RpcError SqliteStorage::CreateUser(const std::string& name, const std::string& passwordHash, Language lang, int startChips, PlayerInfo& outInfo)
+{
+	int newId = -1;
+	{
+		auto lock = _lock.OnWrite();
+		if (!Exec("BEGIN IMMEDIATE;"))
+			return RpcError::REGISTER_FAILED;
+
+		sqlite3_bind_text(_insertUserStmt, 1, name.c_str(), -1, SQLITE_TRANSIENT);
+		sqlite3_bind_text(_insertUserStmt, 2, passwordHash.c_str(), -1, SQLITE_TRANSIENT);
+		sqlite3_bind_int(_insertUserStmt, 3, (int)lang);
+		bool ok = sqlite3_step(_insertUserStmt) == SQLITE_DONE;
+		sqlite3_reset(_insertUserStmt);
+		if (ok)
+		{
+			newId = static_cast<int>(sqlite3_last_insert_rowid(_db));
+			sqlite3_bind_int(_insertAssetStmt, 1, newId);
+			sqlite3_bind_int(_insertAssetStmt, 2, startChips);
+			ok = sqlite3_step(_insertAssetStmt) == SQLITE_DONE;
+			sqlite3_reset(_insertAssetStmt);
+		}
+
+		if (!ok)
+		{
+			std::cout << "SQLITE ERROR: " << sqlite3_errmsg(_db) << std::endl;
+			Exec("ROLLBACK;");
+			return RpcError::REGISTER_FAILED;
+		}
+		if (!Exec("COMMIT;"))
+		{
+			Exec("ROLLBACK;");
+			return RpcError::REGISTER_FAILED;
+		}
+	}
+	return LoadUserInfo(newId, outInfo) ? RpcError::SUCCESS : RpcError::REGISTER_FAILED;
+}
+
+bool SqliteStorage::LoadPasswordHash(int id, std::string& outHash)
+{
+	auto lock = _lock.OnWrite();
+	sqlite3_bind_int(_selectPasswordStmt, 1, id);
+	bool found = sqlite3_step(_selectPasswordStmt) == SQLITE_ROW;
+	if (found)
+	{
+		auto hash = reinterpret_cast<const char*>(sqlite3_column_text(_selectPasswordStmt, 0));
+		outHash = hash ? hash : "";
+	}
+	sqlite3_reset(_selectPasswordStmt);
+	return found;
+}
+
+bool SqliteStorage::WritePasswordHash(int id, const std::string& passwordHash)
+{
+	auto lock = _lock.OnWrite();
+	sqlite3_bind_text(_updatePasswordStmt, 1, passwordHash.c_str(), -1, SQLITE_TRANSIENT);
+	sqlite3_bind_int(_updatePasswordStmt, 2, id);
+	bool ok = sqlite3_step(_updatePasswordStmt) == SQLITE_DONE && sqlite3_changes(_db) > 0;
+	sqlite3_reset(_updatePasswordStmt);
+	return ok;
+}
+
+bool SqliteStorage::LoadUserInfo(int id, PlayerInfo& outInfo)
+{
+	auto lock = _lock.OnWrite();
+	sqlite3_bind_int(_selectUserStmt, 1, id);
+	bool found = sqlite3_step(_selectUserStmt) == SQLITE_ROW;
+	if (found)
+	{
+		auto name = reinterpret_cast<const char*>(sqlite3_column_text(_selectUserStmt, 0));
+		outInfo = PlayerInfo(
+			sqlite3_column_int(_selectUserStmt, 2),
+			name ? name : "",
+			(Language)sqlite3_column_int(_selectUserStmt, 1),
+			sqlite3_column_int(_selectUserStmt, 3));
+	}
+	sqlite3_reset(_selectUserStmt);
+	return found;
+}
+
+bool SqliteStorage::WriteUserInfo(const PlayerInfo& info)
+{
+	auto name = info.GetName();
+	auto lock = _lock.OnWrite();
+	sqlite3_bind_text(_updateUserStmt, 1, name.c_str(), -1, SQLITE_TRANSIENT);
+	sqlite3_bind_int(_updateUserStmt, 2, (int)info.GetLanguage());
+	sqlite3_bind_int(_updateUserStmt, 3, info.GetID());
+	bool ok = sqlite3_step(_updateUserStmt) == SQLITE_DONE && sqlite3_changes(_db) > 0;
+	sqlite3_reset(_updateUserStmt);
+	return ok;
+}
+
+bool SqliteStorage::LoadUserChips(int id, int& outChips)
+{
+	auto lock = _lock.OnWrite();
+	sqlite3_bind_int(_selectChipStmt, 1, id);
+	bool found = sqlite3_step(_selectChipStmt) == SQLITE_ROW;
+	if (found)
+		outChips = sqlite3_column_int(_selectChipStmt, 0);
+	sqlite3_reset(_selectChipStmt);
+	return found;
+}
+
+bool SqliteStorage::WriteUserChips(int id, int chips)
+{
+	auto lock = _lock.OnWrite();
+	sqlite3_bind_int(_updateChipStmt, 1, chips);
+	sqlite3_bind_int(_updateChipStmt, 2, id);
+	bool ok = sqlite3_step(_updateChipStmt) == SQLITE_DONE && sqlite3_changes(_db) > 0;
+	sqlite3_reset(_updateChipStmt);
+	return ok;
+}
+
+bool SqliteStorage::StepAddChips(int id, int delta)
+{
+	sqlite3_stmt* stmt = delta < 0 ? _subChipStmt : _addChipStmt;
+	sqlite3_bind_int(stmt, 1, delta);
+	sqlite3_bind_int(stmt, 2, id);
+	bool ok = sqlite3_step(stmt) == SQLITE_DONE && sqlite3_changes(_db) > 0;
+	sqlite3_reset(stmt);
+	return ok;
+}
+
+bool SqliteStorage::AddChips(int id, int delta)
+{
+	auto lock = _lock.OnWrite();
+	return StepAddChips(id, delta);
+}
+
+bool SqliteStorage::SettleChips(const std::vector<std::vector<ChipDelta>>& settlements, std::vector<bool>& outApplied)
+{
+	outApplied.assign(settlements.size(), false);
+	std::vector<bool> applied(settlements.size(), false);
+	auto lock = _lock.OnWrite();
+	if (!Exec("BEGIN IMMEDIATE;"))
+		return false;
+
+	for (size_t i = 0; i < settlements.size(); i++)
+	{
+		if (!Exec("SAVEPOINT settlement;"))
+		{
+			Exec("ROLLBACK;");
+			return false;
+		}
+		bool ok = true;
+		for (const auto& d : settlements[i])
+		{
+			if (!StepAddChips(d.playerId, d.delta))
+			{
+				ok = false;
+				break;
+			}
+		}
+		if (!ok)
+			Exec("ROLLBACK TO settlement;");
+		Exec("RELEASE settlement;");
+		applied[i] = ok;
+	}
+
+	if (!Exec("COMMIT;"))
+	{
+		Exec("ROLLBACK;");
+		return false;
+	}
+	outApplied = std::move(applied);
+	return true;
+}
+
+#endif
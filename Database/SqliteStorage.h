@@ -0,0 +1,54 @@
+#pragma once
+#include "StorageBackend.h"
+#include "Const.h"
+#include "Utils/ReadWriteLock.h"
+
+#ifdef ENABLE_SQLITE_STORAGE
+#include "sqlite/sqlite3.h"
+
+// embedded single-file StorageBackend, runs in WAL mode so readers never block the writer
+// one connection shared by all threads, statements are prepared once and reused
+class CPPSERVER_API SqliteStorage : public StorageBackend
+{
+	std::string _path;
+	sqlite3* _db = nullptr;
+	ReadWriteLock _lock;
+
+	sqlite3_stmt* _insertUserStmt = nullptr;
+	sqlite3_stmt* _insertAssetStmt = nullptr;
+	sqlite3_stmt* _selectPasswordStmt = nullptr;
+	sqlite3_stmt* _updatePasswordStmt = nullptr;
+	sqlite3_stmt* _selectUserStmt = nullptr;
+	sqlite3_stmt* _updateUserStmt = nullptr;
+	sqlite3_stmt* _selectChipStmt = nullptr;
+	sqlite3_stmt* _updateChipStmt = nullptr;
+	sqlite3_stmt* _addChipStmt = nullptr;
+	sqlite3_stmt* _subChipStmt = nullptr;
+
+	bool Exec(const char* sql);
+	// caller holds _lock
+	bool StepAddChips(int id, int delta);
+	bool Prepare(const char* sql, sqlite3_stmt** stmt);
+	void FinalizeAll();
+
+public:
+	SqliteStorage(const std::string& path);
+	~SqliteStorage() override;
+
+	int Init() override;
+	int Probe() override;
+	const char* GetName() const override { return "SQLite"; }
+
+	RpcError CreateUser(const std::string& name, const std::string& passwordHash, Language lang, int startChips, PlayerInfo& outInfo) override;
+	bool LoadPasswordHash(int id, std::string& outHash) override;
+	bool WritePasswordHash(int id, const std::string& passwordHash) override;
+
+	bool LoadUserInfo(int id, PlayerInfo& outInfo) override;
+	bool WriteUserInfo(const PlayerInfo& info) override;
+
+	bool LoadUserChips(int id, int& outChips) override;
+	bool WriteUserChips(int id, int chips) override;
+	bool AddChips(int id, int delta) override;
+	bool SettleChips(const std::vector<std::vector<ChipDelta>>& settlements, std::vector<bool>& outApplied) override;
+};
+#endif
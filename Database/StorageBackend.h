@@ -0,0 +1,47 @@
+#pragma once
+#include "CppServerAPI.h"
+#include "Net/RpcError.h"
+#include "Player/PlayerInfo.h"
+#include <string>
+#include <vector>
+
+struct CPPSERVER_API ChipDelta
+{
+	int playerId;
+	int delta;
+};
+
+// Persistence interface for user, asset and auth data.
+// Game code talks to this through StorageMgr and never sees backend-specific SQL.
+// All methods are blocking and must be thread safe.
+class CPPSERVER_API StorageBackend
+{
+public:
+	virtual ~StorageBackend() = default;
+
+	virtual int Init() = 0;
+	virtual const char* GetName() const = 0;
+	// cheap round-trip to confirm the backend can serve requests, runs right after Init
+	virtual int Probe() = 0;
+	// optional, e.g. open secondary connections; runs in parallel with Probe
+	virtual void Warmup() {}
+
+	// auth, passwords are stored as PasswordHasher strings and never compared inside the database
+	virtual RpcError CreateUser(const std::string& name, const std::string& passwordHash, Language lang, int startChips, PlayerInfo& outInfo) = 0;
+	virtual bool LoadPasswordHash(int id, std::string& outHash) = 0;
+	virtual bool WritePasswordHash(int id, const std::string& passwordHash) = 0;
+
+	// user
+	virtual bool LoadUserInfo(int id, PlayerInfo& outInfo) = 0;
+	virtual bool WriteUserInfo(const PlayerInfo& info) = 0;
+
+	// asset
+	virtual bool LoadUserChips(int id, int& outChips) = 0;
+	virtual bool WriteUserChips(int id, int chips) = 0;
+	// delta > 0 adds chips, delta < 0 removes them and fails if the balance would go negative
+	virtual bool AddChips(int id, int delta) = 0;
+	// applies a group of settlements in one transaction and one commit
+	// each settlement is all or nothing on its own: if one of its debits would go negative only that settlement is rolled back
+	// outApplied[i] tells whether settlements[i] went through, returns false if the transaction itself failed
+	virtual bool SettleChips(const std::vector<std::vector<ChipDelta>>& settlements, std::vector<bool>& outApplied) = 0;
+};
@@ -0,0 +1,58 @@
+#include "pch.h"
+#include "StorageMgr.h"
+#include "DbRequestQueue.h"
+#include "Utils/StartupTimer.h"
+
+StorageMgr::StorageMgr() = default;
+
+StorageMgr& StorageMgr::Instance()
+{
+	static StorageMgr instance;
+	return instance;
+}
+
+int StorageMgr::Init(std::unique_ptr<StorageBackend> backend)
+{
+	return InitAsync(std::move(backend)).get();
+}
+
+std::future<int> StorageMgr::InitAsync(std::unique_ptr<StorageBackend> backend)
+{
+	auto& mgr = Instance();
+	assert(backend != nullptr);
+	mgr._backend = std::move(backend);
+	std::cout << "Storage backend: " << mgr._backend->GetName() << std::endl;
+	DbRequestQueue::Pause();
+
+	return std::async(std::launch::async, [&mgr]()
+		{
+			int ret = EXIT_FAILURE;
+			{
+				StartupTimer::Phase phase("storage init");
+				ret = mgr._backend->Init();
+			}
+			if (ret == EXIT_SUCCESS)
+			{
+				auto warmup = std::async(std::launch::async, [&mgr]()
+					{
+						StartupTimer::Phase phase("storage warmup");
+						mgr._backend->Warmup();
+					});
+				{
+					StartupTimer::Phase phase("storage probe");
+					ret = mgr._backend->Probe();
+				}
+				warmup.wait();
+			}
+			// on failure the queue still resumes, the breaker takes over from here
+			DbRequestQueue::Resume();
+			return ret;
+		});
+}
+
+StorageBackend& StorageMgr::Backend()
+{
+	auto& mgr = Instance();
+	assert(mgr._backend != nullptr && "StorageMgr::Init must be called first");
+	return *mgr._backend;
+}
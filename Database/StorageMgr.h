@@ -0,0 +1,26 @@
+#pragma once
+#include "CppServerAPI.h"
+#include "StorageBackend.h"
+#include <memory>
+#include <future>
+
+class CPPSERVER_API StorageMgr
+{
+	static StorageMgr& Instance();
+
+	std::unique_ptr<StorageBackend> _backend = nullptr;
+
+	StorageMgr();
+	StorageMgr(const StorageMgr&) = delete;
+	StorageMgr& operator=(const StorageMgr&) = delete;
+
+public:
+	~StorageMgr() = default;
+
+	// takes ownership of the backend and initializes it, call once before accepting players
+	static int Init(std::unique_ptr<StorageBackend> backend);
+	// same as Init but returns right away, Init then Probe/Warmup run on a background thread
+	// DbRequestQueue is paused until they finish, so requests submitted meanwhile just wait
+	static std::future<int> InitAsync(std::unique_ptr<StorageBackend> backend);
+	static StorageBackend& Backend();
+};
@@ -4,6 +4,26 @@
 #include "Net/NetPack.h"
 #include <algorithm>
 #include <map>
+#include <istream>
+#include <ostream>
+
+namespace
+{
+	constexpr uint32_t IDLE_STATE_MAGIC = 0x31444C48; // "HLD1"
+
+	template <typename T>
+	void WritePod(std::ostream& out, T val)
+	{
+		out.write(reinterpret_cast<const char*>(&val), sizeof(T));
+	}
+	template <typename T>
+	T ReadPod(std::istream& in)
+	{
+		T val{};
+		in.read(reinterpret_cast<char*>(&val), sizeof(T));
+		return val;
+	}
+}
 
 HoldemPokerGame::HoldemPokerGame()
 	: _rng(std::random_device{}())
@@ -21,6 +41,7 @@ HoldemPokerGame::SetBlindsResult HoldemPokerGame::SetBlinds(int smallBlind, int
 	_smallBlind = smallBlind;
 	_bigBlind = bigBlind;
 	_minBuyin = _bigBlind * 100;
+	_tableVersion++;
 
 	return SetBlindsResult::Success;
 }
@@ -404,10 +425,17 @@ bool HoldemPokerGame::SitDown(int playerId, int seatIdxHint, int& actualSeatIdx)
 		return false;
 	}
 
-	if (seatIdxHint < 0)
+	if ((int)_seats.size() >= MAX_SEATS)
+	{
+		actualSeatIdx = -1;
+		return false;
+	}
+
+	if (seatIdxHint < 0 || seatIdxHint >= MAX_SEATS)
 		seatIdxHint = 0;
+	// first free seat from the hint on, wrapping around
 	while (GetSeatByIndex(seatIdxHint) != nullptr)
-		seatIdxHint++;
+		seatIdxHint = (seatIdxHint + 1) % MAX_SEATS;
 
 	Seat seat{};
 	seat.seatIndex = seatIdxHint;
@@ -421,6 +449,7 @@ bool HoldemPokerGame::SitDown(int playerId, int seatIdxHint, int& actualSeatIdx)
 	});
 
 	actualSeatIdx = seatIdxHint;
+	_tableVersion++;
 	return true;
 }
 
@@ -476,9 +505,12 @@ void HoldemPokerGame::MarkPendingLeave(int playerId)
 
 void HoldemPokerGame::RemovePendingLeavers()
 {
+	size_t seatedBefore = _seats.size();
 	_seats.erase(std::remove_if(_seats.begin(), _seats.end(), [](const Seat& s) {
 		return s.playerId < 0 || (s.pendingLeave && !s.inHand);
 	}), _seats.end());
+	if (_seats.size() != seatedBefore)
+		_tableVersion++;
 
 	if (_seats.empty())
 	{
@@ -600,6 +632,75 @@ void HoldemPokerGame::WriteTable(NetPack& pack, int viewerPlayerId) const
 	}
 }
 
+bool HoldemPokerGame::WriteIdleState(std::ostream& out) const
+{
+	if (!IsIdle())
+		return false;
+	WritePod<uint32_t>(out, IDLE_STATE_MAGIC);
+	WritePod<int32_t>(out, _smallBlind);
+	WritePod<int32_t>(out, _bigBlind);
+	WritePod<int32_t>(out, _minBuyin);
+	WritePod<uint32_t>(out, _tableVersion);
+	WritePod<uint32_t>(out, (uint32_t)_button);
+	WritePod<uint8_t>(out, (uint8_t)_seats.size());
+	for (const Seat& seat : _seats)
+	{
+		WritePod<int32_t>(out, seat.seatIndex);
+		WritePod<int32_t>(out, seat.playerId);
+		WritePod<int32_t>(out, seat.chips);
+		WritePod<uint8_t>(out, (seat.pendingLeave ? 1 : 0) | (seat.sittingOut ? 2 : 0) | (seat.autoMode ? 4 : 0));
+	}
+	return out.good();
+}
+
+bool HoldemPokerGame::ReadIdleState(std::istream& in)
+{
+	if (ReadPod<uint32_t>(in) != IDLE_STATE_MAGIC)
+		return false;
+	int32_t smallBlind = ReadPod<int32_t>(in);
+	int32_t bigBlind = ReadPod<int32_t>(in);
+	int32_t minBuyin = ReadPod<int32_t>(in);
+	uint32_t tableVersion = ReadPod<uint32_t>(in);
+	uint32_t button = ReadPod<uint32_t>(in);
+	uint8_t seatCount = ReadPod<uint8_t>(in);
+	if (in.fail() || seatCount > MAX_SEATS || smallBlind < 0 || bigBlind < 0 || minBuyin < 0)
+		return false;
+
+	// the stacks are real chips, a file that does not describe a table this game could have written is rejected
+	// as a whole and nothing of it is taken over
+	std::vector<Seat> seats{};
+	seats.reserve(seatCount);
+	for (uint8_t i = 0; i < seatCount; ++i)
+	{
+		Seat seat;
+		seat.seatIndex = ReadPod<int32_t>(in);
+		seat.playerId = ReadPod<int32_t>(in);
+		seat.chips = ReadPod<int32_t>(in);
+		uint8_t flags = ReadPod<uint8_t>(in);
+		if (in.fail() || seat.seatIndex < 0 || seat.seatIndex >= MAX_SEATS || seat.playerId < 0 || seat.chips < 0 || flags > 7)
+			return false;
+		for (const Seat& other : seats)
+		{
+			if (other.seatIndex == seat.seatIndex || other.playerId == seat.playerId)
+				return false;
+		}
+		seat.pendingLeave = (flags & 1) != 0;
+		seat.sittingOut = (flags & 2) != 0;
+		seat.autoMode = (flags & 4) != 0;
+		seats.push_back(seat);
+	}
+	std::sort(seats.begin(), seats.end(), [](const Seat& a, const Seat& b) { return a.seatIndex < b.seatIndex; });
+
+	_smallBlind = smallBlind;
+	_bigBlind = bigBlind;
+	_minBuyin = minBuyin;
+	_tableVersion = tableVersion;
+	_button = seats.empty() ? 0 : button % seats.size();
+	_seats = std::move(seats);
+	_stage = Stage::Waiting;
+	return true;
+}
+
 void HoldemPokerGame::ReadTable(NetPack& pack)
 {
 	_stage = static_cast<Stage>(pack.ReadUInt8());
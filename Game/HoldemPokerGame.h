@@ -5,6 +5,7 @@
 #include <vector>
 #include <random>
 #include <cstdint>
+#include <iosfwd>
 
 class NetPack;
 
@@ -72,6 +73,9 @@ public:
 		InvalidValue = 2
 	};
 
+	// seats per table
+	static constexpr int MAX_SEATS = 9;
+
 	HoldemPokerGame();
 
 	SetBlindsResult SetBlinds(int smallBlind, int bigBlind);
@@ -79,6 +83,9 @@ public:
 	int GetSmallBlind() const { return _smallBlind; }
 	int GetBigBlind() const { return _bigBlind; }
 	int GetMinBuyin() const { return _minBuyin; }
+	// bumped whenever blinds or seat occupancy change, lets the owner republish its lobby entry only when needed
+	uint32_t GetTableVersion() const { return _tableVersion; }
+	int GetSeatedCount() const { return (int)_seats.size(); }
 
 	// Game flow
 	bool CanStart() const;
@@ -122,6 +129,13 @@ public:
 	void WriteTable(NetPack& pack, int viewerPlayerId = -1) const;
 	void ReadTable(NetPack& pack);
 
+	// Serialization (for room hibernation): blinds, button and seats with their stacks, nothing hand related,
+	// so only valid between hands
+	bool IsIdle() const { return _stage == Stage::Waiting && !_hasPendingHandResult; }
+	bool WriteIdleState(std::ostream& out) const;
+	// false, with the game left as it was, unless in holds a table WriteIdleState could have written
+	bool ReadIdleState(std::istream& in);
+
 private:
 	void DealHoleCards();
 	void DealCommunity(size_t count);
@@ -150,6 +164,7 @@ private:
 	int _smallBlind = -1;
 	int _bigBlind = -1;
 	int _minBuyin = 1000;
+	uint32_t _tableVersion = 0;
 	
 	// Hand result tracking
 	HandResult _lastHandResult{};
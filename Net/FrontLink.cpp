@@ -0,0 +1,390 @@
+#include "pch.h"
+#include "FrontLink.h"
+#include <deque>
+#include <iomanip>
+
+FrontLink& FrontLink::Instance()
+{
+	static FrontLink instance;
+	return instance;
+}
+
+std::string FrontLink::GetRingName(int worker, bool inbound)
+{
+	return std::format(FRONT_RING_NAME, worker, inbound ? "in" : "out");
+}
+
+bool FrontLink::Start()
+{
+	auto& link = Instance();
+	for (int i = 0; i < FRONT_WORKER_COUNT; i++)
+	{
+		if (!link._workers[i].inbound.Create(GetRingName(i, true), FRONT_RING_BYTES) ||
+			!link._workers[i].outbound.Create(GetRingName(i, false), FRONT_RING_BYTES))
+			return false;
+	}
+	for (int i = 0; i < FRONT_WORKER_COUNT; i++)
+		std::thread(&FrontLink::ReadJob, &link, i).detach();
+	link._started = true;
+	std::cout << "FrontLink: " << FRONT_WORKER_COUNT << " front workers, waiting for the front process" << std::endl;
+	return true;
+}
+
+void FrontLink::ReadJob(int index)
+{
+	auto& worker = _workers[index];
+	auto onRecord = [this, index, &worker](const uint8_t* data, uint32_t len)
+		{
+			RecordHeader header{};
+			if (len < sizeof(header))
+				return;
+			std::memcpy(&header, data, sizeof(header));
+			const uint8_t* body = data + sizeof(header);
+			uint32_t bodyLen = len - sizeof(header);
+
+			if (header.event == Event::Open)
+			{
+				uint64_t conn = MakeConnId(index, header.conn);
+				PlayerHandle handle = PlayerMgr::OnFrontConnected(conn);
+				if (handle == INVALID_PLAYER_HANDLE)
+				{
+					Push(conn, Event::Close, nullptr, 0);
+					return;
+				}
+				std::lock_guard<std::mutex> lock(worker.bindingsMutex);
+				worker.bindings[header.conn] = Binding{ handle, 0 };
+				return;
+			}
+
+			Binding binding{ INVALID_PLAYER_HANDLE, 0 };
+			{
+				std::lock_guard<std::mutex> lock(worker.bindingsMutex);
+				auto it = worker.bindings.find(header.conn);
+				if (it == worker.bindings.end())
+					return;
+				binding = it->second;
+				if (header.event == Event::Close)
+					worker.bindings.erase(it);
+			}
+			if (header.event == Event::Close)
+			{
+				PlayerMgr::WithPlayer(binding.handle, [&binding](Player* p) { p->OnConnectionLost(binding.connectionSeq, 0); });
+				return;
+			}
+			// the front only forwards whole packs, anything else means the two sides disagree about the format.
+			// checked again here rather than trusted, NetPack copies the whole pack into NET_PACK_MAX_LEN bytes
+			uint16_t type = 0;
+			uint16_t size = 0;
+			if (bodyLen >= 4)
+			{
+				std::memcpy(&type, body, 2);
+				std::memcpy(&size, body + 2, 2);
+			}
+			if (bodyLen < 4 || size != bodyLen || size > NET_PACK_MAX_LEN || type >= RpcEnum::INVALID)
+			{
+				std::cout << "STD ERROR: FrontLink malformed pack from front worker " << index << std::endl;
+				return;
+			}
+			_received++;
+			NetPack pack{ const_cast<uint8_t*>(body) };
+			PlayerMgr::WithPlayer(binding.handle, [&pack](Player* p) { p->OnRecv(std::move(pack)); });
+		};
+
+	int idleRounds = 0;
+	while (true)
+	{
+		if (worker.inbound.TryPop(onRecord))
+		{
+			idleRounds = 0;
+			continue;
+		}
+		// spin a little for the next record of a burst, then stop burning a core on an idle front
+		if (++idleRounds < 64)
+			std::this_thread::yield();
+		else
+			std::this_thread::sleep_for(std::chrono::microseconds(200));
+	}
+}
+
+bool FrontLink::Push(uint64_t conn, Event event, const void* data, uint32_t len)
+{
+	int index = (int)(conn >> 32);
+	if (!_started || index < 0 || index >= FRONT_WORKER_COUNT)
+		return false;
+	auto& worker = _workers[index];
+	RecordHeader header{ (uint32_t)(conn & 0xFFFFFFFF), event };
+	// the mutex keeps the outbound ring single producer, the front drains it on its poll thread
+	std::lock_guard<std::mutex> lock(worker.sendMutex);
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(FRONT_RING_FULL_WAIT_MS);
+	while (!worker.outbound.TryPush(&header, sizeof(header), data, len))
+	{
+		if (std::chrono::steady_clock::now() >= deadline)
+		{
+			_dropped++;
+			return false;
+		}
+		std::this_thread::yield();
+	}
+	return true;
+}
+
+bool FrontLink::Send(uint64_t conn, const char* data, uint32_t len)
+{
+	auto& link = Instance();
+	if (!link.Push(conn, Event::Data, data, len))
+		return false;
+	link._sent++;
+	return true;
+}
+
+void FrontLink::Close(uint64_t conn)
+{
+	auto& link = Instance();
+	int index = (int)(conn >> 32);
+	if (index < 0 || index >= FRONT_WORKER_COUNT)
+		return;
+	{
+		auto& worker = link._workers[index];
+		std::lock_guard<std::mutex> lock(worker.bindingsMutex);
+		worker.bindings.erase((uint32_t)(conn & 0xFFFFFFFF));
+	}
+	link.Push(conn, Event::Close, nullptr, 0);
+}
+
+void FrontLink::Rebind(uint64_t conn, PlayerHandle handle, uint32_t connectionSeq)
+{
+	auto& link = Instance();
+	int index = (int)(conn >> 32);
+	if (index < 0 || index >= FRONT_WORKER_COUNT)
+		return;
+	auto& worker = link._workers[index];
+	std::lock_guard<std::mutex> lock(worker.bindingsMutex);
+	worker.bindings[(uint32_t)(conn & 0xFFFFFFFF)] = Binding{ handle, connectionSeq };
+}
+
+void FrontLink::DebugPrint()
+{
+	auto& link = Instance();
+	if (!link._started)
+		return;
+	size_t connCount = 0;
+	uint64_t inFlight = 0;
+	for (auto& worker : link._workers)
+	{
+		{
+			std::lock_guard<std::mutex> lock(worker.bindingsMutex);
+			connCount += worker.bindings.size();
+		}
+		inFlight += worker.inbound.GetUsedBytes() + worker.outbound.GetUsedBytes();
+	}
+	std::cout << "[FRONT LINK REPORT] connections: " << connCount << ", received: " << link._received.load()
+		<< ", sent: " << link._sent.load() << ", dropped on full ring: " << link._dropped.load()
+		<< ", bytes in rings: " << inFlight << std::endl;
+}
+
+namespace
+{
+	constexpr int BENCH_MESSAGE_COUNT = 1000000;
+	constexpr int BENCH_ROUND_TRIP_COUNT = 100000;
+	// how many empty polls of a ring pass between two checks that the other process is still there
+	constexpr int BENCH_ALIVE_CHECK_POLLS = 1 << 16;
+
+	std::string GetBenchRingName(bool forward)
+	{
+		return FrontLink::GetRingName(FRONT_WORKER_COUNT, forward) + "_bench";
+	}
+
+	// a typical small room packet
+	NetPack MakeBenchSample()
+	{
+		NetPack sample{ RpcEnum::rpc_server_tick };
+		uint8_t payload[60]{};
+		sample.WriteBytes(payload, sizeof(payload));
+		return sample;
+	}
+
+	// both sides copy the pack out into a NetPack, as FrontLink::ReadJob does
+	bool PopBenchRing(ShmRing& ring)
+	{
+		return ring.TryPop([](const uint8_t* data, uint32_t len)
+			{
+				NetPack pack{ const_cast<uint8_t*>(data + sizeof(FrontLink::RecordHeader)) };
+			});
+	}
+
+	void PushBenchRing(ShmRing& ring, NetPack& sample)
+	{
+		FrontLink::RecordHeader header{ 1, FrontLink::Event::Data };
+		while (!ring.TryPush(&header, sizeof(header), sample.GetContent(), (uint32_t)sample.Length()))
+			std::this_thread::yield();
+	}
+
+	// false once alive says the other side is gone
+	template <typename Alive>
+	bool WaitPopBenchRing(ShmRing& ring, Alive&& alive)
+	{
+		for (int polls = 1; !PopBenchRing(ring); polls++)
+		{
+			if (polls % BENCH_ALIVE_CHECK_POLLS == 0 && !alive())
+				return false;
+		}
+		return true;
+	}
+}
+
+int FrontLink::RunBenchmark()
+{
+	NetPack sample = MakeBenchSample();
+	const uint8_t* sampleBytes = (const uint8_t*)sample.GetContent();
+	uint32_t sampleLen = (uint32_t)sample.Length();
+
+	// the in-process path: a recv thread handing packs to another thread through a locked queue
+	struct LockedQueue
+	{
+		std::deque<NetPack> packs{};
+		std::mutex mutex;
+
+		void Push(const uint8_t* bytes)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			packs.emplace_back(const_cast<uint8_t*>(bytes));
+		}
+		bool TryPop()
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (packs.empty())
+				return false;
+			NetPack pack = std::move(packs.front());
+			packs.pop_front();
+			return true;
+		}
+	};
+	auto nsPer = [](std::chrono::steady_clock::time_point start, int count)
+		{
+			return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count() / count;
+		};
+	LockedQueue toConsumer, toProducer;
+
+	// one way throughput
+	auto start = std::chrono::steady_clock::now();
+	{
+		std::thread consumer([&]() { for (int n = 0; n < BENCH_MESSAGE_COUNT;) if (toConsumer.TryPop()) n++; });
+		for (int i = 0; i < BENCH_MESSAGE_COUNT; i++)
+			toConsumer.Push(sampleBytes);
+		consumer.join();
+	}
+	double queueOneWay = nsPer(start, BENCH_MESSAGE_COUNT);
+
+	// round trip, one message in flight at a time
+	start = std::chrono::steady_clock::now();
+	{
+		std::thread echo([&]()
+			{
+				for (int n = 0; n < BENCH_ROUND_TRIP_COUNT;)
+				{
+					if (toConsumer.TryPop())
+					{
+						toProducer.Push(sampleBytes);
+						n++;
+					}
+				}
+			});
+		for (int i = 0; i < BENCH_ROUND_TRIP_COUNT; i++)
+		{
+			toConsumer.Push(sampleBytes);
+			while (!toProducer.TryPop());
+		}
+		echo.join();
+	}
+	double queueRoundTrip = nsPer(start, BENCH_ROUND_TRIP_COUNT);
+
+	// the ring's other end is a second process, as the front is in production: "--bench-ipc-echo" on this executable
+	ShmRing forward, backward;
+	if (!forward.Create(GetBenchRingName(true), FRONT_RING_BYTES) || !backward.Create(GetBenchRingName(false), FRONT_RING_BYTES))
+		return 1;
+	char exePath[MAX_PATH]{};
+	if (GetModuleFileNameA(NULL, exePath, MAX_PATH) == 0)
+	{
+		std::cout << "STD ERROR: FrontLink bench cannot find its own executable: " << GetLastError() << std::endl;
+		return 1;
+	}
+	std::string commandLine = std::format("\"{}\" --bench-ipc-echo {}", exePath, GetCurrentProcessId());
+	STARTUPINFOA startupInfo{};
+	startupInfo.cb = sizeof(startupInfo);
+	PROCESS_INFORMATION child{};
+	if (!CreateProcessA(exePath, commandLine.data(), NULL, NULL, FALSE, 0, NULL, NULL, &startupInfo, &child))
+	{
+		std::cout << "STD ERROR: FrontLink bench cannot start the echo process: " << GetLastError() << std::endl;
+		return 1;
+	}
+	auto childAlive = [&child]() { return WaitForSingleObject(child.hProcess, 0) == WAIT_TIMEOUT; };
+	auto finish = [&child](int result)
+		{
+			if (result != 0)
+			{
+				std::cout << "STD ERROR: FrontLink bench echo process exited early" << std::endl;
+				TerminateProcess(child.hProcess, 1);
+			}
+			WaitForSingleObject(child.hProcess, INFINITE);
+			CloseHandle(child.hThread);
+			CloseHandle(child.hProcess);
+			return result;
+		};
+
+	// the child says it is ready once it opened both rings, its startup is not timed
+	if (!WaitPopBenchRing(backward, childAlive))
+		return finish(1);
+
+	// one way: the child pops every record and answers once at the end
+	start = std::chrono::steady_clock::now();
+	for (int i = 0; i < BENCH_MESSAGE_COUNT; i++)
+		PushBenchRing(forward, sample);
+	if (!WaitPopBenchRing(backward, childAlive))
+		return finish(1);
+	double ringOneWay = nsPer(start, BENCH_MESSAGE_COUNT);
+
+	start = std::chrono::steady_clock::now();
+	for (int i = 0; i < BENCH_ROUND_TRIP_COUNT; i++)
+	{
+		PushBenchRing(forward, sample);
+		if (!WaitPopBenchRing(backward, childAlive))
+			return finish(1);
+	}
+	double ringRoundTrip = nsPer(start, BENCH_ROUND_TRIP_COUNT);
+	finish(0);
+
+	std::cout << std::fixed << std::setprecision(1)
+		<< "[IPC BENCH REPORT] " << sampleLen << " byte packs, " << BENCH_MESSAGE_COUNT << " one way, " << BENCH_ROUND_TRIP_COUNT << " round trips" << std::endl
+		<< "  in-process locked queue:           " << queueOneWay << " ns/msg one way, " << queueRoundTrip << " ns round trip" << std::endl
+		<< "  shared memory ring, two processes: " << ringOneWay << " ns/msg one way, " << ringRoundTrip << " ns round trip" << std::endl
+		<< "  ring overhead:                     " << (ringOneWay - queueOneWay) << " ns/msg one way, " << (ringRoundTrip - queueRoundTrip) << " ns round trip" << std::endl;
+	return 0;
+}
+
+int FrontLink::RunBenchmarkEcho(uint32_t parentPid)
+{
+	HANDLE parent = OpenProcess(SYNCHRONIZE, FALSE, parentPid);
+	if (parent == NULL)
+		return 1;
+	ShmRing forward, backward;
+	if (!forward.Open(GetBenchRingName(true)) || !backward.Open(GetBenchRingName(false)))
+	{
+		CloseHandle(parent);
+		return 1;
+	}
+	// a parent that died mid run would leave this process spinning on an empty ring forever
+	auto parentAlive = [parent]() { return WaitForSingleObject(parent, 0) == WAIT_TIMEOUT; };
+	NetPack sample = MakeBenchSample();
+	int result = 0;
+	PushBenchRing(backward, sample);
+	for (int n = 0; n < BENCH_MESSAGE_COUNT && result == 0; n++)
+		result = WaitPopBenchRing(forward, parentAlive) ? 0 : 1;
+	PushBenchRing(backward, sample);
+	for (int n = 0; n < BENCH_ROUND_TRIP_COUNT && result == 0; n++)
+	{
+		result = WaitPopBenchRing(forward, parentAlive) ? 0 : 1;
+		PushBenchRing(backward, sample);
+	}
+	CloseHandle(parent);
+	return result;
+}
@@ -0,0 +1,86 @@
+#pragma once
+#include "CppServerAPI.h"
+#include "Const.h"
+#include "ShmRing.h"
+#include "Player/PlayerHandle.h"
+#include <array>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+
+class NetPack;
+
+// logic side of the gateway/logic split, FrontProcess is the other end
+// each front worker has an inbound ring (front -> logic, opens, packs and closes of its connections) and an
+// outbound ring (logic -> front, packs to send and closes). every ring has exactly one producer: the front worker
+// inbound, and whichever logic thread holds the worker's send mutex outbound.
+// a front connection is an ordinary Player without a socket or recv thread, its packets come from the reader
+// thread of its worker and go through OnRecv like any other.
+class CPPSERVER_API FrontLink
+{
+public:
+	enum class Event : uint32_t
+	{
+		Open,
+		Data,
+		Close,
+	};
+	// in front of every record, the pack (if any) follows
+	struct RecordHeader
+	{
+		uint32_t conn;
+		Event event;
+	};
+
+	// ids handed out by a front worker start at 1, so 0 is never a connection
+	static uint64_t MakeConnId(int worker, uint32_t conn) { return ((uint64_t)worker << 32) | conn; }
+	static std::string GetRingName(int worker, bool inbound);
+
+private:
+	struct Binding
+	{
+		PlayerHandle handle;
+		uint32_t connectionSeq;
+	};
+	struct Worker
+	{
+		ShmRing inbound;
+		ShmRing outbound;
+		std::mutex sendMutex;
+		std::unordered_map<uint32_t, Binding> bindings{};
+		std::mutex bindingsMutex;
+	};
+
+	static FrontLink& Instance();
+
+	std::array<Worker, FRONT_WORKER_COUNT> _workers{};
+	bool _started = false;
+
+	std::atomic<uint64_t> _received{ 0 };
+	std::atomic<uint64_t> _sent{ 0 };
+	std::atomic<uint64_t> _dropped{ 0 };
+
+	void ReadJob(int worker);
+	// waits up to FRONT_RING_FULL_WAIT_MS for room in the worker's outbound ring
+	bool Push(uint64_t conn, Event event, const void* data, uint32_t len);
+
+	FrontLink() = default;
+	FrontLink(const FrontLink&) = delete;
+	FrontLink& operator=(const FrontLink&) = delete;
+
+public:
+	// creates the rings and starts one reader per front worker, only in "--logic" mode
+	static bool Start();
+	// false if the front did not take it in time, the caller treats that like a failed send()
+	static bool Send(uint64_t conn, const char* data, uint32_t len);
+	static void Close(uint64_t conn);
+	// a resume moved conn to another player, which bumped its connection seq
+	static void Rebind(uint64_t conn, PlayerHandle handle, uint32_t connectionSeq);
+	static void DebugPrint();
+
+	// "--bench-ipc": per message cost of a ShmRing against the in-process handoff (a locked queue, like
+	// NetPackHandler's), one way throughput and round trip, then the process exits.
+	// the ring's far end runs in a child process started with "--bench-ipc-echo <parent pid>", which is RunBenchmarkEcho
+	static int RunBenchmark();
+	static int RunBenchmarkEcho(uint32_t parentPid);
+};
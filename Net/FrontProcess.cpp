@@ -0,0 +1,265 @@
+#include "pch.h"
+#include "FrontProcess.h"
+
+FrontProcess& FrontProcess::Instance()
+{
+	static FrontProcess instance;
+	return instance;
+}
+
+int FrontProcess::Run(SOCKET listenSocket)
+{
+	auto& front = Instance();
+	// the logic process creates the rings, it may come up after the front
+	for (int i = 0; i < FRONT_WORKER_COUNT; i++)
+	{
+		auto& worker = front._workers[i];
+		while ((!worker.inbound.IsOpen() && !worker.inbound.Open(FrontLink::GetRingName(i, true))) ||
+			(!worker.outbound.IsOpen() && !worker.outbound.Open(FrontLink::GetRingName(i, false))))
+		{
+			std::cout << "FrontProcess: waiting for the logic process" << std::endl;
+			std::this_thread::sleep_for(std::chrono::milliseconds(FRONT_RING_OPEN_RETRY_MS));
+		}
+	}
+	for (int i = 0; i < FRONT_WORKER_COUNT; i++)
+		std::thread(&FrontProcess::WorkerJob, &front, i).detach();
+
+	std::atomic<bool> acceptFailed{ false };
+	std::thread acceptThread([&front, &acceptFailed, listenSocket]()
+		{
+			uint64_t next = 0;
+			SOCKET clientSocket = accept(listenSocket, NULL, NULL);
+			while (clientSocket != INVALID_SOCKET)
+			{
+				auto& worker = front._workers[next++ % FRONT_WORKER_COUNT];
+				{
+					std::lock_guard<std::mutex> lock(worker.pendingMutex);
+					worker.pending.push_back(clientSocket);
+				}
+				front._accepted++;
+				clientSocket = accept(listenSocket, NULL, NULL);
+			}
+			printf("accept failed: %d\n", WSAGetLastError());
+			acceptFailed.store(true);
+		});
+	std::cout << "FrontProcess: " << FRONT_WORKER_COUNT << " workers linked to the logic process" << std::endl;
+
+	// the same report cadence as the logic process' tick loop
+	uint64_t seconds = 0;
+	while (!acceptFailed.load())
+	{
+		std::this_thread::sleep_for(std::chrono::seconds(1));
+		seconds++;
+#ifdef ENABLE_DEBUG_REPORT
+		if (seconds % 60 == 0)
+			DebugPrint();
+#endif
+	}
+	acceptThread.join();
+	closesocket(listenSocket);
+	WSACleanup();
+	return 1;
+}
+
+void FrontProcess::WorkerJob(int index)
+{
+	auto& worker = _workers[index];
+	std::vector<WSAPOLLFD> fds{};
+	std::vector<uint32_t> ids{};
+	while (true)
+	{
+		std::vector<SOCKET> accepted{};
+		{
+			std::lock_guard<std::mutex> lock(worker.pendingMutex);
+			accepted.swap(worker.pending);
+		}
+		for (SOCKET s : accepted)
+		{
+			u_long nonBlocking = 1;
+			if (ioctlsocket(s, FIONBIO, &nonBlocking) == SOCKET_ERROR)
+			{
+				std::cout << "STD ERROR: FrontProcess cannot make a client socket non-blocking: " << WSAGetLastError() << std::endl;
+				closesocket(s);
+				continue;
+			}
+			uint32_t id = worker.nextConn++;
+			if (id == 0)
+				id = worker.nextConn++;
+			auto conn = std::make_unique<Conn>();
+			conn->socket = s;
+			worker.conns.emplace(id, std::move(conn));
+			PushInbound(worker, id, FrontLink::Event::Open, nullptr, 0);
+		}
+
+		DrainOutbound(worker);
+
+		fds.clear();
+		ids.clear();
+		for (auto& [id, conn] : worker.conns)
+		{
+			short events = conn->out.empty() ? POLLRDNORM : POLLRDNORM | POLLWRNORM;
+			fds.push_back(WSAPOLLFD{ conn->socket, events, 0 });
+			ids.push_back(id);
+		}
+		if (fds.empty())
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(FRONT_POLL_TIMEOUT_MS));
+			continue;
+		}
+		// short timeout, the outbound ring has no way to wake the poll
+		if (WSAPoll(fds.data(), (ULONG)fds.size(), FRONT_POLL_TIMEOUT_MS) == SOCKET_ERROR)
+		{
+			std::cout << "STD ERROR: FrontProcess WSAPoll failed: " << WSAGetLastError() << std::endl;
+			std::this_thread::sleep_for(std::chrono::milliseconds(FRONT_POLL_TIMEOUT_MS));
+			continue;
+		}
+		for (size_t i = 0; i < fds.size(); i++)
+		{
+			if (fds[i].revents == 0)
+				continue;
+			auto it = worker.conns.find(ids[i]);
+			if (it == worker.conns.end())
+				continue;
+			if ((fds[i].revents & POLLWRNORM) != 0 && !FlushConn(*it->second))
+				CloseConn(worker, ids[i], true);
+			else if ((fds[i].revents & ~POLLWRNORM) != 0 && !ReadConn(worker, ids[i], *it->second))
+				CloseConn(worker, ids[i], true);
+		}
+	}
+}
+
+void FrontProcess::PushInbound(Worker& worker, uint32_t conn, FrontLink::Event event, const uint8_t* data, uint32_t len)
+{
+	FrontLink::RecordHeader header{ conn, event };
+	while (!worker.inbound.TryPush(&header, sizeof(header), data, len))
+		std::this_thread::yield();
+}
+
+bool FrontProcess::ReadConn(Worker& worker, uint32_t id, Conn& conn)
+{
+	int n = recv(conn.socket, (char*)conn.buf + conn.filled, (int)(sizeof(conn.buf) - conn.filled), 0);
+	if (n == SOCKET_ERROR && WSAGetLastError() == WSAEWOULDBLOCK)
+		return true;
+	if (n <= 0)
+		return false;
+	conn.filled += n;
+	// the same split as Player::RecvJob, the logic process only ever sees whole packs
+	size_t offset = 0;
+	while (conn.filled - offset >= 4)
+	{
+		uint16_t type = 0;
+		uint16_t size = 0;
+		std::memcpy(&type, conn.buf + offset, 2);
+		std::memcpy(&size, conn.buf + offset + 2, 2);
+		if (type >= RpcEnum::INVALID || size < 4 || size > NET_PACK_MAX_LEN)
+			return false;
+		if (conn.filled - offset < size)
+			break;
+		PushInbound(worker, id, FrontLink::Event::Data, conn.buf + offset, size);
+		_packsIn++;
+		offset += size;
+	}
+	std::memmove(conn.buf, conn.buf + offset, conn.filled - offset);
+	conn.filled -= offset;
+	return true;
+}
+
+void FrontProcess::DrainOutbound(Worker& worker)
+{
+	// bounded, so a logic process that keeps the ring full cannot starve the sockets of this worker
+	for (int i = 0; i < 4096; i++)
+	{
+		bool popped = worker.outbound.TryPop([this, &worker](const uint8_t* data, uint32_t len)
+			{
+				FrontLink::RecordHeader header{};
+				if (len < sizeof(header))
+					return;
+				std::memcpy(&header, data, sizeof(header));
+				auto it = worker.conns.find(header.conn);
+				// already closed on this side, the logic process hears about it from the inbound ring
+				if (it == worker.conns.end())
+					return;
+				if (header.event == FrontLink::Event::Close)
+				{
+					CloseConn(worker, header.conn, false);
+					return;
+				}
+				if (WriteConn(*it->second, (const char*)data + sizeof(header), len - sizeof(header)))
+					_packsOut++;
+				else
+					CloseConn(worker, header.conn, true);
+			});
+		if (!popped)
+			return;
+	}
+}
+
+bool FrontProcess::WriteConn(Conn& conn, const char* data, size_t len)
+{
+	if (conn.out.empty())
+	{
+		int n = send(conn.socket, data, (int)len, 0);
+		if (n == SOCKET_ERROR && WSAGetLastError() != WSAEWOULDBLOCK)
+			return false;
+		size_t sent = n == SOCKET_ERROR ? 0 : (size_t)n;
+		if (sent == len)
+			return true;
+		data += sent;
+		len -= sent;
+	}
+	if (conn.out.size() - conn.outPos + len > FRONT_CONN_MAX_PENDING_BYTES)
+	{
+		_slowClosed++;
+		std::cout << "STD ERROR: FrontProcess closing a client that stopped reading, "
+			<< conn.out.size() - conn.outPos << " bytes pending" << std::endl;
+		return false;
+	}
+	// FlushConn only moves outPos, the sent front is dropped once it is the larger half
+	if (conn.outPos > conn.out.size() / 2)
+	{
+		conn.out.erase(conn.out.begin(), conn.out.begin() + conn.outPos);
+		conn.outPos = 0;
+	}
+	conn.out.insert(conn.out.end(), data, data + len);
+	return true;
+}
+
+bool FrontProcess::FlushConn(Conn& conn)
+{
+	while (conn.outPos < conn.out.size())
+	{
+		int n = send(conn.socket, conn.out.data() + conn.outPos, (int)(conn.out.size() - conn.outPos), 0);
+		if (n == SOCKET_ERROR)
+			return WSAGetLastError() == WSAEWOULDBLOCK;
+		conn.outPos += n;
+	}
+	conn.out.clear();
+	conn.outPos = 0;
+	return true;
+}
+
+void FrontProcess::CloseConn(Worker& worker, uint32_t id, bool tellLogic)
+{
+	auto it = worker.conns.find(id);
+	if (it == worker.conns.end())
+		return;
+	// a close the logic process asked for goes out after its last packs, as far as the socket takes them now
+	if (!tellLogic)
+		FlushConn(*it->second);
+	shutdown(it->second->socket, SD_SEND);
+	closesocket(it->second->socket);
+	worker.conns.erase(it);
+	if (tellLogic)
+		PushInbound(worker, id, FrontLink::Event::Close, nullptr, 0);
+}
+
+void FrontProcess::DebugPrint()
+{
+	auto& front = Instance();
+	uint64_t inFlight = 0;
+	for (auto& worker : front._workers)
+		inFlight += worker.inbound.GetUsedBytes() + worker.outbound.GetUsedBytes();
+	std::cout << "[FRONT PROCESS REPORT] accepted: " << front._accepted.load() << ", packs in: " << front._packsIn.load()
+		<< ", packs out: " << front._packsOut.load() << ", closed for not reading: " << front._slowClosed.load()
+		<< ", bytes in rings: " << inFlight << std::endl;
+}
@@ -0,0 +1,72 @@
+#pragma once
+#include "CppServerAPI.h"
+#include "Const.h"
+#include "ShmRing.h"
+#include "FrontLink.h"
+#include "NetPack.h"
+#include <array>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+
+// "--front": the process that owns every client socket, see FrontLink for the logic side
+// the accept loop deals connections out to FRONT_WORKER_COUNT workers; each worker polls its sockets, splits the
+// byte stream into packs and pushes them to its inbound ring, and writes out whatever the logic process put in
+// its outbound ring. a worker is the only producer of its inbound ring and the only consumer of its outbound one.
+// sockets are non-blocking, so a client that reads slowly only fills its own buffer and never holds up the worker.
+class CPPSERVER_API FrontProcess
+{
+	struct Conn
+	{
+		SOCKET socket = INVALID_SOCKET;
+		// a recv can end inside a pack, the rest waits here for the next one
+		uint8_t buf[NET_PACK_MAX_LEN * 2];
+		size_t filled = 0;
+		// what the client did not take yet, out[outPos..] is still to go; the worker polls for POLLWRNORM while it is not empty
+		std::vector<char> out{};
+		size_t outPos = 0;
+	};
+	struct Worker
+	{
+		ShmRing inbound;
+		ShmRing outbound;
+		// sockets accepted since the worker's last poll
+		std::vector<SOCKET> pending{};
+		std::mutex pendingMutex;
+		// everything below is only touched by the worker's thread
+		std::unordered_map<uint32_t, std::unique_ptr<Conn>> conns{};
+		uint32_t nextConn = 1;
+	};
+
+	static FrontProcess& Instance();
+
+	std::array<Worker, FRONT_WORKER_COUNT> _workers{};
+
+	std::atomic<uint64_t> _accepted{ 0 };
+	std::atomic<uint64_t> _packsIn{ 0 };
+	std::atomic<uint64_t> _packsOut{ 0 };
+	std::atomic<uint64_t> _slowClosed{ 0 };
+
+	void WorkerJob(int index);
+	// waits for room in the inbound ring, a busy logic process slows the front down instead of losing packs
+	void PushInbound(Worker& worker, uint32_t conn, FrontLink::Event event, const uint8_t* data, uint32_t len);
+	// false if the connection broke or sent something that is not a pack
+	bool ReadConn(Worker& worker, uint32_t id, Conn& conn);
+	void DrainOutbound(Worker& worker);
+	// queues behind what is pending and writes as much as the socket takes, false if the connection has to go
+	bool WriteConn(Conn& conn, const char* data, size_t len);
+	// false if the connection broke
+	bool FlushConn(Conn& conn);
+	void CloseConn(Worker& worker, uint32_t id, bool tellLogic);
+
+	FrontProcess() = default;
+	FrontProcess(const FrontProcess&) = delete;
+	FrontProcess& operator=(const FrontProcess&) = delete;
+
+public:
+	// opens the rings, starts the workers and runs the accept loop, returns only when accept fails
+	static int Run(SOCKET listenSocket);
+	static void DebugPrint();
+};
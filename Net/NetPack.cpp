@@ -171,6 +171,13 @@ void NetPack::WriteUInt32(uint32_t val, int atPos)
 	m_size += 4;
 	std::memcpy(m_content + 2, &m_size, 2);
 }
+void NetPack::WriteBytes(const uint8_t* data, size_t len)
+{
+	assert(m_size + len <= NET_PACK_MAX_LEN);
+	std::memcpy(m_content + m_size, data, len);
+	m_size += len;
+	std::memcpy(m_content + 2, &m_size, 2);
+}
 
 const char* NetPack::GetContent() { return (char*)m_content; }
 size_t NetPack::Length() { return m_size; }
@@ -41,6 +41,7 @@ public:
 	void WriteUInt8(uint8_t val, int atPos = -1);
 	void WriteUInt16(uint16_t val, int atPos = -1);
 	void WriteUInt32(uint32_t val, int atPos = -1);
+	void WriteBytes(const uint8_t* data, size_t len);
 
 	void DebugPrint();
 	uint8_t* DebugGetContent() { return (uint8_t*)m_content; }
@@ -1,17 +1,33 @@
 #include "pch.h"
 #include "NetPackHandler.h"
 #include "Player/PlayerUtils.h"
+#include "Utils/EpochReclaimer.h"
+#include "NetPackStream.h"
+#include "Room/RoomDirectory.h"
+#include "Room/LobbyFeed.h"
+#include "Room/RoomShard.h"
+#include "Net/ShardGateway.h"
 
-NetTask::NetTask(std::shared_ptr<Player> owner, NetPack& pack)
+NetTask::NetTask(PlayerHandle owner, NetPack& pack)
 	: m_taskOwner(owner), m_taskPack(std::move(pack))
 { }
 
 NetTask::NetTask(NetTask&& other) noexcept
-	: m_taskOwner(std::move(other.m_taskOwner)), m_taskPack(std::move(other.m_taskPack))
+	: m_taskOwner(other.m_taskOwner), m_taskPack(std::move(other.m_taskPack))
 { }
 
 NetTask::~NetTask() = default;
 
+namespace
+{
+	// the room lives in another process, the shard answers the client through the gateway
+	void ForwardToShard(Player* owner, int shard, NetPack& pack)
+	{
+		if (!ShardGateway::Forward(owner, shard, pack))
+			owner->SendError(RpcError::ROOM_NOT_EXIST);
+	}
+}
+
 NetPackHandler::NetPackHandler() = default;
 NetPackHandler::~NetPackHandler() = default;
 
@@ -21,7 +37,7 @@ NetPackHandler& NetPackHandler::Instance()
 	return instance;
 }
 
-void NetPackHandler::AddTask(std::shared_ptr<Player> owner, NetPack& pack)
+void NetPackHandler::AddTask(PlayerHandle owner, NetPack& pack)
 {
 	auto& handler = Instance();
 	std::unique_lock<std::mutex> lock(handler._mutex);
@@ -30,7 +46,7 @@ void NetPackHandler::AddTask(std::shared_ptr<Player> owner, NetPack& pack)
 int NetPackHandler::DoOneTask()
 {
 	auto& handler = Instance();
-	std::shared_ptr<Player> owner = nullptr;
+	PlayerHandle ownerHandle = INVALID_PLAYER_HANDLE;
 	NetPack pack{ RpcEnum::INVALID };
 
 	{
@@ -38,11 +54,14 @@ int NetPackHandler::DoOneTask()
 		if (handler._taskList.size() == 0)
 			return 1; // no task to do
 		NetTask& task = handler._taskList.front();
-		handler._taskList.pop();
-		owner = task.m_taskOwner;
+		ownerHandle = task.m_taskOwner;
 		pack = std::move(task.m_taskPack);
+		handler._taskList.pop();
 	}
 
+	// owner stays valid until this task returns
+	EpochReclaimer::ReadGuard guard{};
+	Player* owner = PlayerMgr::Resolve(ownerHandle);
 	if (owner == nullptr || owner->Expired())
 		return 2; // owner no longer valid
 
@@ -52,7 +71,7 @@ int NetPackHandler::DoOneTask()
 			owner->SendError(RpcError::USER_ALREADY_LOGGED_IN);
 		UINT32 id = pack.ReadUInt32();
 		std::string pwd = pack.ReadString();
-		PlayerUtils::UserLogin(id, pwd, owner);
+		PlayerUtils::UserLogin(id, pwd, ownerHandle);
 	}
 	else if (pack.MsgType() == RpcEnum::rpc_server_register)
 	{
@@ -60,19 +79,48 @@ int NetPackHandler::DoOneTask()
 			owner->SendError(RpcError::USER_ALREADY_LOGGED_IN);
 		std::string name = pack.ReadString();
 		std::string pwd = pack.ReadString();
-		PlayerUtils::CreateUserOnDatabase(name, pwd, owner);
+		PlayerUtils::CreateUserOnDatabase(name, pwd, ownerHandle);
 	}
 	else if (pack.MsgType() == RpcEnum::rpc_server_print_room)
 	{
-		NetPack send{ RpcEnum::rpc_client_print_room };
-		RoomMgr::WriteAllRoom(send);
-		owner->Send(send);
+		// both fields are optional, an old client gets the first page
+		uint32_t cursor = pack.ReadUInt32();
+		uint16_t limit = pack.ReadUInt16();
+		NetPackStream send{ RpcEnum::rpc_client_print_room, [owner](NetPack& frame) { owner->Send(frame); } };
+		RoomMgr::WriteRoomPage(send, cursor, limit);
+		send.Finish();
+	}
+	else if (pack.MsgType() == RpcEnum::rpc_server_query_rooms)
+	{
+		RoomDirectory::Query query{};
+		query.Read(pack);
+		NetPackStream send{ RpcEnum::rpc_client_query_rooms, [owner](NetPack& frame) { owner->Send(frame); } };
+		RoomDirectory::WriteQuery(send, query);
+		send.Finish();
+	}
+	else if (pack.MsgType() == RpcEnum::rpc_server_lobby_subscribe)
+	{
+		LobbyFeed::Subscribe(ownerHandle, pack.ReadUInt16());
+	}
+	else if (pack.MsgType() == RpcEnum::rpc_server_lobby_unsubscribe)
+	{
+		LobbyFeed::Unsubscribe(ownerHandle);
 	}
 	else if (pack.MsgType() == RpcEnum::rpc_server_print_user)
 	{
-		NetPack send{ RpcEnum::rpc_client_print_user };
-		PlayerMgr::WriteAllPlayer(send);
-		owner->Send(send);
+		uint32_t cursor = pack.ReadUInt32();
+		uint16_t limit = pack.ReadUInt16();
+		NetPackStream send{ RpcEnum::rpc_client_print_user, [owner](NetPack& frame) { owner->Send(frame); } };
+		PlayerMgr::WritePlayerPage(send, cursor, limit);
+		send.Finish();
+	}
+	else if (pack.MsgType() == RpcEnum::rpc_server_shard_attach)
+	{
+		// only a tunnel of a gateway link, ShardHost checked the shard secret before it opened any
+		if (RoomShard::IsGateway() || !owner->IsShardTunnel() || owner->IsLoggedIn())
+			owner->SendError(RpcError::PLAYER_STATE_ERROR);
+		else if (auto err = (RpcError)PlayerMgr::OnPlayerLoggedIn(ownerHandle, PlayerInfo(pack)); err != RpcError::SUCCESS)
+			owner->SendError(err);
 	}
 	else if (!owner->IsLoggedIn())
 	{
@@ -94,28 +142,39 @@ int NetPackHandler::DoOneTask()
 	else if (pack.MsgType() == RpcEnum::rpc_server_goto_room)
 	{
 		int roomIdx = pack.ReadInt32();
-		auto err = owner->JoinRoom(roomIdx);
-		if (err != SUCCESS)
+		if (!RoomShard::IsLocal(roomIdx))
+			ForwardToShard(owner, RoomShard::ShardOf(roomIdx), pack);
+		// on the room's executor, so it stays in order with the packets the player sends the room next
+		else if (auto err = RoomMgr::PostToRoom(roomIdx, ownerHandle, [roomIdx](Player* p)
+			{
+				if (auto err = p->JoinRoom(roomIdx); err != SUCCESS)
+					p->SendError(err);
+				else
+				{
+					NetPack send{ RpcEnum::rpc_client_goto_room };
+					send.WriteInt32(roomIdx);
+					p->Send(send);
+				}
+			}); err != SUCCESS)
 			owner->SendError(err);
-		else
-		{
-			NetPack send{ RpcEnum::rpc_client_goto_room };
-			send.WriteInt32(roomIdx);
-			owner->Send(send);
-		}
 	}
 	else if (pack.MsgType() == RpcEnum::rpc_server_leave_room)
 	{
 		int roomIdx = pack.ReadInt32();
-		auto err = owner->LeaveRoom(roomIdx);
-		if (err != SUCCESS)
+		if (!RoomShard::IsLocal(roomIdx))
+			ForwardToShard(owner, RoomShard::ShardOf(roomIdx), pack);
+		else if (auto err = RoomMgr::PostToRoom(roomIdx, ownerHandle, [roomIdx](Player* p)
+			{
+				if (auto err = p->LeaveRoom(roomIdx); err != SUCCESS)
+					p->SendError(err);
+				else
+				{
+					NetPack send{ RpcEnum::rpc_client_leave_room };
+					send.WriteInt32(roomIdx);
+					p->Send(send);
+				}
+			}); err != SUCCESS)
 			owner->SendError(err);
-		else
-		{
-			NetPack send{ RpcEnum::rpc_client_leave_room };
-			send.WriteInt32(roomIdx);
-			owner->Send(send);
-		}
 	}
 	else if (pack.MsgType() == RpcEnum::rpc_server_get_my_rooms)
 	{
@@ -127,14 +186,19 @@ int NetPackHandler::DoOneTask()
 	{
 		std::shared_ptr<Room> newRoom = nullptr;
 		int roomType = pack.ReadUInt16();
-		auto err = RoomMgr::CreateRoom((Room::RoomType)roomType, newRoom);
-		if (err != SUCCESS)
-			owner->SendError(err);
-		else
+		// a shard that cannot be reached does not stop room creation, the room just stays here
+		int shard = RoomShard::PickShardForNewRoom();
+		if (shard == RoomShard::GetLocalShard() || !ShardGateway::Forward(owner, shard, pack))
 		{
-			NetPack send{ RpcEnum::rpc_client_create_room };
-			send.WriteInt32(newRoom->GetRoomID());
-			owner->Send(send);
+			auto err = RoomMgr::CreateRoom((Room::RoomType)roomType, newRoom);
+			if (err != SUCCESS)
+				owner->SendError(err);
+			else
+			{
+				NetPack send{ RpcEnum::rpc_client_create_room };
+				send.WriteInt32(newRoom->GetRoomID());
+				owner->Send(send);
+			}
 		}
 	}
 	else if (pack.MsgType() == RpcEnum::rpc_server_send_text
@@ -147,8 +211,17 @@ int NetPackHandler::DoOneTask()
 	{
 		// Client must send target room ID first for multi-room support
 		int roomId = pack.ReadInt32();
-		auto err = RoomMgr::HandleNetPack(owner, pack, roomId);
-		owner->SendError(err);
+		if (!RoomShard::IsLocal(roomId))
+			ForwardToShard(owner, RoomShard::ShardOf(roomId), pack);
+		else
+		{
+			auto roomPack = std::make_shared<NetPack>(std::move(pack));
+			auto err = RoomMgr::PostToRoom(roomId, ownerHandle, [roomPack, roomId](Player* p)
+				{
+					p->SendError(RoomMgr::HandleNetPack(p, *roomPack, roomId));
+				});
+			owner->SendError(err);
+		}
 	}
 	else if (pack.MsgType() == RpcEnum::rpc_server_error_respond)
 	{
@@ -5,9 +5,9 @@
 
 struct CPPSERVER_API NetTask
 {
-	std::shared_ptr<Player> m_taskOwner;
+	PlayerHandle m_taskOwner;
 	NetPack m_taskPack;
-	NetTask(std::shared_ptr<Player> owner, NetPack& pack);
+	NetTask(PlayerHandle owner, NetPack& pack);
 	NetTask(NetTask&& other) noexcept;
 	~NetTask();
 };
@@ -25,6 +25,6 @@ class CPPSERVER_API NetPackHandler
 	NetPackHandler& operator=(const NetPackHandler&) = delete;
 
 public:
-	static void AddTask(std::shared_ptr<Player> owner, NetPack& pack);
+	static void AddTask(PlayerHandle owner, NetPack& pack);
 	static int DoOneTask();
 };
@@ -0,0 +1,86 @@
+#include "pch.h"
+#include "NetPackStream.h"
+
+std::atomic<uint32_t> NetPackStream::s_nextStreamId{ 1 };
+
+NetPackStream::NetPackStream(RpcEnum typ, std::function<void(NetPack&)> sink)
+	: m_enumType(typ), m_sink(std::move(sink))
+{
+	m_pending.reserve(NET_PACK_MAX_LEN);
+}
+NetPackStream::~NetPackStream()
+{
+	if (!m_finished)
+		Finish();
+}
+
+void NetPackStream::Append(const void* data, size_t len)
+{
+	assert(!m_finished);
+	auto bytes = static_cast<const uint8_t*>(data);
+	m_pending.insert(m_pending.end(), bytes, bytes + len);
+	// nothing is cut while the response can still be one plain pack
+	if (!m_fragmented && m_pending.size() <= PLAIN_BODY_MAX)
+		return;
+	// keep one full frame back, the last frame has to carry the last flag
+	while (m_pending.size() > FRAGMENT_PAYLOAD_MAX)
+		EmitFragment(FRAGMENT_PAYLOAD_MAX, false);
+}
+void NetPackStream::EmitFragment(size_t len, bool last)
+{
+	if (!m_fragmented)
+	{
+		m_fragmented = true;
+		m_streamId = s_nextStreamId.fetch_add(1);
+	}
+	NetPack frame{ RpcEnum::rpc_client_fragment };
+	frame.WriteUInt32(m_streamId);
+	frame.WriteUInt16((uint16_t)m_enumType);
+	frame.WriteUInt8(last ? 1 : 0);
+	frame.WriteBytes(m_pending.data(), len);
+	m_pending.erase(m_pending.begin(), m_pending.begin() + len);
+	m_sink(frame);
+}
+
+void NetPackStream::WriteString(const std::string& val)
+{
+	uint16_t strlen = (uint16_t)val.length() + 1;
+	WriteUInt16(strlen);
+	Append(val.c_str(), strlen);
+}
+void NetPackStream::WriteInt8(int8_t val)
+{
+	Append(&val, 1);
+}
+void NetPackStream::WriteInt32(int32_t val)
+{
+	Append(&val, 4);
+}
+void NetPackStream::WriteUInt8(uint8_t val)
+{
+	Append(&val, 1);
+}
+void NetPackStream::WriteUInt16(uint16_t val)
+{
+	Append(&val, 2);
+}
+void NetPackStream::WriteUInt32(uint32_t val)
+{
+	Append(&val, 4);
+}
+
+void NetPackStream::Finish()
+{
+	if (m_finished)
+		return;
+	m_finished = true;
+	if (!m_fragmented && m_pending.size() <= PLAIN_BODY_MAX)
+	{
+		NetPack pack{ m_enumType };
+		pack.WriteBytes(m_pending.data(), m_pending.size());
+		m_pending.clear();
+		m_sink(pack);
+		return;
+	}
+	EmitFragment(m_pending.size(), true);
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include "CppServerAPI.h"
+#include "NetPack.h"
+#include <functional>
+#include <vector>
+#include <atomic>
+
+// writes a response of any size as a sequence of bounded frames, handing each one to the sink as soon as it is full
+// a response that fits one pack is sent as a plain pack of its own type, nothing changes for the client.
+// anything larger goes out as rpc_client_fragment frames:
+//   [stream id u32][inner type u16][last u8][payload]
+// the client appends the payloads of one stream id in order and parses the result as a pack body of the inner type
+class CPPSERVER_API NetPackStream
+{
+	static constexpr size_t FRAGMENT_HEADER_LEN = 4 + 4 + 2 + 1;
+	static constexpr size_t FRAGMENT_PAYLOAD_MAX = NET_PACK_MAX_LEN - FRAGMENT_HEADER_LEN;
+	// the largest body that still goes out as one plain pack
+	static constexpr size_t PLAIN_BODY_MAX = NET_PACK_MAX_LEN - 4;
+	static std::atomic<uint32_t> s_nextStreamId;
+
+	RpcEnum m_enumType;
+	std::function<void(NetPack&)> m_sink;
+	std::vector<uint8_t> m_pending{};
+	uint32_t m_streamId = 0;
+	bool m_fragmented = false;
+	bool m_finished = false;
+
+	void Append(const void* data, size_t len);
+	void EmitFragment(size_t len, bool last);
+
+public:
+	NetPackStream() = delete;
+	NetPackStream(RpcEnum typ, std::function<void(NetPack&)> sink);
+	NetPackStream(const NetPackStream&) = delete;
+	NetPackStream& operator=(const NetPackStream&) = delete;
+	// finishes the stream if the caller did not
+	~NetPackStream();
+
+	// same encoding as the matching NetPack writes
+	void WriteString(const std::string& val);
+	void WriteInt8(int8_t val);
+	void WriteInt32(int32_t val);
+	void WriteUInt8(uint8_t val);
+	void WriteUInt16(uint16_t val);
+	void WriteUInt32(uint32_t val);
+
+	// sends whatever is left, nothing can be written afterwards
+	void Finish();
+
+	// room shards relay their frames through the gateway, each process numbers its streams from its own base
+	static void SetStreamIdBase(uint32_t base) { s_nextStreamId.store(base + 1); }
+};
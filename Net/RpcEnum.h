@@ -53,5 +53,26 @@ enum RpcEnum : std::uint16_t
 	rpc_server_poker_set_blinds,
 	rpc_client_poker_set_blinds,
 
+	// session resume rpc
+	rpc_server_resume_session,
+	rpc_client_resume_session,
+
+	// one frame of a response larger than a single pack, see NetPackStream
+	rpc_client_fragment,
+
+	// lobby rpc, filtered and paginated room summaries from RoomDirectory
+	rpc_server_query_rooms,
+	rpc_client_query_rooms,
+	rpc_server_lobby_subscribe,
+	rpc_server_lobby_unsubscribe,
+	rpc_client_lobby_diff,
+	rpc_server_shard_attach,
+
+	// whole client packs back to back, everything a connection was sent during one tick, see Player::Send
+	rpc_client_batch,
+
+	// every chat text a room queued during one tick, see ChatRoom
+	rpc_client_send_text_batch,
+
 	INVALID,
 };
\ No newline at end of file
@@ -0,0 +1,364 @@
+#include "pch.h"
+#include "ShardGateway.h"
+#include "Room/RoomShard.h"
+#include "Room/RoomDirectory.h"
+#include "Const.h"
+#include <afunix.h>
+
+namespace
+{
+	SOCKET ConnectToShard(int shard)
+	{
+		SOCKET s = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (s == INVALID_SOCKET)
+			return INVALID_SOCKET;
+		sockaddr_un addr{};
+		addr.sun_family = AF_UNIX;
+		RoomShard::GetSocketPath(shard).copy(addr.sun_path, sizeof(addr.sun_path) - 1);
+		if (connect(s, (sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR)
+		{
+			closesocket(s);
+			return INVALID_SOCKET;
+		}
+		return s;
+	}
+
+	bool RecvExact(SOCKET s, uint8_t* buf, size_t len)
+	{
+		size_t got = 0;
+		while (got < len)
+		{
+			int n = recv(s, (char*)buf + got, (int)(len - got), 0);
+			if (n <= 0)
+				return false;
+			got += n;
+		}
+		return true;
+	}
+
+	// calls func for every whole pack in a record body, false if the body does not split into packs
+	// packs inside an rpc_client_batch are visited too when unwrap is set, the batch itself is not
+	template <typename Func>
+	bool ForEachPack(const uint8_t* data, size_t len, bool unwrap, Func&& func)
+	{
+		size_t pos = 0;
+		while (pos < len)
+		{
+			uint16_t type = 0;
+			uint16_t size = 0;
+			if (len - pos < 4)
+				return false;
+			std::memcpy(&type, data + pos, 2);
+			std::memcpy(&size, data + pos + 2, 2);
+			// every pack handed to func is copied into a NetPack, which holds at most NET_PACK_MAX_LEN
+			if (type >= RpcEnum::INVALID || size < 4 || size > NET_PACK_MAX_LEN || size > len - pos)
+				return false;
+			if (unwrap && type == RpcEnum::rpc_client_batch)
+			{
+				if (!ForEachPack(data + pos + 4, size - 4, false, func))
+					return false;
+			}
+			else
+				func(data + pos, size);
+			pos += size;
+		}
+		return true;
+	}
+
+	// a lobby diff body, reassembled from fragments if the shard had to split it
+	struct BodyReader
+	{
+		const std::vector<uint8_t>& data;
+		size_t pos = 0;
+
+		template <typename T>
+		T Read()
+		{
+			T val{};
+			if (pos + sizeof(T) <= data.size())
+				std::memcpy(&val, data.data() + pos, sizeof(T));
+			pos += sizeof(T);
+			return val;
+		}
+	};
+
+	// rows and removals of one rpc_client_lobby_diff from shard into the local directory
+	void ApplyLobbyDiff(int shard, const std::vector<uint8_t>& body)
+	{
+		BodyReader reader{ body };
+		bool reset = reader.Read<uint8_t>() != 0;
+		reader.Read<uint32_t>(); // the shard's version, the local directory keeps its own
+		if (reset)
+			RoomDirectory::RemoveRoomsIf([shard](int roomId) { return RoomShard::ShardOf(roomId) == shard; });
+		uint32_t rowCount = reader.Read<uint32_t>();
+		for (uint32_t i = 0; i < rowCount && reader.pos < body.size(); i++)
+		{
+			RoomSummary row{};
+			row.roomId = reader.Read<int32_t>();
+			row.type = (Room::RoomType)reader.Read<uint16_t>();
+			row.memberCount = reader.Read<uint32_t>();
+			row.smallBlind = reader.Read<int32_t>();
+			row.bigBlind = reader.Read<int32_t>();
+			row.seatedCount = reader.Read<uint8_t>();
+			row.freeSeats = reader.Read<uint8_t>();
+			// a shard only speaks for its own range
+			if (RoomShard::ShardOf(row.roomId) == shard)
+				RoomDirectory::AddRoom(row);
+		}
+		uint32_t removedCount = reader.Read<uint32_t>();
+		for (uint32_t i = 0; i < removedCount && reader.pos < body.size(); i++)
+		{
+			int roomId = reader.Read<int32_t>();
+			if (RoomShard::ShardOf(roomId) == shard)
+				RoomDirectory::RemoveRoom(roomId);
+		}
+	}
+}
+
+ShardGateway& ShardGateway::Instance()
+{
+	static ShardGateway instance;
+	return instance;
+}
+
+bool ShardGateway::SendRecord(SOCKET s, uint32_t tunnel, Event event, const void* data, uint32_t len)
+{
+	if (len > MAX_RECORD_BYTES)
+		return false;
+	RecordHeader header{ tunnel, event, len };
+	if (send(s, (const char*)&header, sizeof(header), 0) == SOCKET_ERROR)
+		return false;
+	return len == 0 || send(s, (const char*)data, (int)len, 0) != SOCKET_ERROR;
+}
+
+bool ShardGateway::RecvRecord(SOCKET s, RecordHeader& header, std::vector<uint8_t>& body)
+{
+	if (!RecvExact(s, (uint8_t*)&header, sizeof(header)) || header.len > MAX_RECORD_BYTES)
+		return false;
+	body.resize(header.len);
+	return header.len == 0 || RecvExact(s, body.data(), header.len);
+}
+
+void ShardGateway::Start()
+{
+	if (ROOM_SHARD_COUNT == 1)
+		return;
+	if (RoomShard::GetSecret().empty())
+	{
+		std::cout << "STD ERROR: " << ROOM_SHARD_SECRET_ENV << " is not set, "
+			<< (RoomShard::IsGateway() ? "no shard will be linked" : "the gateway cannot link to this shard") << std::endl;
+		return;
+	}
+	if (!RoomShard::IsGateway())
+		return;
+	for (int shard = 1; shard < ROOM_SHARD_COUNT; shard++)
+		std::thread(&ShardGateway::LinkJob, &Instance(), shard).detach();
+}
+
+bool ShardGateway::SendLocked(Link& link, uint32_t tunnel, Event event, const void* data, uint32_t len)
+{
+	if (!link.open)
+		return false;
+	if (SendRecord(link.socket, tunnel, event, data, len))
+		return true;
+	link.open = false;
+	// LinkJob's recv fails right away and it closes the socket
+	shutdown(link.socket, SD_BOTH);
+	return false;
+}
+
+void ShardGateway::LinkJob(int shard)
+{
+	auto& link = _links[shard];
+	RecordHeader header{};
+	std::vector<uint8_t> body{};
+	while (true)
+	{
+		SOCKET s = ConnectToShard(shard);
+		if (s == INVALID_SOCKET)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(ROOM_SHARD_RECONNECT_MS));
+			continue;
+		}
+		{
+			std::lock_guard<std::mutex> lock(link.sendMutex);
+			link.socket = s;
+			link.open = true;
+			const std::string& secret = RoomShard::GetSecret();
+			NetPack subscribe{ RpcEnum::rpc_server_lobby_subscribe };
+			subscribe.WriteUInt16(RoomDirectory::Query::ANY_TYPE);
+			if (SendLocked(link, CONTROL_TUNNEL, Event::Hello, secret.data(), (uint32_t)secret.size()) &&
+				SendLocked(link, CONTROL_TUNNEL, Event::Open, nullptr, 0) &&
+				SendLocked(link, CONTROL_TUNNEL, Event::Data, subscribe.GetContent(), (uint32_t)subscribe.Length()))
+				std::cout << "ShardGateway: linked shard " << shard << ", mirroring its rooms" << std::endl;
+		}
+
+		// the first diff is a snapshot and resets whatever an earlier link left behind
+		std::unordered_map<uint32_t, std::vector<uint8_t>> partial{};
+		while (RecvRecord(s, header, body))
+		{
+			if (header.tunnel != CONTROL_TUNNEL)
+			{
+				if (header.event == Event::Data)
+					Relay(header.tunnel, body);
+				else if (header.event == Event::Close)
+				{
+					// the shard dropped the player or never knew it, the next packet attaches it again
+					std::lock_guard<std::mutex> lock(link.attachedMutex);
+					link.attached.erase(header.tunnel);
+				}
+				continue;
+			}
+			// a shard closes the control tunnel when it refused the secret
+			if (header.event == Event::Close)
+				break;
+			if (header.event != Event::Data)
+				continue;
+			ForEachPack(body.data(), body.size(), true, [shard, &partial](const uint8_t* data, uint16_t size)
+				{
+					NetPack pack{ const_cast<uint8_t*>(data) };
+					if (pack.MsgType() == RpcEnum::rpc_client_lobby_diff)
+					{
+						std::vector<uint8_t> diff(data + 4, data + size);
+						ApplyLobbyDiff(shard, diff);
+					}
+					else if (pack.MsgType() == RpcEnum::rpc_client_fragment)
+					{
+						uint32_t streamId = pack.ReadUInt32();
+						uint16_t innerType = pack.ReadUInt16();
+						bool last = pack.ReadUInt8() != 0;
+						auto& diff = partial[streamId];
+						diff.insert(diff.end(), data + 11, data + size);
+						if (last)
+						{
+							if (innerType == RpcEnum::rpc_client_lobby_diff)
+								ApplyLobbyDiff(shard, diff);
+							partial.erase(streamId);
+						}
+					}
+				});
+		}
+
+		std::unordered_set<PlayerHandle> dropped{};
+		{
+			std::lock_guard<std::mutex> lock(link.sendMutex);
+			link.open = false;
+			closesocket(link.socket);
+			link.socket = INVALID_SOCKET;
+			std::lock_guard<std::mutex> attachedLock(link.attachedMutex);
+			dropped.swap(link.attached);
+		}
+		std::cout << "STD ERROR: ShardGateway lost shard " << shard << ", its rooms are unlisted until it is back" << std::endl;
+		RoomDirectory::RemoveRoomsIf([shard](int roomId) { return RoomShard::ShardOf(roomId) == shard; });
+		// the shard tore its players down with the link, they are in none of its rooms anymore
+		for (PlayerHandle handle : dropped)
+		{
+			PlayerMgr::WithPlayer(handle, [shard](Player* p)
+				{
+					for (int roomId : p->GetRooms())
+						if (RoomShard::ShardOf(roomId) == shard)
+							p->TrackRemoteRoom(roomId, false);
+				});
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(ROOM_SHARD_RECONNECT_MS));
+	}
+}
+
+void ShardGateway::Relay(uint32_t tunnel, const std::vector<uint8_t>& body)
+{
+	PlayerMgr::WithPlayer(tunnel, [this, &body](Player* p)
+		{
+			// keep the gateway's room list in step, the client only ever talks to the gateway
+			bool whole = ForEachPack(body.data(), body.size(), true, [p](const uint8_t* data, uint16_t size)
+				{
+					NetPack pack{ const_cast<uint8_t*>(data) };
+					if (pack.MsgType() == RpcEnum::rpc_client_goto_room || pack.MsgType() == RpcEnum::rpc_client_leave_room)
+						p->TrackRemoteRoom(pack.ReadInt32(), pack.MsgType() == RpcEnum::rpc_client_goto_room);
+				});
+			if (!whole)
+				return;
+			ForEachPack(body.data(), body.size(), false, [this, p](const uint8_t* data, uint16_t size)
+				{
+					NetPack pack{ const_cast<uint8_t*>(data) };
+					_relayed++;
+					p->Send(pack);
+				});
+		});
+}
+
+bool ShardGateway::Forward(Player* owner, int shard, NetPack& pack)
+{
+	auto& gateway = Instance();
+	if (owner == nullptr || !RoomShard::IsGateway() || shard <= 0 || shard >= ROOM_SHARD_COUNT)
+		return false;
+	auto& link = gateway._links[shard];
+	PlayerHandle handle = owner->GetHandle();
+	std::lock_guard<std::mutex> lock(link.sendMutex);
+	bool attached = false;
+	{
+		std::lock_guard<std::mutex> attachedLock(link.attachedMutex);
+		attached = link.attached.contains(handle);
+	}
+	if (!attached)
+	{
+		// logs the player in on the shard before anything else arrives in its tunnel
+		NetPack attach{ RpcEnum::rpc_server_shard_attach };
+		owner->GetInfo().WriteInfo(attach);
+		if (!gateway.SendLocked(link, handle, Event::Open, nullptr, 0) ||
+			!gateway.SendLocked(link, handle, Event::Data, attach.GetContent(), (uint32_t)attach.Length()))
+		{
+			gateway._failed++;
+			return false;
+		}
+		std::lock_guard<std::mutex> attachedLock(link.attachedMutex);
+		link.attached.insert(handle);
+	}
+	if (!gateway.SendLocked(link, handle, Event::Data, pack.GetContent(), (uint32_t)pack.Length()))
+	{
+		gateway._failed++;
+		return false;
+	}
+	gateway._forwarded++;
+	return true;
+}
+
+void ShardGateway::DropPlayer(PlayerHandle owner)
+{
+	if (ROOM_SHARD_COUNT == 1 || !RoomShard::IsGateway())
+		return;
+	auto& gateway = Instance();
+	for (int shard = 1; shard < ROOM_SHARD_COUNT; shard++)
+	{
+		auto& link = gateway._links[shard];
+		std::lock_guard<std::mutex> lock(link.sendMutex);
+		size_t erased = 0;
+		{
+			std::lock_guard<std::mutex> attachedLock(link.attachedMutex);
+			erased = link.attached.erase(owner);
+		}
+		if (erased > 0)
+			gateway.SendLocked(link, owner, Event::Close, nullptr, 0);
+	}
+}
+
+void ShardGateway::DebugPrint()
+{
+	if (ROOM_SHARD_COUNT == 1 || !RoomShard::IsGateway())
+		return;
+	auto& gateway = Instance();
+	int linkCount = 0;
+	size_t tunnelCount = 0;
+	for (int shard = 1; shard < ROOM_SHARD_COUNT; shard++)
+	{
+		auto& link = gateway._links[shard];
+		{
+			std::lock_guard<std::mutex> lock(link.sendMutex);
+			linkCount += link.open ? 1 : 0;
+		}
+		std::lock_guard<std::mutex> lock(link.attachedMutex);
+		tunnelCount += link.attached.size();
+	}
+	std::cout << "[SHARD GATEWAY REPORT] links up: " << linkCount << "/" << ROOM_SHARD_COUNT - 1 << ", tunnels: " << tunnelCount
+		<< ", forwarded: " << gateway._forwarded.load() << ", relayed: " << gateway._relayed.load()
+		<< ", failed: " << gateway._failed.load() << std::endl;
+}
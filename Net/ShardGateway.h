@@ -0,0 +1,88 @@
+#pragma once
+#include "CppServerAPI.h"
+#include "Const.h"
+#include "Player/PlayerHandle.h"
+#include <array>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <unordered_set>
+
+class NetPack;
+class Player;
+
+// gateway side of cross-process room sharding, see RoomShard
+// the gateway keeps one unix socket link per shard and every record on it is tagged with a tunnel: the gateway handle
+// of the player it belongs to. a player that touches a room on shard k opens its tunnel on k's link and is attached
+// with rpc_server_shard_attach, so on the shard it is an ordinary logged in player and rooms run unchanged (see ShardHost).
+// room-routed packets go down the tunnel as the client sent them, whatever the shard sends back is relayed to the client.
+// tunnel CONTROL_TUNNEL subscribes to the shard's lobby feed and mirrors its rows into the local RoomDirectory,
+// so queries, listings and lobby pushes on the gateway cover every shard.
+// a link opens with the secret from ROOM_SHARD_SECRET_ENV, a shard reads nothing else from a link until it matches.
+class CPPSERVER_API ShardGateway
+{
+public:
+	enum class Event : uint32_t
+	{
+		// first record of a link, the body is the shard secret
+		Hello,
+		// gateway -> shard, a player starts using its tunnel
+		Open,
+		Data,
+		// either way, the tunnel is gone on the sending side
+		Close,
+	};
+	// in front of every record on a link, len bytes of body follow
+	struct RecordHeader
+	{
+		uint32_t tunnel;
+		Event event;
+		uint32_t len;
+	};
+	// the lobby subscription of the gateway, every other tunnel is a player handle and handles are never 0
+	static constexpr uint32_t CONTROL_TUNNEL = INVALID_PLAYER_HANDLE;
+	// a body is one pack from the gateway and one outbox write from a shard
+	static constexpr uint32_t MAX_RECORD_BYTES = 1 << 20;
+
+	// blocking, the caller keeps other writers of the socket out
+	static bool SendRecord(SOCKET s, uint32_t tunnel, Event event, const void* data, uint32_t len);
+	static bool RecvRecord(SOCKET s, RecordHeader& header, std::vector<uint8_t>& body);
+
+private:
+	struct Link
+	{
+		SOCKET socket = INVALID_SOCKET;
+		// guards socket and open
+		std::mutex sendMutex;
+		bool open = false;
+		// players with an open tunnel on the shard, the reader updates it too so it is never held across a send
+		std::unordered_set<PlayerHandle> attached{};
+		std::mutex attachedMutex;
+	};
+
+	static ShardGateway& Instance();
+
+	std::array<Link, ROOM_SHARD_COUNT> _links{};
+
+	std::atomic<uint64_t> _forwarded{ 0 };
+	std::atomic<uint64_t> _relayed{ 0 };
+	std::atomic<uint64_t> _failed{ 0 };
+
+	void LinkJob(int shard);
+	// caller holds link.sendMutex, a failed write shuts the socket down and LinkJob cleans up
+	bool SendLocked(Link& link, uint32_t tunnel, Event event, const void* data, uint32_t len);
+	void Relay(uint32_t tunnel, const std::vector<uint8_t>& body);
+
+	ShardGateway() = default;
+	ShardGateway(const ShardGateway&) = delete;
+	ShardGateway& operator=(const ShardGateway&) = delete;
+
+public:
+	// starts one link per shard, only on the gateway and only with more than one shard
+	static void Start();
+	// false if the shard cannot be reached
+	static bool Forward(Player* owner, int shard, NetPack& pack);
+	// closes the player's tunnels, each shard tears its side down like any dropped client
+	static void DropPlayer(PlayerHandle owner);
+	static void DebugPrint();
+};
@@ -0,0 +1,194 @@
+#include "pch.h"
+#include "ShardHost.h"
+#include "Room/RoomShard.h"
+
+using Event = ShardGateway::Event;
+
+ShardHost& ShardHost::Instance()
+{
+	static ShardHost instance;
+	return instance;
+}
+
+void ShardHost::Accept(SOCKET&& socket)
+{
+	auto& host = Instance();
+	auto link = std::make_shared<Link>();
+	link->socket = socket;
+	link->seq = host._nextLinkSeq.fetch_add(1);
+	socket = INVALID_SOCKET;
+	std::thread(&ShardHost::LinkJob, &host, link).detach();
+}
+
+std::shared_ptr<ShardHost::Link> ShardHost::FindLink(uint64_t tunnel)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	auto it = _links.find((uint32_t)(tunnel >> 32));
+	return it != _links.end() ? it->second : nullptr;
+}
+
+bool ShardHost::Push(Link& link, uint32_t tunnel, Event event, const void* data, uint32_t len)
+{
+	std::lock_guard<std::mutex> lock(link.sendMutex);
+	if (link.socket == INVALID_SOCKET)
+		return false;
+	if (ShardGateway::SendRecord(link.socket, tunnel, event, data, len))
+		return true;
+	// the reader's recv fails right away and it drops every tunnel of the link
+	shutdown(link.socket, SD_BOTH);
+	return false;
+}
+
+void ShardHost::LinkJob(std::shared_ptr<Link> link)
+{
+	ShardGateway::RecordHeader header{};
+	std::vector<uint8_t> body{};
+	// the first record has to carry the secret, anything else on the link is not even parsed
+	if (!ShardGateway::RecvRecord(link->socket, header, body) || header.event != Event::Hello ||
+		!RoomShard::CheckSecret(body.data(), body.size()))
+	{
+		_refused++;
+		std::cout << "STD ERROR: ShardHost refused a link without the shard secret" << std::endl;
+		Push(*link, ShardGateway::CONTROL_TUNNEL, Event::Close, nullptr, 0);
+		std::lock_guard<std::mutex> lock(link->sendMutex);
+		closesocket(link->socket);
+		link->socket = INVALID_SOCKET;
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_links[link->seq] = link;
+	}
+	std::cout << "ShardHost: gateway linked" << std::endl;
+
+	while (ShardGateway::RecvRecord(link->socket, header, body))
+	{
+		if (header.event == Event::Open)
+		{
+			PlayerHandle handle = PlayerMgr::OnShardTunnelOpened(MakeTunnelId(link->seq, header.tunnel));
+			if (handle == INVALID_PLAYER_HANDLE)
+			{
+				Push(*link, header.tunnel, Event::Close, nullptr, 0);
+				continue;
+			}
+			PlayerHandle previous = INVALID_PLAYER_HANDLE;
+			{
+				std::lock_guard<std::mutex> lock(link->tunnelsMutex);
+				auto& bound = link->tunnels[header.tunnel];
+				previous = bound;
+				bound = handle;
+			}
+			// the gateway reopened a tunnel it had not closed, the old player must not linger
+			if (previous != INVALID_PLAYER_HANDLE)
+				PlayerMgr::WithPlayer(previous, [](Player* p) { p->OnConnectionLost(0, 0); });
+			continue;
+		}
+
+		PlayerHandle handle = INVALID_PLAYER_HANDLE;
+		{
+			std::lock_guard<std::mutex> lock(link->tunnelsMutex);
+			auto it = link->tunnels.find(header.tunnel);
+			if (it != link->tunnels.end())
+			{
+				handle = it->second;
+				if (header.event == Event::Close)
+					link->tunnels.erase(it);
+			}
+		}
+		if (header.event == Event::Close)
+		{
+			if (handle != INVALID_PLAYER_HANDLE)
+				PlayerMgr::WithPlayer(handle, [](Player* p) { p->OnConnectionLost(0, 0); });
+			continue;
+		}
+		if (header.event != Event::Data)
+			continue;
+		// a tunnel this side already dropped, the close tells the gateway to attach the player again
+		if (handle == INVALID_PLAYER_HANDLE)
+		{
+			Push(*link, header.tunnel, Event::Close, nullptr, 0);
+			continue;
+		}
+		// the gateway only forwards whole packs, anything else means the two sides disagree about the format
+		uint16_t type = 0;
+		uint16_t size = 0;
+		if (body.size() >= 4)
+		{
+			std::memcpy(&type, body.data(), 2);
+			std::memcpy(&size, body.data() + 2, 2);
+		}
+		if (body.size() < 4 || size != body.size() || size > NET_PACK_MAX_LEN || type >= RpcEnum::INVALID)
+		{
+			std::cout << "STD ERROR: ShardHost malformed pack in tunnel " << header.tunnel << std::endl;
+			continue;
+		}
+		_received++;
+		NetPack pack{ body.data() };
+		PlayerMgr::WithPlayer(handle, [&pack](Player* p) { p->OnRecv(std::move(pack)); });
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_links.erase(link->seq);
+	}
+	std::unordered_map<uint32_t, PlayerHandle> tunnels{};
+	{
+		std::lock_guard<std::mutex> lock(link->tunnelsMutex);
+		tunnels.swap(link->tunnels);
+	}
+	std::cout << "STD ERROR: ShardHost lost the gateway link, dropping " << tunnels.size() << " players" << std::endl;
+	for (auto& [tunnel, handle] : tunnels)
+		PlayerMgr::WithPlayer(handle, [](Player* p) { p->OnConnectionLost(0, 0); });
+	std::lock_guard<std::mutex> lock(link->sendMutex);
+	closesocket(link->socket);
+	link->socket = INVALID_SOCKET;
+}
+
+bool ShardHost::Send(uint64_t tunnel, const char* data, uint32_t len)
+{
+	auto& host = Instance();
+	auto link = host.FindLink(tunnel);
+	if (link == nullptr || !host.Push(*link, (uint32_t)(tunnel & 0xFFFFFFFF), Event::Data, data, len))
+		return false;
+	host._sent++;
+	return true;
+}
+
+void ShardHost::Close(uint64_t tunnel, PlayerHandle owner)
+{
+	auto& host = Instance();
+	auto link = host.FindLink(tunnel);
+	if (link == nullptr)
+		return;
+	uint32_t id = (uint32_t)(tunnel & 0xFFFFFFFF);
+	{
+		// a reopened tunnel belongs to another player by now, its closing predecessor leaves it alone
+		std::lock_guard<std::mutex> lock(link->tunnelsMutex);
+		auto it = link->tunnels.find(id);
+		if (it == link->tunnels.end() || it->second != owner)
+			return;
+		link->tunnels.erase(it);
+	}
+	host.Push(*link, id, Event::Close, nullptr, 0);
+}
+
+void ShardHost::DebugPrint()
+{
+	if (RoomShard::IsGateway())
+		return;
+	auto& host = Instance();
+	size_t linkCount = 0;
+	size_t tunnelCount = 0;
+	{
+		std::lock_guard<std::mutex> lock(host._mutex);
+		linkCount = host._links.size();
+		for (auto& [seq, link] : host._links)
+		{
+			std::lock_guard<std::mutex> tunnelsLock(link->tunnelsMutex);
+			tunnelCount += link->tunnels.size();
+		}
+	}
+	std::cout << "[SHARD HOST REPORT] shard " << RoomShard::GetLocalShard() << ", links: " << linkCount
+		<< ", tunnels: " << tunnelCount << ", received: " << host._received.load() << ", sent: " << host._sent.load()
+		<< ", refused: " << host._refused.load() << std::endl;
+}
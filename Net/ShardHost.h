@@ -0,0 +1,57 @@
+#pragma once
+#include "CppServerAPI.h"
+#include "ShardGateway.h"
+#include "Player/PlayerHandle.h"
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+
+// shard side of the links ShardGateway keeps, see RoomShard
+// every accepted socket of a shard is a gateway link, read by one thread. nothing on it is looked at before a
+// Hello record with the shard secret; a link that fails that is closed. each tunnel the gateway opens is an
+// ordinary Player here without a socket or recv thread, like a front connection: its packets come from the
+// link's reader and go through OnRecv, what it sends goes back down the link tagged with its tunnel.
+class CPPSERVER_API ShardHost
+{
+	struct Link
+	{
+		SOCKET socket = INVALID_SOCKET;
+		uint32_t seq = 0;
+		// guards socket, the reader closes it once it is done
+		std::mutex sendMutex;
+		// gateway tunnel -> the player running it here
+		std::unordered_map<uint32_t, PlayerHandle> tunnels{};
+		std::mutex tunnelsMutex;
+	};
+
+	static ShardHost& Instance();
+
+	std::unordered_map<uint32_t, std::shared_ptr<Link>> _links{};
+	std::mutex _mutex;
+	std::atomic<uint32_t> _nextLinkSeq{ 1 };
+
+	std::atomic<uint64_t> _received{ 0 };
+	std::atomic<uint64_t> _sent{ 0 };
+	std::atomic<uint64_t> _refused{ 0 };
+
+	void LinkJob(std::shared_ptr<Link> link);
+	std::shared_ptr<Link> FindLink(uint64_t tunnel);
+	bool Push(Link& link, uint32_t tunnel, ShardGateway::Event event, const void* data, uint32_t len);
+
+	ShardHost() = default;
+	ShardHost(const ShardHost&) = delete;
+	ShardHost& operator=(const ShardHost&) = delete;
+
+public:
+	// link sequence numbers start at 1, so 0 is never a tunnel
+	static uint64_t MakeTunnelId(uint32_t linkSeq, uint32_t tunnel) { return ((uint64_t)linkSeq << 32) | tunnel; }
+
+	// takes a socket accepted on the shard's listener and starts its reader
+	static void Accept(SOCKET&& socket);
+	// false if the link is gone or the write failed, the caller treats that like a failed send()
+	static bool Send(uint64_t tunnel, const char* data, uint32_t len);
+	// owner is the player closing it, a no-op once the tunnel is bound to someone else
+	static void Close(uint64_t tunnel, PlayerHandle owner);
+	static void DebugPrint();
+};
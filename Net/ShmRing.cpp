@@ -0,0 +1,152 @@
+#include "pch.h"
+#include "ShmRing.h"
+#include <bit>
+
+namespace
+{
+	constexpr uint32_t SKIP_MARKER = UINT32_MAX;
+	constexpr uint64_t RECORD_ALIGN = 8;
+	constexpr uint64_t READY_MAGIC = 0x574B5252494E4731; // "WKRRING1"
+
+	uint64_t RecordSize(uint32_t payloadLen)
+	{
+		return (sizeof(uint32_t) + payloadLen + RECORD_ALIGN - 1) & ~(RECORD_ALIGN - 1);
+	}
+}
+
+ShmRing::~ShmRing()
+{
+	Unmap();
+}
+
+void ShmRing::Unmap()
+{
+	if (_header != nullptr)
+		UnmapViewOfFile(_header);
+	if (_mapping != nullptr)
+		CloseHandle(_mapping);
+	_mapping = nullptr;
+	_header = nullptr;
+	_data = nullptr;
+	_capacity = 0;
+}
+
+bool ShmRing::Map(void* mapping)
+{
+	_mapping = mapping;
+	void* view = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+	if (view == nullptr)
+	{
+		std::cout << "STD ERROR: ShmRing MapViewOfFile failed: " << GetLastError() << std::endl;
+		return false;
+	}
+	_header = static_cast<Header*>(view);
+	_data = static_cast<uint8_t*>(view) + sizeof(Header);
+	return true;
+}
+
+bool ShmRing::Create(const std::string& name, uint64_t capacity)
+{
+	capacity = std::bit_ceil(std::max<uint64_t>(capacity, 4096));
+	uint64_t total = sizeof(Header) + capacity;
+	HANDLE mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+		(DWORD)(total >> 32), (DWORD)(total & 0xFFFFFFFF), name.c_str());
+	if (mapping == NULL)
+	{
+		std::cout << "STD ERROR: ShmRing CreateFileMapping " << name << " failed: " << GetLastError() << std::endl;
+		return false;
+	}
+	if (!Map(mapping))
+	{
+		Unmap();
+		return false;
+	}
+	// a fresh mapping is zero filled, a leftover one from an earlier run is reset here before any peer opens it
+	_header->ready.store(0);
+	_header->head.store(0);
+	_header->tail.store(0);
+	_header->capacity = capacity;
+	_capacity = capacity;
+	_header->ready.store(READY_MAGIC, std::memory_order_release);
+	return true;
+}
+
+bool ShmRing::Open(const std::string& name)
+{
+	HANDLE mapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, name.c_str());
+	if (mapping == NULL)
+		return false;
+	if (!Map(mapping))
+	{
+		Unmap();
+		return false;
+	}
+	// the name exists as soon as the creator made the mapping, its header may not be written yet
+	if (_header->ready.load(std::memory_order_acquire) != READY_MAGIC)
+	{
+		Unmap();
+		return false;
+	}
+	uint64_t capacity = _header->capacity;
+	MEMORY_BASIC_INFORMATION info{};
+	if (capacity < 4096 || !std::has_single_bit(capacity) ||
+		VirtualQuery(_header, &info, sizeof(info)) == 0 || info.RegionSize < sizeof(Header) + capacity)
+	{
+		std::cout << "STD ERROR: ShmRing " << name << " has a bad capacity: " << capacity << std::endl;
+		Unmap();
+		return false;
+	}
+	_capacity = capacity;
+	return true;
+}
+
+bool ShmRing::TryPush(const void* first, uint32_t firstLen, const void* second, uint32_t secondLen)
+{
+	uint32_t len = firstLen + secondLen;
+	uint64_t need = RecordSize(len);
+	uint64_t tail = _header->tail.load(std::memory_order_relaxed);
+	uint64_t head = _header->head.load(std::memory_order_acquire);
+	uint64_t offset = tail & (_capacity - 1);
+	// a record that would cross the end needs the rest of the buffer for the skip marker as well
+	uint64_t untilEnd = _capacity - offset;
+	uint64_t total = need <= untilEnd ? need : untilEnd + need;
+	if (need > _capacity / 2 || tail + total - head > _capacity)
+		return false;
+	if (need > untilEnd)
+	{
+		std::memcpy(_data + offset, &SKIP_MARKER, sizeof(uint32_t));
+		tail += untilEnd;
+		offset = 0;
+	}
+	std::memcpy(_data + offset, &len, sizeof(uint32_t));
+	std::memcpy(_data + offset + sizeof(uint32_t), first, firstLen);
+	if (secondLen > 0)
+		std::memcpy(_data + offset + sizeof(uint32_t) + firstLen, second, secondLen);
+	_header->tail.store(tail + need, std::memory_order_release);
+	return true;
+}
+
+bool ShmRing::TryPop(const std::function<void(const uint8_t*, uint32_t)>& func)
+{
+	uint64_t head = _header->head.load(std::memory_order_relaxed);
+	uint64_t tail = _header->tail.load(std::memory_order_acquire);
+	if (head == tail)
+		return false;
+	uint64_t offset = head & (_capacity - 1);
+	uint32_t len = 0;
+	std::memcpy(&len, _data + offset, sizeof(uint32_t));
+	if (len == SKIP_MARKER)
+	{
+		head += _capacity - offset;
+		offset = 0;
+		std::memcpy(&len, _data, sizeof(uint32_t));
+	}
+	func(_data + offset + sizeof(uint32_t), len);
+	_header->head.store(head + RecordSize(len), std::memory_order_release);
+	return true;
+}
+
+uint64_t ShmRing::GetUsedBytes() const
+{
+	return _header->tail.load(std::memory_order_relaxed) - _header->head.load(std::memory_order_relaxed);
+}
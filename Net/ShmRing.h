@@ -0,0 +1,48 @@
+#pragma once
+#include "CppServerAPI.h"
+#include <string>
+#include <atomic>
+#include <functional>
+
+// single producer single consumer byte ring in a named file mapping, shared by the front and logic processes
+// records are [length u32][payload] padded to 8 bytes; a record never wraps, the producer writes a skip
+// marker over the rest of the buffer and starts again at offset 0.
+// head is only written by the consumer and tail only by the producer, each on its own cache line,
+// the producer publishes a record with a release store of tail and the consumer frees it with a release store of head.
+class CPPSERVER_API ShmRing
+{
+	struct Header
+	{
+		alignas(64) std::atomic<uint64_t> head;
+		alignas(64) std::atomic<uint64_t> tail;
+		alignas(64) uint64_t capacity;
+		// READY_MAGIC once the creator has reset everything above, Open refuses the ring until then
+		std::atomic<uint64_t> ready;
+	};
+
+	void* _mapping = nullptr;
+	Header* _header = nullptr;
+	uint8_t* _data = nullptr;
+	uint64_t _capacity = 0;
+
+	bool Map(void* mapping);
+	void Unmap();
+
+public:
+	ShmRing() = default;
+	~ShmRing();
+	ShmRing(const ShmRing&) = delete;
+	ShmRing& operator=(const ShmRing&) = delete;
+
+	// creates the mapping (capacity rounded up to a power of two) or opens one another process created
+	bool Create(const std::string& name, uint64_t capacity);
+	bool Open(const std::string& name);
+	bool IsOpen() const { return _header != nullptr; }
+
+	// one record out of two pieces (a header and a pack, usually), false if it does not fit right now
+	bool TryPush(const void* first, uint32_t firstLen, const void* second, uint32_t secondLen);
+	// hands the oldest record to func, which must not keep the pointer; false if the ring is empty
+	bool TryPop(const std::function<void(const uint8_t*, uint32_t)>& func);
+	// bytes in flight, for reports
+	uint64_t GetUsedBytes() const;
+};
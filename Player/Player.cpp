@@ -2,51 +2,202 @@
 #include "Player.h"
 #include "Net/NetPackHandler.h"
 #include "Room/RoomMgr.h"
+#include "SessionToken.h"
+#include "Net/ShardGateway.h"
+#include "Room/RoomShard.h"
+#include "Net/FrontLink.h"
+#include "Net/ShardHost.h"
+#include <future>
 
 
-Player::Player(SOCKET&& socket) :
-	m_socket(socket)
+Player::Player(SOCKET&& socket, PlayerHandle handle) :
+	m_socket(socket), m_handle(handle)
+{
+	m_recvThread = std::thread(&Player::RecvJob, this, m_socket, m_connectionSeq);
+}
+Player::Player(PlayerHandle handle, uint64_t frontConn) :
+	m_socket(INVALID_SOCKET), m_frontConn(frontConn), m_handle(handle)
+{
+}
+Player::Player(PlayerHandle handle, ShardTunnel tunnel) :
+	m_socket(INVALID_SOCKET), m_shardTunnel(tunnel.id), m_handle(handle)
 {
-	m_recvThread = std::thread(&Player::RecvJob, this);
 }
 Player::~Player()
 {
 	if (m_deleted.load()) return;
 	Delete();
 }
-void Player::RecvJob()
+void Player::RecvJob(SOCKET socket, uint32_t connectionSeq)
 {
-	char recvbuf[NET_PACK_MAX_LEN];
-	int recvbuflen = NET_PACK_MAX_LEN;
+	uint8_t recvbuf[NET_PACK_MAX_LEN * 2];
+	size_t filled = 0;
 	int iResult;
 	// Receive until the peer shuts down the connection
 	do {
-		iResult = recv(m_socket, recvbuf, recvbuflen, 0);
-		if (iResult > 0)
+		iResult = recv(socket, (char*)recvbuf + filled, (int)(sizeof(recvbuf) - filled), 0);
+		if (iResult <= 0)
+			break;
+		filled += iResult;
+		// one recv may end inside a pack or hold several, split on the header size
+		size_t offset = 0;
+		while (filled - offset >= 4 && m_connected.load() && !m_deleted.load())
 		{
-			NetPack pack = NetPack((uint8_t*)recvbuf);
+			uint16_t size = 0;
+			std::memcpy(&size, recvbuf + offset + 2, 2);
+			if (size < 4 || size > NET_PACK_MAX_LEN)
+			{
+				iResult = SOCKET_ERROR;
+				break;
+			}
+			if (filled - offset < size)
+				break;
+			NetPack pack = NetPack(recvbuf + offset);
 			OnRecv(std::move(pack));
+			offset += size;
 		}
-		else
-			break;
-	} while (iResult > 0 && !m_deleted.load());
-	m_recvThread.detach();
+		std::memmove(recvbuf, recvbuf + offset, filled - offset);
+		filled -= offset;
+	} while (iResult > 0 && m_connected.load() && !m_deleted.load());
+	OnConnectionLost(connectionSeq, iResult);
 }
 void Player::OnRecv(NetPack&& pack)
 {
-	NetPackHandler::AddTask(m_selfPtr, pack);
+	// resumed right here on the recv thread, the socket changes owner and this loop has to stop before the next recv
+	if (pack.MsgType() == RpcEnum::rpc_server_resume_session && !m_loggedIn)
+	{
+		auto err = PlayerMgr::ResumeSession(m_handle, pack.ReadString());
+		SendError(err);
+		return;
+	}
+	NetPackHandler::AddTask(m_handle, pack);
 }
-void Player::Send(NetPack& pack)
+void Player::OnConnectionLost(uint32_t connectionSeq, int errCode)
 {
-	if (Expired()) return;
-	
 	std::lock_guard<std::mutex> lock(m_sendMutex);
-	// Double-check after acquiring lock
-	if (m_deleted.load()) return;
-	
-	auto iSendResult = send(m_socket, pack.GetContent(), (int)pack.Length(), 0);
-	if (iSendResult == SOCKET_ERROR)
-		Delete(iSendResult * 100);
+	if (!m_connected.load() || connectionSeq != m_connectionSeq)
+		return;
+	std::cout << "player connection lost(err " << errCode << ")" << (m_loggedIn ? ", parked for resume" : "") << std::endl;
+	m_connected.store(false);
+	// on a shard every player is a gateway tunnel, the gateway owns the session and reattaches if it needs to
+	m_resumable = m_loggedIn && !m_deleted.load() && RoomShard::IsGateway();
+	m_disconnectedAt = std::chrono::steady_clock::now();
+	CloseConnection();
+}
+bool Player::HandOffConnection(SOCKET& outSocket, uint64_t& outFrontConn)
+{
+	std::lock_guard<std::mutex> lock(m_sendMutex);
+	if (!m_connected.load() || m_deleted.load() || m_shardTunnel != 0)
+		return false;
+	outSocket = m_socket;
+	outFrontConn = m_frontConn;
+	m_socket = INVALID_SOCKET;
+	m_frontConn = 0;
+	m_connected.store(false);
+	m_resumable = false;
+	return true;
+}
+bool Player::WriteToConnection(const char* data, size_t len)
+{
+	if (m_shardTunnel != 0)
+		return ShardHost::Send(m_shardTunnel, data, (uint32_t)len);
+	if (m_frontConn != 0)
+		return FrontLink::Send(m_frontConn, data, (uint32_t)len);
+	return send(m_socket, data, (int)len, 0) != SOCKET_ERROR;
+}
+bool Player::WriteOutbox()
+{
+	// runs of queued packs are wrapped into rpc_client_batch frames of at most NET_PACK_MAX_LEN,
+	// a run of one goes out unwrapped; all frames leave in a single write
+	std::vector<char> frames{};
+	frames.reserve(m_outbox.size() + 4 * (m_outbox.size() / (NET_PACK_MAX_LEN - 4) + 1));
+	size_t pos = 0;
+	while (pos < m_outbox.size())
+	{
+		size_t end = pos;
+		int count = 0;
+		while (end < m_outbox.size())
+		{
+			uint16_t size = 0;
+			std::memcpy(&size, m_outbox.data() + end + 2, 2);
+			if (count > 0 && end + size - pos + 4 > NET_PACK_MAX_LEN)
+				break;
+			end += size;
+			count++;
+		}
+		if (count > 1)
+		{
+			uint16_t header[2] = { (uint16_t)RpcEnum::rpc_client_batch, (uint16_t)(end - pos + 4) };
+			frames.insert(frames.end(), (const char*)header, (const char*)header + sizeof(header));
+		}
+		frames.insert(frames.end(), m_outbox.begin() + pos, m_outbox.begin() + end);
+		pos = end;
+	}
+	m_outbox.clear();
+	return WriteToConnection(frames.data(), frames.size());
+}
+void Player::FlushOutbox()
+{
+	uint32_t connectionSeq = 0;
+	{
+		std::lock_guard<std::mutex> lock(m_sendMutex);
+		if (m_outbox.empty())
+			return;
+		if (m_deleted.load() || !m_connected.load())
+		{
+			m_outbox.clear();
+			return;
+		}
+		if (WriteOutbox())
+			return;
+		connectionSeq = m_connectionSeq;
+	}
+	OnConnectionLost(connectionSeq, SOCKET_ERROR * 100);
+}
+void Player::CloseConnection()
+{
+	m_outbox.clear();
+	if (m_shardTunnel != 0)
+		ShardHost::Close(m_shardTunnel, m_handle);
+	else if (m_frontConn != 0)
+	{
+		FrontLink::Close(m_frontConn);
+		m_frontConn = 0;
+	}
+	else if (m_socket != INVALID_SOCKET)
+	{
+		shutdown(m_socket, SD_SEND);
+		closesocket(m_socket);
+		m_socket = INVALID_SOCKET;
+	}
+}
+void Player::Send(NetPack& pack)
+{
+	uint32_t connectionSeq = 0;
+	{
+		std::lock_guard<std::mutex> lock(m_sendMutex);
+		// parked players drop whatever the rooms send them until they resume
+		if (m_deleted.load() || !m_connected.load()) return;
+
+		// PlayerMgr::FlushSendBatch clears the flag before it takes this lock, so nothing queued now can miss the flush
+		bool batching = PlayerMgr::IsBatchingSends();
+		if (!batching && m_outbox.empty())
+		{
+			if (WriteToConnection(pack.GetContent(), pack.Length()))
+				return;
+		}
+		else
+		{
+			// behind whatever is queued already, so the client sees packs in the order they were sent
+			m_outbox.insert(m_outbox.end(), pack.GetContent(), pack.GetContent() + pack.Length());
+			if (batching && m_outbox.size() < PLAYER_OUTBOX_FLUSH_BYTES)
+				return;
+			if (WriteOutbox())
+				return;
+		}
+		connectionSeq = m_connectionSeq;
+	}
+	OnConnectionLost(connectionSeq, SOCKET_ERROR * 100);
 }
 void Player::Send(RpcEnum msgType, std::function<void(NetPack&)> func)
 {
@@ -66,33 +217,126 @@ void Player::SendError(RpcError err)
 }
 void Player::Delete(int errCode)
 {
-	// Use compare_exchange to ensure only one thread enters
-	bool expected = false;
-	if (!m_deleted.compare_exchange_strong(expected, true))
+	if (!MarkDeleted())
 		return;
 	
 	std::cout << "delete player(err " << errCode << ")" << std::endl;
-	m_info.WriteInfoToDatabase();
-	m_info.WriteAssetToDatabase();
-	
+	// synchronous: waits for the rooms' executors to run the exits, so never call it from one of them
+	std::promise<bool> left{};
+	auto wasLoggedIn = left.get_future();
+	Detach([&left](bool loggedIn) { left.set_value(loggedIn); });
+	// a connection that never logged in has nothing to persist
+	// chips are not written here: every change already reached the db as a settlement, and the absolute count
+	// held in memory could overwrite one that settled while the player was leaving
+	if (wasLoggedIn.get())
+		m_info.WriteInfoToDatabase();
+	JoinRecvThread();
+}
+bool Player::MarkDeleted()
+{
+	// Use compare_exchange to ensure only one thread enters
+	bool expected = false;
+	return m_deleted.compare_exchange_strong(expected, true);
+}
+void Player::Detach(std::function<void(bool wasLoggedIn)> onLeft)
+{
+	bool wasLoggedIn = m_loggedIn;
 	// Leave all rooms before cleanup
-	LeaveAllRooms();
+	LeaveAllRooms([onLeft = std::move(onLeft), wasLoggedIn]() { onLeft(wasLoggedIn); });
+	// rooms on other shards are left when they see the connection close
+	ShardGateway::DropPlayer(m_handle);
 	
 	m_loggedIn = false;
-	m_selfPtr = nullptr;
 	
 	// Lock to ensure no send operations are in progress
 	{
 		std::lock_guard<std::mutex> lock(m_sendMutex);
-		shutdown(m_socket, SD_SEND);
-		closesocket(m_socket);
+		m_connected.store(false);
+		m_resumable = false;
+		CloseConnection();
+	}
+}
+void Player::JoinRecvThread()
+{
+	if (m_recvThread.joinable())
+	{
+		if (m_recvThread.get_id() == std::this_thread::get_id())
+			m_recvThread.detach();
+		else
+			m_recvThread.join();
 	}
-	
-	if (m_recvThread.joinable()) m_recvThread.join();
 }
 bool Player::Expired()
 {
-	return m_deleted.load() || !m_recvThread.joinable();
+	if (m_deleted.load()) return true;
+	if (m_connected.load()) return false;
+	std::lock_guard<std::mutex> lock(m_sendMutex);
+	if (m_connected.load()) return false;
+	// once the window is over it stays over, so a late resume cannot race the removal
+	if (m_resumable && std::chrono::steady_clock::now() - m_disconnectedAt >= std::chrono::milliseconds(SESSION_RESUME_GRACE_MS))
+		m_resumable = false;
+	return !m_resumable;
+}
+bool Player::IsConnected()
+{
+	return m_connected.load();
+}
+bool Player::Resume(uint64_t nonce, Player& from)
+{
+	std::thread oldRecvThread;
+	{
+		std::lock_guard<std::mutex> lock(m_sendMutex);
+		if (m_deleted.load() || m_connected.load() || !m_resumable || nonce != m_sessionNonce)
+			return false;
+		if (std::chrono::steady_clock::now() - m_disconnectedAt >= std::chrono::milliseconds(SESSION_RESUME_GRACE_MS))
+		{
+			m_resumable = false;
+			return false;
+		}
+		// from is never the target of a resume, so taking its lock inside ours cannot deadlock
+		SOCKET socket = INVALID_SOCKET;
+		uint64_t frontConn = 0;
+		if (!from.HandOffConnection(socket, frontConn))
+			return false;
+		m_socket = socket;
+		m_frontConn = frontConn;
+		m_connectionSeq++;
+		m_resumable = false;
+		m_connected.store(true);
+		oldRecvThread = std::move(m_recvThread);
+		// a front connection keeps arriving on its FrontLink reader, only who it is delivered to changes
+		if (m_frontConn != 0)
+			FrontLink::Rebind(m_frontConn, m_handle, m_connectionSeq);
+		else
+			m_recvThread = std::thread(&Player::RecvJob, this, m_socket, m_connectionSeq);
+	}
+	// the old thread saw its socket closed when the connection was lost, it is done or about to be
+	if (oldRecvThread.joinable())
+		oldRecvThread.join();
+	SendLoginState();
+	return true;
+}
+bool Player::DropParkedSession()
+{
+	std::lock_guard<std::mutex> lock(m_sendMutex);
+	if (m_connected.load() && !m_deleted.load())
+		return false;
+	m_resumable = false;
+	return true;
+}
+void Player::SendLoginState()
+{
+	uint64_t nonce = SessionToken::NewNonce();
+	{
+		std::lock_guard<std::mutex> lock(m_sendMutex);
+		m_sessionNonce = nonce;
+	}
+	NetPack login{ RpcEnum::rpc_client_log_in };
+	m_info.WriteInfo(login);
+	Send(login);
+	NetPack token{ RpcEnum::rpc_client_resume_session };
+	token.WriteString(SessionToken::Issue(GetID(), nonce));
+	Send(token);
 }
 PlayerInfo& Player::GetInfo()
 {
@@ -108,7 +352,7 @@ bool Player::IsLoggedIn()
 }
 RpcError Player::JoinRoom(int roomIdx)
 {
-	auto ret = RoomMgr::AddPlayerToRoom(m_selfPtr, roomIdx);
+	auto ret = RoomMgr::AddPlayerToRoom(this, roomIdx);
 	if (ret == RpcError::SUCCESS)
 	{
 		std::lock_guard<std::mutex> lock(m_roomsMutex);
@@ -118,7 +362,7 @@ RpcError Player::JoinRoom(int roomIdx)
 }
 RpcError Player::LeaveRoom(int roomIdx)
 {
-	auto ret = RoomMgr::RemovePlayerFromRoom(m_selfPtr, roomIdx);
+	auto ret = RoomMgr::RemovePlayerFromRoom(this, roomIdx);
 	if (ret == RpcError::SUCCESS)
 	{
 		std::lock_guard<std::mutex> lock(m_roomsMutex);
@@ -126,15 +370,31 @@ RpcError Player::LeaveRoom(int roomIdx)
 	}
 	return ret;
 }
-void Player::LeaveAllRooms()
+void Player::LeaveAllRooms(std::function<void()> onLeft)
 {
 	std::unordered_set<int> roomsCopy;
 	{
 		std::lock_guard<std::mutex> lock(m_roomsMutex);
 		roomsCopy = m_rooms;
 	}
+	// every exit holds a reference, the last one let go calls onLeft whether it ran or its room was removed first
+	std::shared_ptr<void> left(nullptr, [onLeft = std::move(onLeft)](void*) { onLeft(); });
 	for (int roomId : roomsCopy)
-		LeaveRoom(roomId);
+	{
+		// rooms on other shards are left there, see ShardGateway::DropPlayer
+		if (!RoomShard::IsLocal(roomId))
+			continue;
+		// only the room's executor touches the room, the exit queues behind whatever the player sent it before
+		RoomMgr::PostExitToRoom(roomId, m_handle, [roomId, left](Player* p) { p->LeaveRoom(roomId); });
+	}
+}
+void Player::TrackRemoteRoom(int roomIdx, bool joined)
+{
+	std::lock_guard<std::mutex> lock(m_roomsMutex);
+	if (joined)
+		m_rooms.insert(roomIdx);
+	else
+		m_rooms.erase(roomIdx);
 }
 std::unordered_set<int> Player::GetRooms()
 {
@@ -3,14 +3,28 @@
 #include "Net/RpcError.h"
 #include "Net/RpcEnum.h"
 #include "PlayerInfo.h"
+#include "PlayerHandle.h"
 #include <mutex>
 #include <atomic>
+#include <chrono>
 #include <unordered_set>
 
 class NetPack;
+class PlayerTeardown;
+class FrontLink;
+class ShardHost;
+// tag for a player that reached this shard through a gateway link, id is its tunnel, see ShardHost
+struct ShardTunnel
+{
+	uint64_t id;
+};
 class CPPSERVER_API Player
 {
 	SOCKET m_socket;
+	// set instead of m_socket when the connection lives in the front process, see FrontLink
+	uint64_t m_frontConn = 0;
+	// set instead of m_socket on a shard, a tunnel never resumes so it stays the same for the player's life
+	const uint64_t m_shardTunnel = 0;
 	PlayerInfo m_info{};
 	std::thread m_recvThread;
 	std::atomic<bool> m_deleted{false};
@@ -20,37 +34,90 @@ class CPPSERVER_API Player
 	mutable std::mutex m_roomsMutex;
 	
 	bool m_loggedIn = false;
-	std::shared_ptr<Player> m_selfPtr = nullptr;
+	// owned by PlayerMgr, everyone else refers to this player by handle
+	const PlayerHandle m_handle;
 	
-	// Mutex for protecting socket send operations
+	// Mutex for protecting socket send operations, also guards the connection state below
 	mutable std::mutex m_sendMutex;
+	// whole packs sent while PlayerMgr batches, written out together by FlushOutbox
+	std::vector<char> m_outbox{};
+
+	// a logged in player whose socket drops is parked instead of deleted, a resume within
+	// SESSION_RESUME_GRACE_MS rebinds a new socket to it (see PlayerMgr::ResumeSession)
+	std::atomic<bool> m_connected{ true };
+	bool m_resumable = false;
+	// bumped on every rebind so a recv thread of an older socket cannot park the new one
+	uint32_t m_connectionSeq = 0;
+	uint64_t m_sessionNonce = 0;
+	std::chrono::steady_clock::time_point m_disconnectedAt{};
 	
-	void RecvJob();
+	void RecvJob(SOCKET socket, uint32_t connectionSeq);
 	void OnRecv(NetPack&& pack);
+	void OnConnectionLost(uint32_t connectionSeq, int errCode);
+	// gives up the connection of a fresh player that resumed another session, this player expires right after
+	bool HandOffConnection(SOCKET& outSocket, uint64_t& outFrontConn);
+	// caller holds m_sendMutex
+	bool WriteToConnection(const char* data, size_t len);
+	bool WriteOutbox();
+	void CloseConnection();
+	// end of the tick, see PlayerMgr::FlushSendBatch
+	void FlushOutbox();
 public:
 	Player() = delete;
-	Player(SOCKET&& socket);
+	Player(SOCKET&& socket, PlayerHandle handle);
+	// a connection of the front process, packets arrive through FrontLink and there is no recv thread
+	Player(PlayerHandle handle, uint64_t frontConn);
+	// a gateway tunnel on a shard, packets arrive through ShardHost and there is no recv thread
+	Player(PlayerHandle handle, ShardTunnel tunnel);
 	~Player();
 	void Send(NetPack& pack);
 	void Send(RpcEnum msgType, std::function<void(NetPack&)> func);
 	void SendError(RpcError err);
+	// synchronous teardown, PlayerMgr::RemovePlayers goes through PlayerTeardown instead
 	void Delete(int errCode = 0);
+	// deleted, or disconnected and past its resume window
 	bool Expired();
+	bool IsConnected();
+
+	// rebinds the socket of from to this parked session if nonce matches, then sends the login state
+	bool Resume(uint64_t nonce, Player& from);
+	// a fresh login for the same account replaces a parked session, false if this one is still connected
+	bool DropParkedSession();
+	// rpc_client_log_in followed by a new resume token, which invalidates the previous one
+	void SendLoginState();
 
 	PlayerInfo& GetInfo();
 	void SetInfo(PlayerInfo newInfo);
 
 	bool IsLoggedIn();
+	// only these may attach, the link they came over showed the shard secret
+	bool IsShardTunnel() const { return m_shardTunnel != 0; }
 	
 	// Multi-room support methods
 	RpcError JoinRoom(int roomIdx);
 	RpcError LeaveRoom(int roomIdx);
-	void LeaveAllRooms();
+	// posts an exit to the executor of every local room, onLeft runs once all of them ran or were dropped with
+	// their room, on whichever thread lets go of the last one
+	void LeaveAllRooms(std::function<void()> onLeft);
 	std::unordered_set<int> GetRooms();
+	// rooms on another shard are joined and left there, ShardGateway reports the outcome here
+	void TrackRemoteRoom(int roomIdx, bool joined);
 	bool IsInRoom(int roomIdx);
 	
+	PlayerHandle GetHandle() const { return m_handle; }
 	int GetID();
 	std::string GetName();
 
 	friend PlayerMgr;
+	friend PlayerTeardown;
+	friend FrontLink;
+	friend ShardHost;
+
+private:
+	// teardown steps, in order; MarkDeleted is true only for the first caller
+	bool MarkDeleted();
+	// leaves every room and closes the socket, onLeft gets whether the player was logged in once the rooms
+	// processed the exits; the player must stay resolvable until then
+	void Detach(std::function<void(bool wasLoggedIn)> onLeft);
+	void JoinRecvThread();
 };
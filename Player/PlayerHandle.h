@@ -0,0 +1,7 @@
+#pragma once
+#include <cstdint>
+
+// 32-bit generational handle of a connected player, see PlayerSlotMap
+// index in the low PLAYER_HANDLE_INDEX_BITS, generation above it; 0 is never a valid handle
+using PlayerHandle = uint32_t;
+constexpr PlayerHandle INVALID_PLAYER_HANDLE = 0;
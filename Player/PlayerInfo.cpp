@@ -1,6 +1,7 @@
 #include "pch.h"
 #include "PlayerInfo.h"
 #include "PlayerUtils.h"
+#include "Net/NetPackStream.h"
 #include "Const.h"
 
 PlayerInfo::PlayerInfo()
@@ -37,6 +38,11 @@ PlayerInfo::PlayerInfo(NetPack& src)
 	ReadInfo(src);
 }
 
+PlayerInfo::PlayerInfo(int id, const std::string& name, Language lang, int chips)
+	: m_id(id), m_name(name), m_language(lang), m_chipCount(chips)
+{
+}
+
 PlayerInfo::~PlayerInfo()
 {
 }
@@ -102,7 +108,16 @@ Language PlayerInfo::GetLanguage() const
 	return m_language;
 }
 
-void PlayerInfo::WriteInfo(NetPack& dst)
+void PlayerInfo::WriteInfo(NetPack& dst) const
+{
+	auto rLock = m_lock.OnRead();
+	dst.WriteUInt32(m_id);
+	dst.WriteString(m_name);
+	dst.WriteUInt8(m_language);
+	dst.WriteInt32(m_chipCount.load());
+}
+
+void PlayerInfo::WriteInfo(NetPackStream& dst) const
 {
 	auto rLock = m_lock.OnRead();
 	dst.WriteUInt32(m_id);
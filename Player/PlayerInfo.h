@@ -13,6 +13,7 @@ enum Language : byte
 };
 
 class NetPack;
+class NetPackStream;
 class Player;
 class PlayerMgr;
 
@@ -31,6 +32,7 @@ public:
 	PlayerInfo(const PlayerInfo& other);
 	PlayerInfo& operator=(const PlayerInfo& other);
 	PlayerInfo(NetPack& src);
+	PlayerInfo(int id, const std::string& name, Language lang, int chips);
 	~PlayerInfo();
 
 	void SetName(std::string n);
@@ -49,7 +51,8 @@ public:
 	std::string GetName() const;
 	Language GetLanguage() const;
 
-	void WriteInfo(NetPack& dst);
+	void WriteInfo(NetPack& dst) const;
+	void WriteInfo(NetPackStream& dst) const;
 	void ReadInfo(NetPack& src);
 
 	PlayerInfo(mysqlx::abi2::r0::Row& rowData);
@@ -1,9 +1,22 @@
 #include "pch.h"
 #include "PlayerMgr.h"
 #include "Player.h"
+#include "SessionToken.h"
+#include "PlayerTeardown.h"
+#include "Net/NetPackStream.h"
+#include "Utils/EpochReclaimer.h"
+#include "Room/RoomShard.h"
 
-PlayerMgr::PlayerMgr() = default;
-PlayerMgr::~PlayerMgr() = default;
+PlayerMgr::PlayerMgr()
+{
+	for (auto& shard : _shards)
+		shard.snapshot.store(new PlayerSnapshot());
+}
+PlayerMgr::~PlayerMgr()
+{
+	for (auto& shard : _shards)
+		delete shard.snapshot.exchange(nullptr);
+}
 
 PlayerMgr& PlayerMgr::Instance()
 {
@@ -11,95 +24,317 @@ PlayerMgr& PlayerMgr::Instance()
 	return instance;
 }
 
-std::shared_ptr<Player> PlayerMgr::OnPlayerConnected(SOCKET&& socket)
+size_t PlayerMgr::ShardOfId(UINT32 id)
+{
+	return id & (PLAYER_REGISTRY_SHARD_COUNT - 1);
+}
+size_t PlayerMgr::ShardOfConnection(PlayerHandle handle)
+{
+	return PlayerSlotMap::IndexOf(handle) & (PLAYER_REGISTRY_SHARD_COUNT - 1);
+}
+void PlayerMgr::PublishSnapshot(Shard& shard)
+{
+	auto next = new PlayerSnapshot();
+	next->loggedIn.reserve(shard.loggedIn.size());
+	for (const auto& item : shard.loggedIn)
+	{
+		if (auto p = _slotMap.Resolve(item.second))
+			next->loggedIn.push_back(p);
+	}
+	next->all.reserve(shard.preLogIn.size() + shard.loggedIn.size());
+	for (auto handle : shard.preLogIn)
+	{
+		if (auto p = _slotMap.Resolve(handle))
+			next->all.push_back(p);
+	}
+	next->all.insert(next->all.end(), next->loggedIn.begin(), next->loggedIn.end());
+	shard.playerCount.store(next->all.size());
+	shard.loggedInCount.store(next->loggedIn.size());
+	auto prev = shard.snapshot.exchange(next);
+	EpochReclaimer::Retire([prev]() { delete prev; });
+}
+
+PlayerHandle PlayerMgr::OnPlayerConnected(SOCKET&& socket)
+{
+	auto& mgr = Instance();
+	PlayerHandle handle = mgr._slotMap.Reserve();
+	if (handle == INVALID_PLAYER_HANDLE)
+	{
+		std::cout << "PlayerMgr: no free connection slot, refusing client" << std::endl;
+		closesocket(socket);
+		return INVALID_PLAYER_HANDLE;
+	}
+	// the handle is known before the recv thread starts, so the first packet can already carry it
+	mgr._slotMap.Publish(handle, new Player(std::move(socket), handle));
+	mgr.AddPreLogIn(handle);
+	return handle;
+}
+PlayerHandle PlayerMgr::OnFrontConnected(uint64_t frontConn)
+{
+	auto& mgr = Instance();
+	PlayerHandle handle = mgr._slotMap.Reserve();
+	if (handle == INVALID_PLAYER_HANDLE)
+	{
+		std::cout << "PlayerMgr: no free connection slot, refusing front connection" << std::endl;
+		return INVALID_PLAYER_HANDLE;
+	}
+	mgr._slotMap.Publish(handle, new Player(handle, frontConn));
+	mgr.AddPreLogIn(handle);
+	return handle;
+}
+PlayerHandle PlayerMgr::OnShardTunnelOpened(uint64_t tunnel)
 {
 	auto& mgr = Instance();
-	std::shared_ptr<Player> newPlayer = std::make_shared<Player>(std::move(socket));
-	newPlayer->m_selfPtr = newPlayer;
+	PlayerHandle handle = mgr._slotMap.Reserve();
+	if (handle == INVALID_PLAYER_HANDLE)
 	{
-		auto wLock = mgr._lock.OnWrite();
-		mgr._allPlayer.insert(newPlayer);
-		mgr._preLogInPlayer.insert(newPlayer);
+		std::cout << "PlayerMgr: no free connection slot, refusing gateway tunnel" << std::endl;
+		return INVALID_PLAYER_HANDLE;
 	}
-	return newPlayer;
+	mgr._slotMap.Publish(handle, new Player(handle, ShardTunnel{ tunnel }));
+	mgr.AddPreLogIn(handle);
+	return handle;
+}
+void PlayerMgr::AddPreLogIn(PlayerHandle handle)
+{
+	auto& shard = _shards[ShardOfConnection(handle)];
+	auto wLock = shard.lock.OnWrite();
+	shard.preLogIn.insert(handle);
+	PublishSnapshot(shard);
 }
-UINT16 PlayerMgr::OnPlayerLoggedIn(std::shared_ptr<Player> p, const PlayerInfo& info)
+UINT16 PlayerMgr::OnPlayerLoggedIn(PlayerHandle handle, const PlayerInfo& info)
 {
 	auto& mgr = Instance();
+	size_t fromIdx = ShardOfConnection(handle);
+	size_t toIdx = ShardOfId(info.m_id);
+	auto& from = mgr._shards[fromIdx];
+	auto& to = mgr._shards[toIdx];
+
+	// move between the two shards atomically so ForAllPlayer never sees the player twice or not at all
+	// lock in index order, two logins crossing the same pair of shards cannot deadlock
+	std::unique_lock<std::shared_mutex> firstLock = mgr._shards[std::min(fromIdx, toIdx)].lock.OnWrite();
+	std::unique_lock<std::shared_mutex> secondLock{};
+	if (fromIdx != toIdx)
+		secondLock = mgr._shards[std::max(fromIdx, toIdx)].lock.OnWrite();
+
+	// already removed by the tick thread while its login was in flight
+	if (!from.preLogIn.contains(handle))
+		return RpcError::PLAYER_STATE_ERROR;
+	if (auto it = to.loggedIn.find(info.m_id); it != to.loggedIn.end())
 	{
-		auto wLock = mgr._lock.OnWrite();
-		if (mgr._loggedInPlayer.contains(info.m_id))
+		// a password login wins over a session that is only waiting for a resume
+		Player* existing = mgr._slotMap.Resolve(it->second);
+		if (existing && !existing->DropParkedSession())
 			return RpcError::USER_ALREADY_LOGGED_IN_ELSEWHERE;
-		mgr._preLogInPlayer.erase(p);
-		mgr._loggedInPlayer[info.m_id] = p;
+		{
+			std::lock_guard<std::mutex> lock(mgr._displacedMutex);
+			mgr._displaced.push_back(it->second);
+		}
+		to.loggedIn.erase(it);
 	}
+	// still in preLogIn, so RemovePlayers has not released it yet
+	Player* p = mgr._slotMap.Resolve(handle);
+	// info must be in place before the player leaves the connection shard, RemovePlayers relies on it
 	p->m_info = info;
 	p->m_loggedIn = true;
+	from.preLogIn.erase(handle);
+	to.loggedIn[info.m_id] = handle;
+	mgr.PublishSnapshot(to);
+	if (fromIdx != toIdx)
+		mgr.PublishSnapshot(from);
 	return RpcError::SUCCESS;
 }
-void PlayerMgr::RemovePlayers(std::unordered_set<std::shared_ptr<Player>> playerSet)
+void PlayerMgr::RemovePlayers(const std::vector<PlayerHandle>& handles)
 {
 	auto& mgr = Instance();
+	std::vector<PlayerHandle> displaced{};
+	{
+		std::lock_guard<std::mutex> lock(mgr._displacedMutex);
+		displaced.swap(mgr._displaced);
+	}
+	// constant work per player, the actual teardown runs on the PlayerTeardown thread
+	EpochReclaimer::ReadGuard guard{};
+	auto removeOne = [&mgr](PlayerHandle handle)
+		{
+			Player* p = mgr._slotMap.Resolve(handle);
+			// a player stays in the snapshots until it is detached, later ticks find it again
+			if (p && p->MarkDeleted())
+				PlayerTeardown::Enqueue(handle, p);
+		};
+	for (auto handle : handles)
+		removeOne(handle);
+	for (auto handle : displaced)
+		removeOne(handle);
+}
+void PlayerMgr::Unregister(const std::vector<Player*>& players)
+{
+	// the connection shard first, whoever is not there has logged in and m_info is final
+	std::array<std::vector<Player*>, PLAYER_REGISTRY_SHARD_COUNT> byConnection{};
+	std::array<std::vector<Player*>, PLAYER_REGISTRY_SHARD_COUNT> byId{};
+	for (auto p : players)
+		byConnection[ShardOfConnection(p->GetHandle())].push_back(p);
+	for (size_t i = 0; i < PLAYER_REGISTRY_SHARD_COUNT; i++)
+	{
+		if (byConnection[i].empty())
+			continue;
+		auto& shard = _shards[i];
+		auto wLock = shard.lock.OnWrite();
+		bool changed = false;
+		for (auto p : byConnection[i])
+		{
+			if (shard.preLogIn.erase(p->GetHandle()) > 0)
+				changed = true;
+			else
+				byId[ShardOfId(p->m_info.m_id)].push_back(p);
+		}
+		if (changed)
+			PublishSnapshot(shard);
+	}
+	for (size_t i = 0; i < PLAYER_REGISTRY_SHARD_COUNT; i++)
 	{
-		auto wLock = mgr._lock.OnWrite();
-		for (auto p : playerSet)
+		if (byId[i].empty())
+			continue;
+		auto& shard = _shards[i];
+		auto wLock = shard.lock.OnWrite();
+		bool changed = false;
+		for (auto p : byId[i])
 		{
-			mgr._preLogInPlayer.erase(p);
-			mgr._allPlayer.erase(p);
-			if (mgr._loggedInPlayer.contains(p->m_info.m_id))
-				mgr._loggedInPlayer.erase(p->m_info.m_id);
+			auto it = shard.loggedIn.find(p->m_info.m_id);
+			// a displaced session already lost its entry to the new login
+			if (it != shard.loggedIn.end() && it->second == p->GetHandle())
+			{
+				shard.loggedIn.erase(it);
+				changed = true;
+			}
 		}
+		if (changed)
+			PublishSnapshot(shard);
 	}
-	for (auto p : playerSet)
-		p->Delete();
 }
-void PlayerMgr::ForAllPlayer(std::function<void(std::shared_ptr<Player>)> func)
+RpcError PlayerMgr::ResumeSession(PlayerHandle connection, const std::string& token)
+{
+	int id = -1;
+	uint64_t nonce = 0;
+	if (!SessionToken::Verify(token, id, nonce))
+		return RpcError::SESSION_RESUME_FAILED;
+
+	auto& mgr = Instance();
+	EpochReclaimer::ReadGuard guard{};
+	Player* from = mgr._slotMap.Resolve(connection);
+	if (!from)
+		return RpcError::PLAYER_STATE_ERROR;
+	// the read lock keeps a concurrent login from displacing the session while it is rebound
+	auto& shard = mgr._shards[ShardOfId(id)];
+	auto rLock = shard.lock.OnRead();
+	auto it = shard.loggedIn.find(id);
+	if (it == shard.loggedIn.end())
+		return RpcError::SESSION_RESUME_FAILED;
+	Player* parked = mgr._slotMap.Resolve(it->second);
+	if (!parked || !parked->Resume(nonce, *from))
+		return RpcError::SESSION_RESUME_FAILED;
+	return RpcError::SUCCESS;
+}
+Player* PlayerMgr::Resolve(PlayerHandle handle)
+{
+	return Instance()._slotMap.Resolve(handle);
+}
+bool PlayerMgr::WithPlayer(PlayerHandle handle, std::function<void(Player*)> func)
+{
+	EpochReclaimer::ReadGuard guard{};
+	Player* p = Resolve(handle);
+	if (!p)
+		return false;
+	func(p);
+	return true;
+}
+void PlayerMgr::ForAllPlayer(std::function<void(Player*)> func)
 {
 	auto& mgr = Instance();
-	std::unordered_set<std::shared_ptr<Player>> setCopy{};
+	EpochReclaimer::ReadGuard guard{};
+	for (auto& shard : mgr._shards)
 	{
-		auto rLock = mgr._lock.OnRead();
-		setCopy = std::unordered_set<std::shared_ptr<Player>>(mgr._allPlayer);
+		for (auto p : shard.snapshot.load()->all)
+			func(p);
 	}
-	for (auto p : setCopy)
-		func(p);
 }
-void PlayerMgr::ForAllLoggedInPlayer(std::function<void(std::shared_ptr<Player>)> func)
+void PlayerMgr::ForAllLoggedInPlayer(std::function<void(Player*)> func)
 {
 	auto& mgr = Instance();
-	std::unordered_map<UINT32, std::shared_ptr<Player>> mapCopy{};
+	EpochReclaimer::ReadGuard guard{};
+	for (auto& shard : mgr._shards)
 	{
-		auto rLock = mgr._lock.OnRead();
-		mapCopy = std::unordered_map<UINT32, std::shared_ptr<Player>>(mgr._loggedInPlayer);
+		for (auto p : shard.snapshot.load()->loggedIn)
+			func(p);
 	}
-	for (auto item : mapCopy)
-		func(item.second);
 }
-void PlayerMgr::ForPlayerWithGivenID(int pid, std::function<void(std::shared_ptr<Player>)> func)
+void PlayerMgr::ForPlayerWithGivenID(int pid, std::function<void(Player*)> func)
 {
-	auto& mgr = Instance();
-	std::shared_ptr<Player> target = nullptr;
+	auto& shard = Instance()._shards[ShardOfId(pid)];
+	PlayerHandle target = INVALID_PLAYER_HANDLE;
 	{
-		auto rLock = mgr._lock.OnRead();
-		if (!mgr._loggedInPlayer.contains(pid))
+		auto rLock = shard.lock.OnRead();
+		auto it = shard.loggedIn.find(pid);
+		if (it == shard.loggedIn.end())
 			return;
-		target = mgr._loggedInPlayer[pid];
+		target = it->second;
 	}
-	func(target);
+	WithPlayer(target, func);
 }
-void PlayerMgr::WriteAllPlayer(NetPack& pack)
+void PlayerMgr::WritePlayerPage(NetPackStream& pack, uint32_t afterId, uint16_t limit)
 {
 	auto& mgr = Instance();
-	std::unordered_map<UINT32, std::shared_ptr<Player>> mapCopy{};
+	size_t pageSize = limit == 0 ? LISTING_DEFAULT_PAGE_SIZE : std::min((size_t)limit, (size_t)LISTING_MAX_PAGE_SIZE);
+	EpochReclaimer::ReadGuard guard{};
+	std::vector<std::pair<uint32_t, Player*>> page{};
+	for (auto& shard : mgr._shards)
+	{
+		for (auto p : shard.snapshot.load()->loggedIn)
+		{
+			uint32_t id = (uint32_t)p->GetID();
+			if (id > afterId)
+				page.emplace_back(id, p);
+		}
+	}
+	auto byId = [](const auto& a, const auto& b) { return a.first < b.first; };
+	bool more = page.size() > pageSize;
+	if (more)
 	{
-		auto rLock = mgr._lock.OnRead();
-		mapCopy = std::unordered_map<UINT32, std::shared_ptr<Player>>(mgr._loggedInPlayer);
+		std::partial_sort(page.begin(), page.begin() + pageSize, page.end(), byId);
+		page.resize(pageSize);
 	}
-	pack.WriteUInt32((uint32_t)mapCopy.size());
-	for (auto item : mapCopy)
+	else
+		std::sort(page.begin(), page.end(), byId);
+
+	pack.WriteUInt32((uint32_t)page.size());
+	for (const auto& item : page)
 		item.second->GetInfo().WriteInfo(pack);
+	pack.WriteUInt32(more ? page.back().first : 0);
+}
+size_t PlayerMgr::GetPlayerCount()
+{
+	size_t total = 0;
+	for (auto& shard : Instance()._shards)
+		total += shard.playerCount.load(std::memory_order_relaxed);
+	return total;
 }
 size_t PlayerMgr::GetLoggedInPlayerCount()
 {
-	return Instance()._loggedInPlayer.size();
-}
\ No newline at end of file
+	size_t total = 0;
+	for (auto& shard : Instance()._shards)
+		total += shard.loggedInCount.load(std::memory_order_relaxed);
+	return total;
+}
+void PlayerMgr::BeginSendBatch()
+{
+	if (RoomShard::IsGateway())
+		Instance()._batchingSends.store(true);
+}
+void PlayerMgr::FlushSendBatch()
+{
+	Instance()._batchingSends.store(false);
+	ForAllPlayer([](Player* p) { p->FlushOutbox(); });
+}
+bool PlayerMgr::IsBatchingSends()
+{
+	return Instance()._batchingSends.load();
+}
@@ -1,18 +1,61 @@
 #pragma once
 #include "CppServerAPI.h"
+#include "Const.h"
 #include "Utils/ReadWriteLock.h"
+#include "Net/RpcError.h"
+#include "PlayerHandle.h"
+#include "PlayerSlotMap.h"
 #include <thread>
 #include <mutex>
+#include <array>
+#include <atomic>
 
 class NetPack;
+class NetPackStream;
+class PlayerTeardown;
 class CPPSERVER_API PlayerMgr
 {
+	static_assert((PLAYER_REGISTRY_SHARD_COUNT & (PLAYER_REGISTRY_SHARD_COUNT - 1)) == 0, "shard count must be a power of two");
+
+	// immutable view of one shard, rebuilt on every membership change of that shard
+	// players are retired after the snapshot that drops them, so the pointers stay valid under the same guard
+	struct PlayerSnapshot
+	{
+		std::vector<Player*> all{};
+		std::vector<Player*> loggedIn{};
+	};
+
+	// logged in players live in the shard of their player id, everyone else in the shard of their connection slot
+	struct Shard
+	{
+		std::unordered_set<PlayerHandle> preLogIn{};
+		std::unordered_map<UINT32, PlayerHandle> loggedIn{};
+		ReadWriteLock lock;
+		// ForAll* read this without a lock under an EpochReclaimer::ReadGuard
+		std::atomic<const PlayerSnapshot*> snapshot{ nullptr };
+		std::atomic<size_t> playerCount{ 0 };
+		std::atomic<size_t> loggedInCount{ 0 };
+	};
+
 	static PlayerMgr& Instance();
 
-	std::unordered_set<std::shared_ptr<Player>> _allPlayer;
-	std::unordered_set<std::shared_ptr<Player>> _preLogInPlayer;
-	std::unordered_map<UINT32, std::shared_ptr<Player>> _loggedInPlayer;
-	ReadWriteLock _lock;
+	std::array<Shard, PLAYER_REGISTRY_SHARD_COUNT> _shards{};
+	// owns every Player object
+	PlayerSlotMap _slotMap{};
+	// parked sessions replaced by a fresh login, no longer in any shard, removed on the next RemovePlayers
+	std::vector<PlayerHandle> _displaced{};
+	std::mutex _displacedMutex;
+	// raised by the main thread around the tick, see BeginSendBatch
+	std::atomic<bool> _batchingSends{ false };
+
+	static size_t ShardOfId(UINT32 id);
+	static size_t ShardOfConnection(PlayerHandle handle);
+	// caller holds the shard's write lock
+	void PublishSnapshot(Shard& shard);
+	// a freshly published connection waits in its connection shard until it logs in
+	void AddPreLogIn(PlayerHandle handle);
+	// drops players from their shards, locking and republishing each touched shard once
+	void Unregister(const std::vector<Player*>& players);
 
 	PlayerMgr();
 	~PlayerMgr();
@@ -20,12 +63,37 @@ class CPPSERVER_API PlayerMgr
 	PlayerMgr& operator=(const PlayerMgr&) = delete;
 
 public:
-	static std::shared_ptr<Player> OnPlayerConnected(SOCKET&& socket);
-	static UINT16 OnPlayerLoggedIn(std::shared_ptr<Player> p, const PlayerInfo& info);
-	static void RemovePlayers(std::unordered_set<std::shared_ptr<Player>> playerSet);
-	static void ForAllPlayer(std::function<void(std::shared_ptr<Player>)> func);
-	static void ForAllLoggedInPlayer(std::function<void(std::shared_ptr<Player>)> func);
-	static void ForPlayerWithGivenID(int pid, std::function<void(std::shared_ptr<Player>)> func);
-	static void WriteAllPlayer(NetPack& pack);
+	friend PlayerTeardown;
+
+	// returns INVALID_PLAYER_HANDLE and closes the socket if the server is full
+	static PlayerHandle OnPlayerConnected(SOCKET&& socket);
+	// a connection the front process accepted, returns INVALID_PLAYER_HANDLE if the server is full
+	static PlayerHandle OnFrontConnected(uint64_t frontConn);
+	// a tunnel the gateway opened on a link to this shard, returns INVALID_PLAYER_HANDLE if the shard is full
+	static PlayerHandle OnShardTunnelOpened(uint64_t tunnel);
+	static UINT16 OnPlayerLoggedIn(PlayerHandle handle, const PlayerInfo& info);
+	// hands the players to PlayerTeardown, cheap enough for the tick thread
+	static void RemovePlayers(const std::vector<PlayerHandle>& handles);
+	// called on the recv thread of connection, moves its socket into the parked session the token points at
+	static RpcError ResumeSession(PlayerHandle connection, const std::string& token);
+
+	// nullptr for a stale handle, the pointer is only valid while the caller holds an EpochReclaimer::ReadGuard
+	static Player* Resolve(PlayerHandle handle);
+	// resolves under its own guard, returns false and skips func if the player is gone
+	static bool WithPlayer(PlayerHandle handle, std::function<void(Player*)> func);
+
+	// func sees each shard as of its last membership change and must not keep the pointer past the call
+	static void ForAllPlayer(std::function<void(Player*)> func);
+	static void ForAllLoggedInPlayer(std::function<void(Player*)> func);
+	static void ForPlayerWithGivenID(int pid, std::function<void(Player*)> func);
+	// logged in players with an id above afterId in id order, followed by the cursor of the next page (0 when done)
+	static void WritePlayerPage(NetPackStream& pack, uint32_t afterId, uint16_t limit);
+	// from here to FlushSendBatch every Player::Send queues instead of writing, then each connection gets
+	// everything it was sent in one write. only on the gateway, a shard's packs are relayed and must stay whole
+	static void BeginSendBatch();
+	static void FlushSendBatch();
+	static bool IsBatchingSends();
+	// sums the per shard counters, no lock
+	static size_t GetPlayerCount();
 	static size_t GetLoggedInPlayerCount();
 };
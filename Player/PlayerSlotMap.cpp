@@ -0,0 +1,62 @@
+#include "pch.h"
+#include "PlayerSlotMap.h"
+
+PlayerSlotMap::PlayerSlotMap() : _slots(std::make_unique<Slot[]>(PLAYER_SLOT_CAPACITY))
+{
+}
+
+PlayerHandle PlayerSlotMap::Reserve()
+{
+	std::unique_lock<std::mutex> lock(_mutex);
+	uint32_t index = 0;
+	if (!_freeList.empty())
+	{
+		index = _freeList.back();
+		_freeList.pop_back();
+	}
+	else if (_highWater < PLAYER_SLOT_CAPACITY)
+		index = _highWater++;
+	else
+		return INVALID_PLAYER_HANDLE;
+
+	auto& slot = _slots[index];
+	// generation 0 would make handle 0 possible for slot 0
+	if (++slot.generation >= (1u << (32 - PLAYER_HANDLE_INDEX_BITS)))
+		slot.generation = 1;
+	return (slot.generation << PLAYER_HANDLE_INDEX_BITS) | index;
+}
+
+void PlayerSlotMap::Publish(PlayerHandle handle, Player* player)
+{
+	auto& slot = _slots[IndexOf(handle)];
+	slot.player.store(player, std::memory_order_relaxed);
+	slot.handle.store(handle, std::memory_order_release);
+}
+
+Player* PlayerSlotMap::Release(PlayerHandle handle)
+{
+	if (handle == INVALID_PLAYER_HANDLE)
+		return nullptr;
+	std::unique_lock<std::mutex> lock(_mutex);
+	auto& slot = _slots[IndexOf(handle)];
+	if (slot.handle.load(std::memory_order_relaxed) != handle)
+		return nullptr;
+	slot.handle.store(INVALID_PLAYER_HANDLE, std::memory_order_release);
+	auto player = slot.player.exchange(nullptr);
+	_freeList.push_back(IndexOf(handle));
+	return player;
+}
+
+Player* PlayerSlotMap::Resolve(PlayerHandle handle) const
+{
+	if (handle == INVALID_PLAYER_HANDLE)
+		return nullptr;
+	auto& slot = _slots[IndexOf(handle)];
+	if (slot.handle.load(std::memory_order_acquire) != handle)
+		return nullptr;
+	auto player = slot.player.load(std::memory_order_acquire);
+	// released (and maybe reused) between the two loads
+	if (slot.handle.load(std::memory_order_acquire) != handle)
+		return nullptr;
+	return player;
+}
@@ -0,0 +1,47 @@
+#pragma once
+#include "CppServerAPI.h"
+#include "Const.h"
+#include "PlayerHandle.h"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+class Player;
+
+// dense table of every connection, addressed by PlayerHandle
+// a slot's generation is bumped each time it is freed, so a handle that outlived its player
+// resolves to nullptr instead of to whoever got the slot next.
+// Resolve is lock free, the returned pointer is only valid while the caller holds an EpochReclaimer::ReadGuard.
+class CPPSERVER_API PlayerSlotMap
+{
+	static constexpr uint32_t INDEX_MASK = PLAYER_SLOT_CAPACITY - 1;
+
+	struct Slot
+	{
+		// full handle while the slot is live, 0 while it is free or reserved
+		std::atomic<PlayerHandle> handle{ INVALID_PLAYER_HANDLE };
+		std::atomic<Player*> player{ nullptr };
+		uint32_t generation = 0;
+	};
+
+	std::unique_ptr<Slot[]> _slots;
+	std::vector<uint32_t> _freeList{};
+	uint32_t _highWater = 0;
+	std::mutex _mutex;
+
+public:
+	PlayerSlotMap();
+	PlayerSlotMap(const PlayerSlotMap&) = delete;
+	PlayerSlotMap& operator=(const PlayerSlotMap&) = delete;
+
+	// returns INVALID_PLAYER_HANDLE when every slot is taken
+	PlayerHandle Reserve();
+	// makes a reserved handle resolvable
+	void Publish(PlayerHandle handle, Player* player);
+	// the handle stops resolving right away, the caller retires the player object
+	Player* Release(PlayerHandle handle);
+	Player* Resolve(PlayerHandle handle) const;
+
+	static uint32_t IndexOf(PlayerHandle handle) { return handle & INDEX_MASK; }
+};
@@ -0,0 +1,132 @@
+#include "pch.h"
+#include "PlayerTeardown.h"
+#include "Player.h"
+#include "PlayerMgr.h"
+#include "PlayerUtils.h"
+#include "Utils/EpochReclaimer.h"
+
+PlayerTeardown::PlayerTeardown()
+{
+	_worker = std::thread(&PlayerTeardown::WorkerJob, this);
+}
+
+PlayerTeardown::~PlayerTeardown()
+{
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		_isDead = true;
+	}
+	_cond.notify_all();
+	if (_worker.joinable()) _worker.join();
+}
+
+PlayerTeardown& PlayerTeardown::Instance()
+{
+	static PlayerTeardown instance;
+	return instance;
+}
+
+void PlayerTeardown::Enqueue(PlayerHandle handle, Player* player)
+{
+	auto& teardown = Instance();
+	teardown._queued++;
+	teardown.Push(Job{ handle, player, Stage::Detach });
+}
+
+void PlayerTeardown::Push(Job job)
+{
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		_jobs.push_back(job);
+	}
+	_cond.notify_one();
+}
+
+void PlayerTeardown::WorkerJob()
+{
+	while (true)
+	{
+		std::deque<Job> round{};
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_cond.wait(lock, [this]() { return _isDead || !_jobs.empty(); });
+			if (_isDead && _jobs.empty()) return;
+			round.swap(_jobs);
+		}
+
+		std::vector<Job> toDetach{};
+		for (const auto& job : round)
+		{
+			if (job.stage == Stage::Detach)
+				toDetach.push_back(job);
+		}
+		try
+		{
+			if (!toDetach.empty())
+				DetachAll(toDetach);
+			for (const auto& job : round)
+			{
+				if (job.stage == Stage::Persist)
+					Persist(job);
+				else if (job.stage == Stage::Reclaim)
+					Reclaim(job);
+			}
+		}
+		catch (const std::exception& e)
+		{
+			std::cout << "STD ERROR: " << e.what() << std::endl;
+		}
+	}
+}
+
+void PlayerTeardown::DetachAll(std::vector<Job>& jobs)
+{
+	std::vector<Player*> players{};
+	players.reserve(jobs.size());
+	for (const auto& job : jobs)
+		players.push_back(job.player);
+	PlayerMgr::Instance().Unregister(players);
+
+	for (const auto& job : jobs)
+	{
+		std::cout << "delete player(handle " << job.handle << ")" << std::endl;
+		// the exits run on the rooms' executors, the player comes back here once the last one is done
+		job.player->Detach([this, job](bool wasLoggedIn)
+			{
+				Push(Job{ job.handle, job.player, wasLoggedIn ? Stage::Persist : Stage::Reclaim });
+			});
+	}
+}
+
+void PlayerTeardown::Persist(const Job& job)
+{
+	_persisting++;
+	// the player stays resolvable until reclaimed, so late db callbacks of its rooms can still reach it
+	PlayerUtils::FlushPlayerToDatabase(job.player->GetInfo(), [this, job]()
+		{
+			_persisting--;
+			Push(Job{ job.handle, job.player, Stage::Reclaim });
+		});
+}
+
+void PlayerTeardown::Reclaim(const Job& job)
+{
+	// the socket was closed on detach, the recv thread is done or about to be
+	job.player->JoinRecvThread();
+	PlayerMgr::Instance()._slotMap.Release(job.handle);
+	// retired after the snapshots that dropped it, readers of those still hold an older epoch
+	EpochReclaimer::Retire([p = job.player]() { delete p; });
+	_reclaimed++;
+}
+
+void PlayerTeardown::DebugPrint()
+{
+	auto& teardown = Instance();
+	size_t pending = 0;
+	{
+		std::unique_lock<std::mutex> lock(teardown._mutex);
+		pending = teardown._jobs.size();
+	}
+	std::cout << "[PLAYER TEARDOWN REPORT] queued: " << teardown._queued.load() << "; pending: " << pending
+		<< "; persisting: " << teardown._persisting.load() << "; reclaimed: " << teardown._reclaimed.load() << std::endl;
+}
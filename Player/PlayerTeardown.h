@@ -0,0 +1,63 @@
+#pragma once
+#include "CppServerAPI.h"
+#include "PlayerHandle.h"
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <vector>
+
+class Player;
+
+// removes disconnected players off the tick thread, in three stages:
+// detach - drop them from the registry, post their room exits and close the socket, right away
+// persist - once the rooms' executors ran the exits, final profile write on DbRequestQueue, the player waits without blocking anything
+// reclaim - join the recv thread, free the slot and retire the object through EpochReclaimer
+// detach and reclaim run on one dedicated thread, persist completes on a db worker and hands back.
+class CPPSERVER_API PlayerTeardown
+{
+	enum class Stage
+	{
+		Detach,
+		Persist,
+		Reclaim,
+	};
+
+	struct Job
+	{
+		PlayerHandle handle;
+		Player* player;
+		Stage stage;
+	};
+
+	static PlayerTeardown& Instance();
+
+	std::deque<Job> _jobs{};
+	std::thread _worker;
+	std::mutex _mutex;
+	std::condition_variable _cond;
+	bool _isDead = false;
+
+	std::atomic<uint64_t> _queued{ 0 };
+	std::atomic<uint64_t> _persisting{ 0 };
+	std::atomic<uint64_t> _reclaimed{ 0 };
+
+	void WorkerJob();
+	void Push(Job job);
+	// batched so each registry shard is locked and republished once per round
+	void DetachAll(std::vector<Job>& jobs);
+	void Persist(const Job& job);
+	void Reclaim(const Job& job);
+
+	PlayerTeardown();
+	PlayerTeardown(const PlayerTeardown&) = delete;
+	PlayerTeardown& operator=(const PlayerTeardown&) = delete;
+
+public:
+	~PlayerTeardown();
+
+	// O(1), the caller already won Player::MarkDeleted
+	static void Enqueue(PlayerHandle handle, Player* player);
+	static void DebugPrint();
+};
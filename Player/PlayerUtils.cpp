@@ -1,177 +1,203 @@
 #include "pch.h"
 #include "PlayerUtils.h"
 #include "Const.h"
+#include "Database/StorageMgr.h"
+#include "Database/DbRequestQueue.h"
+#include "Database/ChipSettlementMgr.h"
+#include "Utils/PasswordHasher.h"
 
-std::string PlayerUtils::EscapeSqlString(const std::string& input)
+void PlayerUtils::SendTo(PlayerHandle owner, NetPack& pack)
 {
-	std::string output;
-	output.reserve(input.size() * 2);
-	for (char c : input)
-	{
-		switch (c)
-		{
-		case '\'': output += "''"; break;  // ?????
-		case '\\': output += "\\\\"; break; // ?????
-		case '"': output += "\\\""; break;  // ?????
-		case '\0': break; // ?????
-		default: output += c; break;
-		}
-	}
-	return output;
+	PlayerMgr::WithPlayer(owner, [&pack](Player* p) { p->Send(pack); });
+}
+
+void PlayerUtils::SendErrorTo(PlayerHandle owner, RpcError err)
+{
+	PlayerMgr::WithPlayer(owner, [err](Player* p) { p->SendError(err); });
 }
 
-void PlayerUtils::CreateUserOnDatabase(std::string username, std::string password, std::shared_ptr<Player> owner)
+void PlayerUtils::CreateUserOnDatabase(std::string username, std::string password, PlayerHandle owner)
 {
-	int defaultLanguage = (int)Language::English;
-	std::string safeUsername = EscapeSqlString(username);
-	std::string safePassword = EscapeSqlString(password);
-	std::vector<std::string> insertCommand = std::vector<std::string>();
-	insertCommand.emplace_back(std::format(CREATE_USER_ACCOUNT_SQL_CMD, safeUsername, safePassword, std::to_string(defaultLanguage)));
-	insertCommand.emplace_back(std::format(CREATE_USER_ASSET_SQL_CMD, std::to_string(USER_ACCOUNT_START_CHIP)));
-	MySqlMgr::DoSql(insertCommand, [username, owner, defaultLanguage](std::vector<mysqlx::SqlResult>&& resultList)
+	std::erase(username, '\0');
+	std::erase(password, '\0');
+	bool admitted = PasswordHasher::HashAsync(password, [username, owner](std::string&& passwordHash)
 		{
-			// after creating user account, fetch the user info from database
-			auto& res = resultList[0];
-			auto id = static_cast<uint32_t>(res.getAutoIncrementValue());
-			std::string selectCols = "*";
-			MySqlMgr::Select("`wkr_server_schema`.`v_user_info_with_asset`", selectCols, "_id=" + std::to_string(id), [owner](mysqlx::SqlResult&& selectRes)
+			DbRequestQueue::Submit(DbRequestQueue::RequestType::Write, [username, passwordHash, owner]()
 				{
-					RpcError err = RpcError::REGISTER_FAILED;
-					auto row = selectRes.fetchOne();
-					if (!row.isNull())
+					PlayerInfo newPlayerInfo{};
+					RpcError err = StorageMgr::Backend().CreateUser(username, passwordHash, Language::English, USER_ACCOUNT_START_CHIP, newPlayerInfo);
+					if (err == RpcError::SUCCESS)
 					{
-						PlayerInfo newPlayerInfo = PlayerInfo(row);
-						auto logInError = (RpcError)PlayerMgr::OnPlayerLoggedIn(owner, newPlayerInfo);
-						err = logInError;
-						if (logInError == SUCCESS)
-						{
-							NetPack send{ RpcEnum::rpc_client_log_in };
-							newPlayerInfo.WriteInfo(send);
-							owner->Send(send);
-						}
+						err = (RpcError)PlayerMgr::OnPlayerLoggedIn(owner, newPlayerInfo);
+						if (err == RpcError::SUCCESS)
+							PlayerMgr::WithPlayer(owner, [](Player* p) { p->SendLoginState(); });
 					}
-					owner->SendError(err);
-				});
-		}, true);
+					SendErrorTo(owner, err);
+				}, [owner](RpcError err) { SendErrorTo(owner, err); });
+		});
+	if (!admitted)
+		SendErrorTo(owner, RpcError::SERVER_BUSY);
 }
 
-void PlayerUtils::UserLogin(int id, std::string password, std::shared_ptr<Player> owner)
+void PlayerUtils::UserLogin(int id, std::string password, PlayerHandle owner)
 {
 	std::erase(password, '\0');
-	std::string safePassword = EscapeSqlString(password);
-	std::string where = "`_id`=" + std::to_string(id) + " AND `pswd`='" + safePassword + "'";
-	std::string selectCols = "_id";
-	bool pswdCorrect = false;
-	MySqlMgr::Select("`wkr_server_schema`.`user`", selectCols, where, [owner, id, &pswdCorrect](mysqlx::SqlResult&& result)
+	DbRequestQueue::Submit(DbRequestQueue::RequestType::Read, [id, password, owner]()
 		{
-			auto row = result.fetchOne();
-			if (!row.isNull())
+			std::string storedHash{};
+			if (!StorageMgr::Backend().LoadPasswordHash(id, storedHash))
 			{
-				pswdCorrect = true;
+				SendErrorTo(owner, RpcError::WRONG_PASSWORD);
+				return;
 			}
-			else
-				owner->SendError(RpcError::WRONG_PASSWORD);
-		});
-	if (!pswdCorrect) return;
 
-	MySqlMgr::Select("`wkr_server_schema`.`v_user_info_with_asset`", "*", "`_id`=" + std::to_string(id), [owner, id](mysqlx::SqlResult&& result)
+			// verification is the expensive part, it runs on the hasher pool so this db worker is free right away
+			bool admitted = PasswordHasher::VerifyAsync(password, storedHash, [id, password, storedHash, owner](bool match)
+				{
+					if (!match)
+					{
+						SendErrorTo(owner, RpcError::WRONG_PASSWORD);
+						return;
+					}
+					if (PasswordHasher::NeedsRehash(storedHash))
+						UpgradePasswordHash(id, password);
+					FinishLogin(id, owner);
+				});
+			if (!admitted)
+				SendErrorTo(owner, RpcError::SERVER_BUSY);
+		}, [owner](RpcError err) { SendErrorTo(owner, err); });
+}
+
+void PlayerUtils::FinishLogin(int id, PlayerHandle owner)
+{
+	DbRequestQueue::Submit(DbRequestQueue::RequestType::Read, [id, owner]()
 		{
-			auto row = result.fetchOne();
-			if (!row.isNull())
+			PlayerInfo newPlayerInfo{};
+			if (!StorageMgr::Backend().LoadUserInfo(id, newPlayerInfo))
 			{
-				PlayerInfo newPlayerInfo = PlayerInfo(row);
-				auto logInError = (RpcError)PlayerMgr::OnPlayerLoggedIn(owner, newPlayerInfo);
-				if (logInError == SUCCESS)
-				{
-					NetPack send{ RpcEnum::rpc_client_log_in };
-					newPlayerInfo.WriteInfo(send);
-					owner->Send(send);
-				}
-				else
-					owner->SendError(logInError);
+				SendErrorTo(owner, RpcError::SQL_COMMAND_FAILED);
+				return;
 			}
+			auto logInError = (RpcError)PlayerMgr::OnPlayerLoggedIn(owner, newPlayerInfo);
+			if (logInError == SUCCESS)
+				PlayerMgr::WithPlayer(owner, [](Player* p) { p->SendLoginState(); });
 			else
-				owner->SendError(RpcError::SQL_COMMAND_FAILED);
+				SendErrorTo(owner, logInError);
+		}, [owner](RpcError err) { SendErrorTo(owner, err); });
+}
+
+void PlayerUtils::UpgradePasswordHash(int id, std::string password)
+{
+	// best effort, if the pool is busy the row is upgraded on a later login
+	PasswordHasher::HashAsync(password, [id](std::string&& passwordHash)
+		{
+			DbRequestQueue::Submit(DbRequestQueue::RequestType::Write, [id, passwordHash]()
+				{
+					StorageMgr::Backend().WritePasswordHash(id, passwordHash);
+				});
 		});
 }
 
-void PlayerUtils::FetchUserInfoFromDatabase(std::shared_ptr<Player> owner)
+void PlayerUtils::FetchUserInfoFromDatabase(PlayerHandle owner)
 {
-	auto id = owner->GetID();
-	std::string selectCols = "*";
-	MySqlMgr::Select("`wkr_server_schema`.`v_user_info_with_asset`", selectCols, "_id=" + std::to_string(id), [owner](mysqlx::SqlResult&& selectRes)
+	int id = -1;
+	if (!PlayerMgr::WithPlayer(owner, [&id](Player* p) { id = p->GetID(); }))
+		return;
+	DbRequestQueue::Submit(DbRequestQueue::RequestType::Read, [id, owner]()
 		{
-			auto row = selectRes.fetchOne();
-			if (!row.isNull())
+			PlayerInfo newPlayerInfo{};
+			if (!StorageMgr::Backend().LoadUserInfo(id, newPlayerInfo))
 			{
-				PlayerInfo newPlayerInfo = PlayerInfo(row);
-				owner->SetInfo(newPlayerInfo);
-				NetPack send{ RpcEnum::rpc_client_refresh_user_info };
-				newPlayerInfo.WriteInfo(send);
-				owner->Send(send);
+				SendErrorTo(owner, RpcError::SQL_COMMAND_FAILED);
+				return;
 			}
-			else
-				owner->SendError(RpcError::SQL_COMMAND_FAILED);
-		});
+			NetPack send{ RpcEnum::rpc_client_refresh_user_info };
+			newPlayerInfo.WriteInfo(send);
+			PlayerMgr::WithPlayer(owner, [&newPlayerInfo, &send](Player* p)
+				{
+					p->SetInfo(newPlayerInfo);
+					p->Send(send);
+				});
+		}, [owner](RpcError err) { SendErrorTo(owner, err); });
 }
 
-void PlayerUtils::UpdateUserAssetFromDatabase(std::shared_ptr<Player> owner)
+void PlayerUtils::UpdateUserAssetFromDatabase(PlayerHandle owner)
 {
-	auto id = owner->GetID();
-	std::string selectCols = "chip";
-	MySqlMgr::Select("wkr_server_schema.user_asset", selectCols, "_id=" + std::to_string(id), [owner](mysqlx::SqlResult&& selectRes)
+	int id = -1;
+	if (!PlayerMgr::WithPlayer(owner, [&id](Player* p) { id = p->GetID(); }))
+		return;
+	DbRequestQueue::Submit(DbRequestQueue::RequestType::Read, [id, owner]()
 		{
-			auto row = selectRes.fetchOne();
-			if (!row.isNull())
+			int chips = 0;
+			if (!StorageMgr::Backend().LoadUserChips(id, chips))
 			{
-				owner->GetInfo().SetChipsMemoryOnly(static_cast<int>(row.get(0)));
-				NetPack send{ RpcEnum::rpc_client_refresh_user_info };
-				owner->GetInfo().WriteInfo(send);
-				owner->Send(send);
+				SendErrorTo(owner, RpcError::SQL_COMMAND_FAILED);
+				return;
 			}
-			else
-				owner->SendError(RpcError::SQL_COMMAND_FAILED);
-		});
+			PlayerMgr::WithPlayer(owner, [chips](Player* p)
+				{
+					p->GetInfo().SetChipsMemoryOnly(chips);
+					NetPack send{ RpcEnum::rpc_client_refresh_user_info };
+					p->GetInfo().WriteInfo(send);
+					p->Send(send);
+				});
+		}, [owner](RpcError err) { SendErrorTo(owner, err); });
 }
 
 void PlayerUtils::WriteUserInfoChangeToDatabase(const PlayerInfo& info)
 {
-	auto id = info.GetID();
-	std::string safeName = EscapeSqlString(info.GetName());
-	std::string sqlCmd = std::format("UPDATE wkr_server_schema.user SET _name='{}',lang={} WHERE _id={};",
-		safeName, std::to_string((int)info.GetLanguage()), std::to_string(id));
-	MySqlMgr::DoSql(sqlCmd, [](mysqlx::SqlResult&& res) {});
+	PlayerInfo infoCopy = info;
+	DbRequestQueue::Submit(DbRequestQueue::RequestType::Write, [infoCopy]()
+		{
+			StorageMgr::Backend().WriteUserInfo(infoCopy);
+		}, [id = infoCopy.GetID()](RpcError err)
+		{
+			std::cerr << "[PlayerUtils] user info write for player " << id << " dropped (err " << err << ")" << std::endl;
+		});
 }
 
 void PlayerUtils::WriteUserAssetChangeToDatabase(const PlayerInfo& info)
 {
-	auto id = info.GetID();
-	std::string sqlCmd = std::format("UPDATE wkr_server_schema.user_asset SET chip={} WHERE _id={};",
-		std::to_string(info.GetChip()), std::to_string(id));
-	MySqlMgr::DoSql(sqlCmd, [](mysqlx::SqlResult&& res) {});
+	int id = info.GetID();
+	int chips = info.GetChip();
+	DbRequestQueue::Submit(DbRequestQueue::RequestType::Write, [id, chips]()
+		{
+			StorageMgr::Backend().WriteUserChips(id, chips);
+		}, [id, chips](RpcError err)
+		{
+			std::cerr << "[PlayerUtils] CRITICAL: asset write (" << chips << " chips) for player " << id << " dropped (err " << err << ")" << std::endl;
+		});
 }
 
-void PlayerUtils::AddChipsToDatabase(int playerId, int delta, std::function<void(bool)> callback)
+void PlayerUtils::FlushPlayerToDatabase(const PlayerInfo& info, std::function<void()> done)
 {
-	std::string sqlCmd;
-	if (delta < 0)
-	{
-		sqlCmd = std::format(
-			"UPDATE wkr_server_schema.user_asset SET chip = chip + {} WHERE _id = {} AND chip >= {};",
-			delta, playerId, -delta);
-	}
-	else
-	{
-		sqlCmd = std::format(
-			"UPDATE wkr_server_schema.user_asset SET chip = chip + {} WHERE _id = {};",
-			delta, playerId);
-	}
-
-	MySqlMgr::DoSql(sqlCmd, [callback, delta](mysqlx::SqlResult&& res)
+	PlayerInfo infoCopy = info;
+	DbRequestQueue::Submit(DbRequestQueue::RequestType::Write, [infoCopy, done]()
 		{
-			auto affectedRows = res.getAffectedItemsCount();
-			bool success = (affectedRows > 0);
-			if (callback)
-				callback(success);
+			try
+			{
+				StorageMgr::Backend().WriteUserInfo(infoCopy);
+			}
+			catch (...)
+			{
+				done();
+				throw;
+			}
+			done();
+		}, [id = infoCopy.GetID(), done](RpcError err)
+		{
+			std::cerr << "[PlayerUtils] CRITICAL: final write for player " << id << " dropped (err " << err << ")" << std::endl;
+			done();
 		});
-}
\ No newline at end of file
+}
+
+void PlayerUtils::AddChipsToDatabase(int playerId, int delta, std::function<void(bool)> callback)
+{
+	// a single delta is just a settlement of one, this way simultaneous cash outs still share a commit
+	ChipSettlementMgr::Settle({ ChipDelta{ playerId, delta } }, std::move(callback));
+}
+
+void PlayerUtils::SettleChipsToDatabase(std::vector<ChipDelta> deltas, std::function<void(bool)> callback)
+{
+	ChipSettlementMgr::Settle(std::move(deltas), std::move(callback));
+}
@@ -1,31 +1,47 @@
 #pragma once
 #include <functional>
+#include "Database/StorageBackend.h"
+#include "PlayerHandle.h"
 
-class Player;
+class NetPack;
 
-// not thread safe
+// thin layer between game code and StorageMgr
+// every call is queued on DbRequestQueue and completes asynchronously on a db worker thread
+// password hashing and verification run on the PasswordHasher pool in between
 class PlayerUtils
 {
+	// second half of UserLogin, once the password is verified
+	static void FinishLogin(int id, PlayerHandle owner);
+	// no-ops if the owner disconnected while its request was in flight
+	static void SendTo(PlayerHandle owner, NetPack& pack);
+	static void SendErrorTo(PlayerHandle owner, RpcError err);
+	// rewrites a plain text or outdated hash after a successful login
+	static void UpgradePasswordHash(int id, std::string password);
+
 public:
 
-	static void CreateUserOnDatabase(std::string username, std::string password, std::shared_ptr<Player> owner);
+	static void CreateUserOnDatabase(std::string username, std::string password, PlayerHandle owner);
 
-	static void UserLogin(int id, std::string password, std::shared_ptr<Player> owner);
+	static void UserLogin(int id, std::string password, PlayerHandle owner);
 
-	static void FetchUserInfoFromDatabase(std::shared_ptr<Player> owner);
+	static void FetchUserInfoFromDatabase(PlayerHandle owner);
 
-	static void UpdateUserAssetFromDatabase(std::shared_ptr<Player> owner);
+	static void UpdateUserAssetFromDatabase(PlayerHandle owner);
 
 	static void WriteUserInfoChangeToDatabase(const PlayerInfo& info);
 
 	static void WriteUserAssetChangeToDatabase(const PlayerInfo& info);
 
+	// final profile write of a leaving player, done runs once it finished or was dropped
+	// chips are left alone, every chip change already went out as a settlement and a cash out may still be in flight
+	static void FlushPlayerToDatabase(const PlayerInfo& info, std::function<void()> done);
+
 	// ????????????????/???
 	// delta > 0 ???delta < 0 ??
 	// callback(true) ???callback(false) ??????????????
 	static void AddChipsToDatabase(int playerId, int delta, std::function<void(bool)> callback);
 
-private:
-	// ??SQL?????????
-	static std::string EscapeSqlString(const std::string& input);
+	// applies all deltas of one hand or table event atomically, concurrent settlements share one commit
+	// callback(true) once committed, callback(false) if none of the deltas were applied
+	static void SettleChipsToDatabase(std::vector<ChipDelta> deltas, std::function<void(bool)> callback);
 };
\ No newline at end of file
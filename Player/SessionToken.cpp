@@ -0,0 +1,63 @@
+#include "pch.h"
+#include "SessionToken.h"
+#include "Const.h"
+#include "Utils/PasswordHasher.h"
+#include <chrono>
+#include <random>
+
+SessionToken::SessionToken()
+{
+	std::random_device rd;
+	_key.resize(32);
+	for (auto& c : _key)
+		c = (char)rd();
+}
+
+SessionToken& SessionToken::Instance()
+{
+	static SessionToken instance;
+	return instance;
+}
+
+std::string SessionToken::Issue(int playerId, uint64_t nonce)
+{
+	auto expiry = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count()
+		+ SESSION_TOKEN_TTL_SECONDS;
+	std::string body = std::format("{}.{}.{:016x}", playerId, expiry, nonce);
+	return body + "." + PasswordHasher::HmacSha256Hex(Instance()._key, body);
+}
+
+bool SessionToken::Verify(const std::string& token, int& outPlayerId, uint64_t& outNonce)
+{
+	size_t macPos = token.rfind('.');
+	if (macPos == std::string::npos)
+		return false;
+	std::string body = token.substr(0, macPos);
+	if (!PasswordHasher::ConstantTimeEquals(token.substr(macPos + 1), PasswordHasher::HmacSha256Hex(Instance()._key, body)))
+		return false;
+
+	size_t first = body.find('.');
+	size_t second = first == std::string::npos ? std::string::npos : body.find('.', first + 1);
+	if (second == std::string::npos)
+		return false;
+	try
+	{
+		long long expiry = std::stoll(body.substr(first + 1, second - first - 1));
+		long long now = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+		if (now >= expiry)
+			return false;
+		outPlayerId = std::stoi(body.substr(0, first));
+		outNonce = std::stoull(body.substr(second + 1), nullptr, 16);
+	}
+	catch (const std::exception&)
+	{
+		return false;
+	}
+	return true;
+}
+
+uint64_t SessionToken::NewNonce()
+{
+	std::random_device rd;
+	return (uint64_t)rd() << 32 | rd();
+}
@@ -0,0 +1,20 @@
+#pragma once
+#include "CppServerAPI.h"
+#include <string>
+
+// signed token handed out at login so a dropped client can rebind to its in-memory session without a db login
+// format: <player id>.<expiry, unix seconds>.<session nonce hex>.<hmac-sha256 hex>
+// the key is generated at startup, tokens do not survive a restart, and neither do the sessions they point at
+class CPPSERVER_API SessionToken
+{
+	std::string _key{};
+
+	static SessionToken& Instance();
+	SessionToken();
+
+public:
+	static std::string Issue(int playerId, uint64_t nonce);
+	// checks the signature and expiry only, the caller checks the nonce against the live session
+	static bool Verify(const std::string& token, int& outPlayerId, uint64_t& outNonce);
+	static uint64_t NewNonce();
+};
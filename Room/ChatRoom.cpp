@@ -1,43 +1,47 @@
 #include "pch.h"
 #include "ChatRoom.h"
+#include "Net/NetPackStream.h"
+#include "Const.h"
 #include <algorithm>
 
-void ChatRoom::OnPlayerExit(std::shared_ptr<Player> player)
+RpcError ChatRoom::OnPlayerJoin(Player* player)
 {
-	Room::OnPlayerExit(player);
+	auto err = Room::OnPlayerJoin(player);
+	// the joiner is a member by now and sees its own announcement
+	if (err == RpcError::SUCCESS)
+		QueueText(player->GetInfo(), player->GetName() + " joined the room", false);
+	return err;
+}
+void ChatRoom::OnPlayerExit(Player* player)
+{
+	bool left = false;
 	bool doRemoveRoom = false;
 	{
 		auto wLock = _lock.OnWrite();
+		left = RemoveMember(player->GetHandle());
 		if (_roomExpired == false && GetPlayerCnt() == 0)
 		{
 			_roomExpired = true;
 			doRemoveRoom = true;
 		}
 	}
+	if (left)
+		QueueText(player->GetInfo(), player->GetName() + " left the room", false);
 	if (doRemoveRoom)
 		RoomMgr::RemoveRoom(_roomId);
 }
-RpcError ChatRoom::OnRecvPlayerNetPack(std::shared_ptr<Player> player, NetPack& pack)
+RpcError ChatRoom::OnRecvPlayerNetPack(Player* player, NetPack& pack)
 {
 	switch (pack.MsgType())
 	{
 	case RpcEnum::rpc_server_send_text:
 	{
+		// the join was announced when it happened, so a member's text can never arrive ahead of it
+		if (!IsPlayerInRoom(player->GetHandle()))
+			return RpcError::PLAYER_STATE_ERROR;
 		auto msg = pack.ReadString();
 		std::erase(msg, '\0');
-		int pid = player->GetID();
-		bool inCache = false;
-		{
-			auto rLock = _lock.OnRead();
-            inCache = _inRoomPlayerCache.contains(pid);
-		}
-		if (!inCache)
-		{
-			auto wLock = _lock.OnWrite();
-			_pendingPlayerMessageCache[pid] = msg;
-			return RpcError::SUCCESS;
-		}
-		BroadcastText(player, msg, true);
+		QueueText(player->GetInfo(), msg, true);
 		return RpcError::SUCCESS;
 	}
 	default:
@@ -53,80 +57,61 @@ void ChatRoom::OnRoomCreated(int id)
 
 void ChatRoom::OnTick()
 {
-    std::vector<std::shared_ptr<Player>> toAdd;
-    std::vector<std::shared_ptr<Player>> toRemove;
-    {
-        auto rLock = _lock.OnRead();
-        std::unordered_map<int, std::shared_ptr<Player>> currentMembers;
-        for (const auto& p : _members)
-        {
-            if (p && !p->Expired())
-                currentMembers[p->GetID()] = p;
-        }
-        for (auto member : currentMembers)
-            if (!_inRoomPlayerCache.contains(member.first))
-                toAdd.push_back(member.second);
-        for (auto member : _inRoomPlayerCache)
-            if (!currentMembers.contains(member.first))
-                toRemove.push_back(member.second);
-    }
+	FlushTexts();
+}
 
-    if (!toAdd.empty() || !toRemove.empty())
-    {
-        auto wLock = _lock.OnWrite();
-        for (auto member : toRemove)
-        {
-            _inRoomPlayerCache.erase(member->GetID());
-            _pendingPlayerMessageCache.erase(member->GetID());
-        }
-        for (auto member : toAdd)
-            _inRoomPlayerCache[member->GetID()] = member;
-    }
-    
-    for (auto p : toAdd)
-    {
-        if (!p)
-            continue;
-        BroadcastText(p, p->GetName() + " joined the room", false);
-        std::string pendingMsg;
-        {
-            auto wLock = _lock.OnWrite();
-            auto it = _pendingPlayerMessageCache.find(p->GetID());
-            if (it != _pendingPlayerMessageCache.end())
-            {
-                pendingMsg = it->second;
-                _pendingPlayerMessageCache.erase(it);
-            }
-        }
-        if (!pendingMsg.empty())
-            BroadcastText(p, pendingMsg, true);
-    }
-    
-    for (auto p : toRemove)
-    {
-        if (!p)
-            continue;
-        BroadcastText(p, p->GetName() + " left the room", false);
-    }
+void ChatRoom::QueueText(const PlayerInfo& sender, const std::string& msg, bool includeSpeakerName)
+{
+	bool overdue = false;
+	{
+		std::lock_guard<std::mutex> lock(_batchMutex);
+		auto now = std::chrono::steady_clock::now();
+		if (_batchTexts.empty())
+			_batchStartedAt = now;
+		auto [it, inserted] = _batchSenderIndex.try_emplace(sender.GetID(), (uint16_t)_batchSenders.size());
+		if (inserted)
+			_batchSenders.push_back(sender);
+		_batchTexts.push_back(PendingText{ it->second, msg, includeSpeakerName });
+		overdue = now - _batchStartedAt >= std::chrono::milliseconds(CHAT_BATCH_MAX_DELAY_MS)
+			|| _batchSenders.size() >= UINT16_MAX || _batchTexts.size() >= UINT16_MAX;
+	}
+	if (overdue)
+		FlushTexts();
 }
 
-void ChatRoom::BroadcastText(std::shared_ptr<Player> sender, const std::string& msg, bool includeSpeakerName)
+void ChatRoom::FlushTexts()
 {
-    if (!sender)
-        return;
-	//std::cout << sender->GetName() << " says: " << msg << std::endl;
-    NetPack send{ RpcEnum::rpc_client_send_text };
-    sender->GetInfo().WriteInfo(send);
-    send.WriteString(msg);
-    send.WriteInt8(includeSpeakerName ? 1 : 0);
-    std::unordered_set<std::shared_ptr<Player>> membersCopy;
-    {
-        auto rLock = _lock.OnRead();
-        membersCopy = _members;
-    }
-    for (const auto& p : membersCopy)
-    {
-        if (p && !p->Expired())
-            p->Send(send);
-    }
-}
\ No newline at end of file
+	std::lock_guard<std::mutex> flushLock(_flushMutex);
+	std::vector<PlayerInfo> senders{};
+	std::vector<PendingText> texts{};
+	{
+		std::lock_guard<std::mutex> lock(_batchMutex);
+		if (_batchTexts.empty())
+			return;
+		senders.swap(_batchSenders);
+		texts.swap(_batchTexts);
+		_batchSenderIndex.clear();
+	}
+
+	// encoded once, every member gets the same frames
+	std::vector<std::unique_ptr<NetPack>> frames{};
+	{
+		NetPackStream send{ RpcEnum::rpc_client_send_text_batch, [&frames](NetPack& frame) { frames.push_back(std::make_unique<NetPack>(std::move(frame))); } };
+		send.WriteUInt16((uint16_t)senders.size());
+		for (const auto& sender : senders)
+			sender.WriteInfo(send);
+		send.WriteUInt16((uint16_t)texts.size());
+		for (const auto& text : texts)
+		{
+			send.WriteUInt16(text.sender);
+			send.WriteString(text.text);
+			send.WriteInt8(text.includeSpeakerName ? 1 : 0);
+		}
+		send.Finish();
+	}
+	ForEachPlayerInRoom([&frames](Player* p)
+		{
+			for (auto& frame : frames)
+				p->Send(*frame);
+		});
+}
@@ -1,16 +1,38 @@
 #pragma once
 # include "Room.h"
+#include <chrono>
+// joins and exits are queued as they happen, a chat room with nothing queued does nothing on its tick
+// texts are queued and go out once per tick as one rpc_client_send_text_batch, encoded once for every member:
+//   [sender count u16][sender infos][text count u16][per text: sender index u16, text, include speaker name i8]
+// a text waits at most CHAT_BATCH_MAX_DELAY_MS, a tick that runs late does not hold it back
 class ChatRoom : public Room
 {
-	std::unordered_map<int, std::shared_ptr<Player>> _inRoomPlayerCache{};
-	std::unordered_map<int, std::string> _pendingPlayerMessageCache{};
+	struct PendingText
+	{
+		uint16_t sender;
+		std::string text;
+		bool includeSpeakerName;
+	};
 
-	void BroadcastText(std::shared_ptr<Player> sender, const std::string& msg, bool includeSpeakerName);
+	// the batch since the last flush, each sender is listed once
+	std::vector<PlayerInfo> _batchSenders{};
+	std::unordered_map<int, uint16_t> _batchSenderIndex{};
+	std::vector<PendingText> _batchTexts{};
+	std::chrono::steady_clock::time_point _batchStartedAt{};
+	std::mutex _batchMutex;
+	// held across a whole flush, so two batches cannot overtake each other on the way out
+	std::mutex _flushMutex;
+
+	void QueueText(const PlayerInfo& sender, const std::string& msg, bool includeSpeakerName);
+	void FlushTexts();
 
 public:
-	void OnPlayerExit(std::shared_ptr<Player> player) override;
-	RpcError OnRecvPlayerNetPack(std::shared_ptr<Player> player, NetPack& pack) override;
+	void OnPlayerExit(Player* player) override;
+	RpcError OnRecvPlayerNetPack(Player* player, NetPack& pack) override;
 	void OnRoomCreated(int id) override;
 
 	void OnTick() override;
+
+protected:
+	RpcError OnPlayerJoin(Player* player) override;
 };
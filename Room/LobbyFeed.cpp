@@ -0,0 +1,94 @@
+#include "pch.h"
+#include "LobbyFeed.h"
+#include "RoomDirectory.h"
+#include "Player/PlayerMgr.h"
+#include "Net/NetPack.h"
+#include "Net/NetPackStream.h"
+#include "Utils/EpochReclaimer.h"
+#include "Const.h"
+#include <map>
+#include <tuple>
+
+LobbyFeed& LobbyFeed::Instance()
+{
+	static LobbyFeed instance;
+	return instance;
+}
+
+void LobbyFeed::Subscribe(PlayerHandle player, uint16_t type)
+{
+	auto& feed = Instance();
+	std::lock_guard<std::mutex> lock(feed._mutex);
+	feed._subscribers[player] = Subscription{ type, 0, true };
+}
+
+void LobbyFeed::Unsubscribe(PlayerHandle player)
+{
+	auto& feed = Instance();
+	std::lock_guard<std::mutex> lock(feed._mutex);
+	feed._subscribers.erase(player);
+}
+
+void LobbyFeed::Tick()
+{
+	auto& feed = Instance();
+	auto now = std::chrono::steady_clock::now();
+	if (now < feed._nextPush)
+		return;
+	feed._nextPush = now + std::chrono::milliseconds(LOBBY_PUSH_INTERVAL_MS);
+
+	// (type, snapshot, since version) -> subscribers sharing that diff
+	std::map<std::tuple<uint16_t, bool, uint32_t>, std::vector<PlayerHandle>> groups{};
+	uint32_t head = RoomDirectory::GetVersion();
+	{
+		std::lock_guard<std::mutex> lock(feed._mutex);
+		for (const auto& [handle, sub] : feed._subscribers)
+		{
+			if (!sub.needsSnapshot && sub.version == head)
+				continue;
+			groups[{ sub.type, sub.needsSnapshot, sub.needsSnapshot ? 0 : sub.version }].push_back(handle);
+		}
+	}
+
+	for (const auto& [key, handles] : groups)
+	{
+		const auto& [type, snapshot, since] = key;
+		std::vector<NetPack> frames{};
+		uint32_t version = 0;
+		{
+			NetPackStream diff{ RpcEnum::rpc_client_lobby_diff, [&frames](NetPack& frame) { frames.push_back(std::move(frame)); } };
+			if (snapshot || !RoomDirectory::WriteChanges(diff, type, since, version))
+				RoomDirectory::WriteSnapshot(diff, type, version);
+			diff.Finish();
+		}
+
+		std::vector<PlayerHandle> gone{};
+		{
+			EpochReclaimer::ReadGuard guard{};
+			for (auto handle : handles)
+			{
+				Player* p = PlayerMgr::Resolve(handle);
+				if (p == nullptr || !p->IsConnected())
+				{
+					gone.push_back(handle);
+					continue;
+				}
+				for (auto& frame : frames)
+					p->Send(frame);
+			}
+		}
+
+		std::lock_guard<std::mutex> lock(feed._mutex);
+		for (auto handle : handles)
+		{
+			auto it = feed._subscribers.find(handle);
+			// resubscribed meanwhile, it gets a fresh snapshot next round
+			if (it == feed._subscribers.end() || it->second.needsSnapshot != snapshot || it->second.type != type)
+				continue;
+			it->second.version = version;
+			it->second.needsSnapshot = false;
+		}
+		for (auto handle : gone)
+			feed._subscribers.erase(handle);
+	}
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include "Player/PlayerHandle.h"
+#include <unordered_map>
+#include <chrono>
+#include <mutex>
+
+// push based lobby view, replaces polling print_room
+// a subscriber gets a snapshot of the rooms of its type first and then, at most every LOBBY_PUSH_INTERVAL_MS,
+// one coalesced diff of what changed in RoomDirectory since the version it last received.
+// subscribers at the same version and type share one encoded diff, so the cost follows the change rate.
+// a subscription ends with its connection, a resumed client subscribes again.
+class LobbyFeed
+{
+	struct Subscription
+	{
+		uint16_t type = 0;
+		uint32_t version = 0;
+		bool needsSnapshot = true;
+	};
+
+	static LobbyFeed& Instance();
+
+	std::unordered_map<PlayerHandle, Subscription> _subscribers{};
+	std::mutex _mutex;
+	std::chrono::steady_clock::time_point _nextPush{};
+
+	LobbyFeed() = default;
+	LobbyFeed(const LobbyFeed&) = delete;
+	LobbyFeed& operator=(const LobbyFeed&) = delete;
+
+public:
+	// type is a Room::RoomType or RoomDirectory::Query::ANY_TYPE, subscribing again changes it and resends the snapshot
+	static void Subscribe(PlayerHandle player, uint16_t type);
+	static void Unsubscribe(PlayerHandle player);
+	// main thread, once per tick
+	static void Tick();
+};
@@ -1,18 +1,67 @@
 #include "pch.h"
 #include "PokerRoom.h"
 #include "RoomMgr.h"
+#include "RoomDirectory.h"
 #include "Net/NetPack.h"
 #include "Player/PlayerUtils.h"
+#include "Const.h"
+#include <filesystem>
+#include <fstream>
 
-void PokerRoom::OnPlayerExit(std::shared_ptr<Player> player)
+namespace
 {
+	long long SteadyNowMs()
+	{
+		return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+}
+
+RpcError PokerRoom::OnPlayerJoin(Player* player)
+{
+	if (!Touch())
+		return RpcError::ROOM_UNAVAILABLE;
+	auto err = Room::OnPlayerJoin(player);
+	if (err != RpcError::SUCCESS)
+		return err;
+	// spectators only get the table when it changes, so a newcomer gets it here; queued behind this join
+	// on the same executor, so it arrives after the rpc_client_goto_room reply
+	RoomMgr::PostToRoom(_roomId, player->GetHandle(), [self = shared_from_this(), this](Player* p)
+		{
+			if (!IsPlayerInRoom(p->GetHandle()) || !Touch())
+				return;
+			bool seated = false;
+			{
+				auto rLock = _lock.OnRead();
+				seated = _game->GetSeatByPlayerId(p->GetID()) != nullptr;
+			}
+			// a seat still held from before the player left shows its own cards
+			if (seated || _spectatorView.empty())
+			{
+				SendTableInfoTo(p);
+				return;
+			}
+			// the view the other spectators already have
+			NetPack view{ reinterpret_cast<uint8_t*>(_spectatorView.data()) };
+			p->Send(view);
+		});
+	return RpcError::SUCCESS;
+}
+
+void PokerRoom::OnPlayerExit(Player* player)
+{
+	bool resident = Touch();
 	if (player)
 	{
-		ReturnChipsToPlayer(player);
+		int playerId = player->GetID();
+		// an exit cannot be refused; the stack stays in the hibernation file, which is kept for recovery
+		if (resident)
+			ReturnChipsToPlayer(player);
+		else
+			std::cerr << "[PokerRoom] CRITICAL: player " << playerId << " left room " << _roomId << " with its stack still in " << GetHibernationPath() << std::endl;
 
 		auto wLock = _lock.OnWrite();
-		int playerId = player->GetID();
-		_game.MarkPendingLeave(playerId);
+		if (resident)
+			_game->MarkPendingLeave(playerId);
 		UnregisterPlayer(playerId);
 	}
 	Room::OnPlayerExit(player);
@@ -30,8 +79,10 @@ void PokerRoom::OnPlayerExit(std::shared_ptr<Player> player)
 		RoomMgr::RemoveRoom(_roomId);
 }
 
-RpcError PokerRoom::OnRecvPlayerNetPack(std::shared_ptr<Player> player, NetPack& pack)
+RpcError PokerRoom::OnRecvPlayerNetPack(Player* player, NetPack& pack)
 {
+	if (!Touch())
+		return RpcError::ROOM_UNAVAILABLE;
 	switch (pack.MsgType())
 	{
 	case RpcEnum::rpc_server_get_poker_table_info:
@@ -77,49 +128,159 @@ void PokerRoom::OnRoomCreated(int id)
 {
 	Room::OnRoomCreated(id);
 	_type = RoomType::POKER_ROOM;
+	_lastActivityMs = SteadyNowMs();
+}
+
+bool PokerRoom::Touch()
+{
+	// pairs with Hibernate, which raises the flag before checking activity: either it sees this touch and
+	// backs off, or this thread sees the flag and waits on the lock for the table to be written
+	_lastActivityMs = SteadyNowMs();
+	if (!_hibernating)
+		return true;
+
+	auto wLock = _lock.OnWrite();
+	if (!_hibernating)
+		return true;
+	auto path = GetHibernationPath();
+	auto game = std::make_unique<HoldemPokerGame>();
+	{
+		std::ifstream in(path, std::ios::binary);
+		if (!in || !game->ReadIdleState(in))
+		{
+			// the seated stacks only exist in that file, an empty table in its place would lose them for good
+			std::cerr << "[PokerRoom] CRITICAL: room " << _roomId << " could not read its table back from " << path << ", staying hibernated" << std::endl;
+			return false;
+		}
+	}
+	std::error_code ec;
+	std::filesystem::remove(path, ec);
+	_game = std::move(game);
+	_hibernating = false;
+	RoomMgr::WakeRoom(_roomId);
+	return true;
+}
+
+bool PokerRoom::Hibernate()
+{
+	if (_hibernating || _roomExpired || !_game->IsIdle())
+		return false;
+	_hibernating = true;
+	if (SteadyNowMs() - _lastActivityMs < ROOM_HIBERNATE_AFTER_MS)
+	{
+		_hibernating = false;
+		return false;
+	}
+
+	auto path = GetHibernationPath();
+	std::error_code ec;
+	std::filesystem::create_directories(ROOM_HIBERNATE_DIR, ec);
+	{
+		std::ofstream out(path, std::ios::binary | std::ios::trunc);
+		if (out && _game->WriteIdleState(out))
+			out.flush();
+		if (!out)
+		{
+			std::cout << "STD ERROR: PokerRoom " << _roomId << " could not write " << path << ", staying resident" << std::endl;
+			// retry after another full idle period rather than every tick
+			_lastActivityMs = SteadyNowMs();
+			_hibernating = false;
+			return false;
+		}
+	}
+	_game.reset();
+	// only a post brings it back, until then its executor does not look at it
+	RoomMgr::SleepRoom(_roomId);
+	return true;
+}
+
+std::string PokerRoom::GetHibernationPath() const
+{
+	return std::string(ROOM_HIBERNATE_DIR) + "/poker_room_" + std::to_string(_roomId) + ".bin";
+}
+
+RoomSummary PokerRoom::Summarize()
+{
+	RoomSummary row = Room::Summarize();
+	auto wLock = _lock.OnWrite();
+	row.smallBlind = _game->GetSmallBlind();
+	row.bigBlind = _game->GetBigBlind();
+	row.seatedCount = (uint8_t)_game->GetSeatedCount();
+	row.freeSeats = (uint8_t)(HoldemPokerGame::MAX_SEATS - _game->GetSeatedCount());
+	_listedTableVersion = _game->GetTableVersion();
+	return row;
+}
+
+void PokerRoom::UpdateListing()
+{
+	if (_game->GetTableVersion() == _listedTableVersion)
+		return;
+	_listedTableVersion = _game->GetTableVersion();
+	RoomDirectory::SetTable(_roomId, _game->GetSmallBlind(), _game->GetBigBlind(), _game->GetSeatedCount(), HoldemPokerGame::MAX_SEATS);
 }
 
 void PokerRoom::OnTick()
 {
 	bool shouldBroadcastHandResult = false;
 	HandResult handResult;
+	std::vector<ChipDelta> leaverPayouts{};
 	
 	{
 		auto wLock = _lock.OnWrite();
-		_game.RemovePendingLeavers();
-		if (_game.CanStart())
-			_game.StartHand();
-		_game.ProcessAutoModePlayer();
-		_game.ResolveIfNeeded();
+		// players who left mid-hand still own their stack once the hand is over, pay them all out in one settlement
+		for (const auto& seat : _game->GetSeats())
+		{
+			if (seat.playerId >= 0 && seat.pendingLeave && !seat.inHand && seat.chips > 0)
+				leaverPayouts.push_back(ChipDelta{ seat.playerId, seat.chips });
+		}
+		for (const auto& payout : leaverPayouts)
+			_game->CashOut(payout.playerId);
+		_game->RemovePendingLeavers();
+		if (_game->CanStart())
+			_game->StartHand();
+		_game->ProcessAutoModePlayer();
+		_game->ResolveIfNeeded();
 		
 		// Check for pending hand result
-		if (_game.HasPendingHandResult())
+		if (_game->HasPendingHandResult())
 		{
 			shouldBroadcastHandResult = true;
-			handResult = _game.GetLastHandResult();
-			_game.ClearPendingHandResult();
+			handResult = _game->GetLastHandResult();
+			_game->ClearPendingHandResult();
 		}
+		UpdateListing();
+		if (!_game->IsIdle() || !leaverPayouts.empty() || shouldBroadcastHandResult)
+			_lastActivityMs = SteadyNowMs();
 	}
 	
+	if (!leaverPayouts.empty())
+		SettleLeaverPayouts(std::move(leaverPayouts));
+
 	// Broadcast hand result if available
 	if (shouldBroadcastHandResult)
 		BroadcastHandResult(handResult);
 	
-	BroadcastTableInfo();
+	BroadcastTableInfo(true);
+
+	if (SteadyNowMs() - _lastActivityMs >= ROOM_HIBERNATE_AFTER_MS)
+	{
+		auto wLock = _lock.OnWrite();
+		Hibernate();
+	}
 }
 
-std::shared_ptr<Player> PokerRoom::GetPlayerById(int playerId)
+PlayerHandle PokerRoom::GetPlayerById(int playerId)
 {
 	auto it = _playerById.find(playerId);
 	if (it != _playerById.end())
 		return it->second;
-	return nullptr;
+	return INVALID_PLAYER_HANDLE;
 }
 
-void PokerRoom::RegisterPlayer(std::shared_ptr<Player> player)
+void PokerRoom::RegisterPlayer(Player* player)
 {
 	if (player)
-		_playerById[player->GetID()] = player;
+		_playerById[player->GetID()] = player->GetHandle();
 }
 
 void PokerRoom::UnregisterPlayer(int playerId)
@@ -127,7 +288,7 @@ void PokerRoom::UnregisterPlayer(int playerId)
 	_playerById.erase(playerId);
 }
 
-void PokerRoom::SendTableInfoTo(std::shared_ptr<Player> player)
+void PokerRoom::SendTableInfoTo(Player* player)
 {
 	if (!player || player->Expired()) return;
 
@@ -135,48 +296,56 @@ void PokerRoom::SendTableInfoTo(std::shared_ptr<Player> player)
 	{
 		auto rLock = _lock.OnRead();
 		send.WriteInt32(_roomId);
-		_game.WriteTable(send, player->GetID());
+		_game->WriteTable(send, player->GetID());
 	}
 	player->Send(send);
 }
 
-void PokerRoom::BroadcastTableInfo()
+void PokerRoom::BroadcastTableInfo(bool includeSpectators)
 {
-	std::vector<std::shared_ptr<Player>> members{};
+	// seated players, the acting one among them, see their own hole cards and get a pack each.
+	// everyone else sees the same table, encoded once and shared; what happened between two spectator
+	// pushes is coalesced into the next one, and an unchanged table is not pushed again
+	std::vector<int> seatedIds{};
+	std::unique_ptr<NetPack> spectatorView{};
 	{
 		auto rLock = _lock.OnRead();
-		for (const auto& m : _members)
+		for (const auto& seat : _game->GetSeats())
+			seatedIds.push_back(seat.playerId);
+		long long now = SteadyNowMs();
+		if (includeSpectators && now - _spectatorViewAtMs >= POKER_SPECTATOR_UPDATE_MS)
 		{
-			if (m && !m->Expired())
-				members.push_back(m);
+			_spectatorViewAtMs = now;
+			auto view = std::make_unique<NetPack>(RpcEnum::rpc_client_get_poker_table_info);
+			view->WriteInt32(_roomId);
+			// no seat has id -1, so this shows exactly what a player without a seat may see
+			_game->WriteTable(*view, -1);
+			std::string_view bytes{ view->GetContent(), view->Length() };
+			if (bytes != _spectatorView)
+			{
+				_spectatorView.assign(bytes);
+				spectatorView = std::move(view);
+			}
 		}
 	}
-	for (auto& p : members)
-		SendTableInfoTo(p);
+	ForEachPlayerInRoom([this, &seatedIds, &spectatorView](Player* p)
+		{
+			if (std::find(seatedIds.begin(), seatedIds.end(), p->GetID()) != seatedIds.end())
+				SendTableInfoTo(p);
+			else if (spectatorView != nullptr)
+				p->Send(*spectatorView);
+		});
 }
 
 void PokerRoom::BroadcastHandResult(const HandResult& result)
 {
-	std::vector<std::shared_ptr<Player>> members{};
-	{
-		auto rLock = _lock.OnRead();
-		for (const auto& m : _members)
-		{
-			if (m && !m->Expired())
-				members.push_back(m);
-		}
-	}
-	
-	for (auto& p : members)
-	{
-		NetPack send{ RpcEnum::rpc_client_poker_hand_result };
-		send.WriteInt32(_roomId);
-		result.Write(send);
-		p->Send(send);
-	}
+	NetPack send{ RpcEnum::rpc_client_poker_hand_result };
+	send.WriteInt32(_roomId);
+	result.Write(send);
+	ForEachPlayerInRoom([&send](Player* p) { p->Send(send); });
 }
 
-void PokerRoom::HandleSitDown(std::shared_ptr<Player> player, int seatIdx)
+void PokerRoom::HandleSitDown(Player* player, int seatIdx)
 {
 	if (!player) return;
 
@@ -184,36 +353,45 @@ void PokerRoom::HandleSitDown(std::shared_ptr<Player> player, int seatIdx)
 	int playerId = player->GetID();
 	int actualSeatIdx = -1;
 
-	if (!_game.SitDown(playerId, seatIdx, actualSeatIdx))
+	if (!_game->SitDown(playerId, seatIdx, actualSeatIdx))
 		return;
 
 	RegisterPlayer(player);
+	UpdateListing();
 
 	NetPack send{ RpcEnum::rpc_client_sit_down };
 	send.WriteInt32(actualSeatIdx);
 	send.WriteInt32(0);
-	send.WriteInt32(_game.GetMinBuyin());
-	send.WriteInt32(_game.GetBigBlind());
+	send.WriteInt32(_game->GetMinBuyin());
+	send.WriteInt32(_game->GetBigBlind());
 	send.WriteInt32(player->GetInfo().GetChip());
 	player->Send(send);
 }
 
-void PokerRoom::HandleBuyIn(std::shared_ptr<Player> player, int amount)
+void PokerRoom::HandleBuyIn(Player* player, int amount)
 {
 	if (!player) return;
 
 	int playerId = player->GetID();
 	int walletChips = player->GetInfo().GetChip();
 
-	if (!_game.AreBlindsSet())
+	RpcError err = RpcError::SUCCESS;
+	int minBuyin = 0;
 	{
-		player->SendError(RpcError::POKER_BLINDS_NOT_SET);
-		return;
+		// the buy-in callback and the tick change the table under the write lock
+		auto rLock = _lock.OnRead();
+		if (_game == nullptr)
+			err = RpcError::ROOM_UNAVAILABLE;
+		else if (!_game->AreBlindsSet())
+			err = RpcError::POKER_BLINDS_NOT_SET;
+		else if (_game->GetSeatByPlayerId(playerId) == nullptr)
+			err = RpcError::POKER_PLAYER_NOT_SEATED;
+		else
+			minBuyin = _game->GetMinBuyin();
 	}
-
-	if (_game.GetSeatByPlayerId(playerId) == nullptr)
+	if (err != RpcError::SUCCESS)
 	{
-		player->SendError(RpcError::POKER_PLAYER_NOT_SEATED);
+		player->SendError(err);
 		return;
 	}
 
@@ -223,7 +401,7 @@ void PokerRoom::HandleBuyIn(std::shared_ptr<Player> player, int amount)
 		return;
 	}
 
-	if (amount < _game.GetMinBuyin())
+	if (amount < minBuyin)
 	{
 		NetPack send{ RpcEnum::rpc_client_poker_buyin };
 		send.WriteUInt8(static_cast<uint8_t>(HoldemPokerGame::BuyInResult::BelowMinimum));
@@ -233,84 +411,116 @@ void PokerRoom::HandleBuyIn(std::shared_ptr<Player> player, int amount)
 		return;
 	}
 
-	PlayerUtils::AddChipsToDatabase(playerId, -amount, [this, player, playerId, amount](bool dbSuccess)
+	// the db callback runs on a db worker, keep the room alive until it is done
+	// the player may disconnect meanwhile, so only its handle is captured
+	PlayerUtils::AddChipsToDatabase(playerId, -amount, [self = shared_from_this(), this, owner = player->GetHandle(), playerId, amount](bool dbSuccess)
 		{
 			if (!dbSuccess)
 			{
-				player->SendError(RpcError::POKER_BUYIN_FAILED);
+				PlayerMgr::WithPlayer(owner, [](Player* p) { p->SendError(RpcError::POKER_BUYIN_FAILED); });
 				return;
 			}
 
-			player->GetInfo().AddChipsMemoryOnly(-amount);
+			PlayerMgr::WithPlayer(owner, [amount](Player* p) { p->GetInfo().AddChipsMemoryOnly(-amount); });
 
-			// ????
+			// the table may have hibernated while the write was in flight
+			bool resident = Touch();
 			auto wLock = _lock.OnWrite();
-			auto result = _game.BuyIn(playerId, amount);
+			auto result = resident && _game != nullptr ? _game->BuyIn(playerId, amount) : HoldemPokerGame::BuyInResult::PlayerNotFound;
 
 			NetPack send{ RpcEnum::rpc_client_poker_buyin };
 			send.WriteUInt8(static_cast<uint8_t>(result));
 			if (result == HoldemPokerGame::BuyInResult::Success)
 			{
-				const Seat* seat = _game.GetSeatByPlayerId(playerId);
+				const Seat* seat = _game->GetSeatByPlayerId(playerId);
 				send.WriteInt32(seat ? seat->chips : 0);  // ????
 			}
 			else
 			{
-				PlayerUtils::AddChipsToDatabase(playerId, amount, [player, amount](bool refundSuccess)
+				PlayerUtils::AddChipsToDatabase(playerId, amount, [owner, amount](bool refundSuccess)
 					{
 						if (refundSuccess)
-							player->GetInfo().AddChipsMemoryOnly(amount);
+							PlayerMgr::WithPlayer(owner, [amount](Player* p) { p->GetInfo().AddChipsMemoryOnly(amount); });
 					});
 				send.WriteInt32(0);
 			}
-			send.WriteInt32(player->GetInfo().GetChip());
-			player->Send(send);
+			PlayerMgr::WithPlayer(owner, [&send](Player* p)
+				{
+					send.WriteInt32(p->GetInfo().GetChip());
+					p->Send(send);
+				});
 		});
 }
 
-void PokerRoom::HandleStandUp(std::shared_ptr<Player> player)
+void PokerRoom::HandleStandUp(Player* player)
 {
 	if (!player) return;
 
 	auto wLock = _lock.OnWrite();
 	int playerId = player->GetID();
-	bool success = _game.StandUp(playerId);
+	bool success = _game->StandUp(playerId);
 
 	NetPack send{ RpcEnum::rpc_client_poker_standup };
 	send.WriteUInt8(success ? 1 : 0);
 	player->Send(send);
 }
 
-void PokerRoom::HandleSetBlinds(std::shared_ptr<Player> player, int smallBlind, int bigBlind)
+void PokerRoom::HandleSetBlinds(Player* player, int smallBlind, int bigBlind)
 {
 	if (!player) return;
 
 	auto wLock = _lock.OnWrite();
-	auto result = _game.SetBlinds(smallBlind, bigBlind);
+	auto result = _game->SetBlinds(smallBlind, bigBlind);
+	UpdateListing();
 
 	NetPack send{ RpcEnum::rpc_client_poker_set_blinds };
 	send.WriteUInt8(static_cast<uint8_t>(result));
-	send.WriteInt32(_game.GetSmallBlind());
-	send.WriteInt32(_game.GetBigBlind());
-	send.WriteInt32(_game.GetMinBuyin());
+	send.WriteInt32(_game->GetSmallBlind());
+	send.WriteInt32(_game->GetBigBlind());
+	send.WriteInt32(_game->GetMinBuyin());
 	player->Send(send);
 }
 
-void PokerRoom::HandlePlayerAction(std::shared_ptr<Player> player, uint8_t action, int amount)
+void PokerRoom::HandlePlayerAction(Player* player, uint8_t action, int amount)
 {
 	if (!player) return;
 
-	auto wLock = _lock.OnWrite();
-	int playerId = player->GetID();
+	{
+		auto wLock = _lock.OnWrite();
+		int playerId = player->GetID();
 
-	if (_game.CanStart())
-		_game.StartHand();
+		if (_game->CanStart())
+			_game->StartHand();
+
+		auto actionEnum = static_cast<HoldemPokerGame::Action>(action);
+		_game->HandleAction(playerId, actionEnum, amount);
+	}
+	// the table moved on, whoever is seated sees it now rather than at the next tick
+	BroadcastTableInfo(false);
+}
 
-	auto actionEnum = static_cast<HoldemPokerGame::Action>(action);
-	_game.HandleAction(playerId, actionEnum, amount);
+void PokerRoom::SettleLeaverPayouts(std::vector<ChipDelta> payouts)
+{
+	PlayerUtils::SettleChipsToDatabase(payouts, [payouts](bool success)
+		{
+			if (!success)
+			{
+				for (const auto& payout : payouts)
+					std::cerr << "[PokerRoom] CRITICAL: Failed to return " << payout.delta << " chips to player " << payout.playerId << std::endl;
+				return;
+			}
+			// keep the wallet of anyone still online in sync
+			for (const auto& payout : payouts)
+			{
+				PlayerMgr::ForPlayerWithGivenID(payout.playerId, [delta = payout.delta](Player* p)
+					{
+						p->GetInfo().AddChipsMemoryOnly(delta);
+					});
+			}
+		});
 }
 
-void PokerRoom::ReturnChipsToPlayer(std::shared_ptr<Player> player)
+void PokerRoom::ReturnChipsToPlayer(Player* player)
 {
 	if (!player) return;
 
@@ -319,21 +529,22 @@ void PokerRoom::ReturnChipsToPlayer(std::shared_ptr<Player> player)
 
 	{
 		auto wLock = _lock.OnWrite();
-		tableChips = _game.CashOut(playerId);
+		tableChips = _game->CashOut(playerId);
 	}
 
 	if (tableChips <= 0) return;
 
-	PlayerUtils::AddChipsToDatabase(playerId, tableChips, [player, tableChips](bool success)
+	// called on exit, the player is usually gone by the time the db answers
+	PlayerUtils::AddChipsToDatabase(playerId, tableChips, [owner = player->GetHandle(), playerId, tableChips](bool success)
 		{
 			if (success)
 			{
-				player->GetInfo().AddChipsMemoryOnly(tableChips);
-				std::cout << "[PokerRoom] Returned " << tableChips << " chips to player " << player->GetID() << std::endl;
+				PlayerMgr::WithPlayer(owner, [tableChips](Player* p) { p->GetInfo().AddChipsMemoryOnly(tableChips); });
+				std::cout << "[PokerRoom] Returned " << tableChips << " chips to player " << playerId << std::endl;
 			}
 			else
 			{
-				std::cerr << "[PokerRoom] CRITICAL: Failed to return " << tableChips << " chips to player " << player->GetID() << std::endl;
+				std::cerr << "[PokerRoom] CRITICAL: Failed to return " << tableChips << " chips to player " << playerId << std::endl;
 			}
 		});
 }
@@ -1,34 +1,62 @@
 #pragma once
 #include "Room.h"
 #include "Game/HoldemPokerGame.h"
+#include "Database/StorageBackend.h"
 #include <unordered_map>
 #include <functional>
+#include <memory>
+#include <atomic>
+#include <string>
 
 class PokerRoom : public Room
 {
 public:
-	void OnPlayerExit(std::shared_ptr<Player> player) override;
-	RpcError OnRecvPlayerNetPack(std::shared_ptr<Player> player, NetPack& pack) override;
+	void OnPlayerExit(Player* player) override;
+	RpcError OnRecvPlayerNetPack(Player* player, NetPack& pack) override;
 	virtual void OnRoomCreated(int id);
+	RoomSummary Summarize() override;
 	void OnTick() override;
 
+protected:
+	RpcError OnPlayerJoin(Player* player) override;
+
 private:
-	HoldemPokerGame _game{};
-	std::unordered_map<int, std::shared_ptr<Player>> _playerById{};
+	// null while hibernating
+	std::unique_ptr<HoldemPokerGame> _game = std::make_unique<HoldemPokerGame>();
+	// steady clock ms of the last join, exit, packet or tick with a hand running
+	std::atomic<long long> _lastActivityMs{ 0 };
+	// table version last pushed to RoomDirectory
+	uint32_t _listedTableVersion = 0;
+	// the spectator view last pushed and when it was last checked, only the room's executor touches these (tick and joins)
+	std::string _spectatorView{};
+	long long _spectatorViewAtMs = 0;
+	std::unordered_map<int, PlayerHandle> _playerById{};
 
-	std::shared_ptr<Player> GetPlayerById(int playerId);
-	void RegisterPlayer(std::shared_ptr<Player> player);
+	PlayerHandle GetPlayerById(int playerId);
+	void RegisterPlayer(Player* player);
 	void UnregisterPlayer(int playerId);
 
-	void SendTableInfoTo(std::shared_ptr<Player> player);
-	void BroadcastTableInfo();
+	// call before touching _game without holding _lock, reloads the table if the room is hibernating
+	// false if the table could not be read back, the room then stays hibernated and keeps its file
+	bool Touch();
+	// caller holds the write lock, false if the table is busy or could not be written
+	bool Hibernate();
+	std::string GetHibernationPath() const;
+
+	// caller holds _lock, pushes blinds and seats to RoomDirectory if the table changed since the last push
+	void UpdateListing();
+
+	void SendTableInfoTo(Player* player);
+	// seated players every time, spectators only from the tick and at most every POKER_SPECTATOR_UPDATE_MS
+	void BroadcastTableInfo(bool includeSpectators);
 	void BroadcastHandResult(const HandResult& result);
 
-	void HandleSitDown(std::shared_ptr<Player> player, int seatIdx);
-	void HandleBuyIn(std::shared_ptr<Player> player, int amount);
-	void HandleStandUp(std::shared_ptr<Player> player);
-	void HandleSetBlinds(std::shared_ptr<Player> player, int smallBlind, int bigBlind);
-	void HandlePlayerAction(std::shared_ptr<Player> player, uint8_t action, int amount);
+	void HandleSitDown(Player* player, int seatIdx);
+	void HandleBuyIn(Player* player, int amount);
+	void HandleStandUp(Player* player);
+	void HandleSetBlinds(Player* player, int smallBlind, int bigBlind);
+	void HandlePlayerAction(Player* player, uint8_t action, int amount);
 
-	void ReturnChipsToPlayer(std::shared_ptr<Player> player);
+	void ReturnChipsToPlayer(Player* player);
+	void SettleLeaverPayouts(std::vector<ChipDelta> payouts);
 };
@@ -1,7 +1,15 @@
 #include "pch.h"
 #include "Net/NetPack.h"
+#include "Net/NetPackStream.h"
 #include "Room.h"
+#include "RoomDirectory.h"
+#include "Utils/EpochReclaimer.h"
+#include <algorithm>
 
+Room::~Room()
+{
+	delete _members.exchange(nullptr);
+}
 void Room::OnRoomCreated(int id)
 {
 	_roomId = id;
@@ -10,67 +18,102 @@ void Room::OnRoomDestroy()
 {
 
 }
-RpcError Room::OnPlayerJoin(std::shared_ptr<Player> player)
+RpcError Room::OnPlayerJoin(Player* player)
 {
 	auto wLock = _lock.OnWrite();
-	if (IsPlayerInRoom(player))
+	if (IsPlayerInRoom(player->GetHandle()))
 		return RpcError::ALREADY_IN_SELECTED_ROOM;
 	if (_roomExpired)
 		return RpcError::ROOM_NOT_EXIST;
-	_members.insert(player);
+	AddMember(player->GetHandle());
 	return RpcError::SUCCESS;
 }
-void Room::OnPlayerExit(std::shared_ptr<Player> player)
+void Room::OnPlayerExit(Player* player)
 {
 	auto wLock = _lock.OnWrite();
-	if (!IsPlayerInRoom(player))
-		return;
-	_members.erase(player);
+	RemoveMember(player->GetHandle());
 }
-RpcError Room::OnRecvPlayerNetPack(std::shared_ptr<Player> player, NetPack& pack)
+RpcError Room::OnRecvPlayerNetPack(Player* player, NetPack& pack)
 {
 	return RpcError::ROOM_TYPE_ERROR;
 }
-void Room::WriteRoom(NetPack& pack)
+void Room::WriteRoom(NetPackStream& pack)
 {
-	std::unordered_set<std::shared_ptr<Player>> members{};
+	EpochReclaimer::ReadGuard guard{};
+	const auto& handles = GetMembers().handles;
+	std::vector<Player*> members{};
+	members.reserve(handles.size());
+	for (auto handle : handles)
 	{
-		auto rLock = _lock.OnRead();
-		members = std::unordered_set<std::shared_ptr<Player>>(_members);
+		if (auto p = PlayerMgr::Resolve(handle))
+			members.push_back(p);
 	}
 	pack.WriteInt32(_roomId);
 	pack.WriteUInt16(_type);  // Write room type
 	pack.WriteUInt32((uint32_t)members.size());
-	for (const auto& p : members)
+	for (auto p : members)
 		p->GetInfo().WriteInfo(pack);
 }
 
-bool Room::IsPlayerInRoom(std::shared_ptr<Player> player)
+RoomSummary Room::Summarize()
 {
-	return _members.contains(player);
+	RoomSummary row{};
+	row.roomId = _roomId;
+	row.type = _type;
+	row.memberCount = (uint32_t)GetPlayerCnt();
+	return row;
+}
+bool Room::IsPlayerInRoom(PlayerHandle player)
+{
+	EpochReclaimer::ReadGuard guard{};
+	const auto& handles = GetMembers().handles;
+	return std::binary_search(handles.begin(), handles.end(), player);
 }
 size_t Room::GetPlayerCnt()
 {
-	return _members.size();
+	EpochReclaimer::ReadGuard guard{};
+	return GetMembers().handles.size();
 }
-void Room::ForEachPlayerInRoom(std::function<void(std::shared_ptr<Player>)> func)
+void Room::PublishMembers(std::vector<PlayerHandle>&& handles)
 {
-	std::unordered_set<std::shared_ptr<Player>> members{};
-	{
-		auto rLock = _lock.OnRead();
-		members = std::unordered_set<std::shared_ptr<Player>>(_members);
-	}
-	for (auto iter = members.begin(); iter != members.end();)
+	auto next = new MemberSnapshot();
+	next->handles = std::move(handles);
+	next->version = GetMembers().version + 1;
+	RoomDirectory::SetMemberCount(_roomId, (uint32_t)next->handles.size());
+	auto prev = _members.exchange(next);
+	EpochReclaimer::Retire([prev]() { delete prev; });
+}
+bool Room::AddMember(PlayerHandle player)
+{
+	if (IsPlayerInRoom(player))
+		return false;
+	auto handles = GetMembers().handles;
+	handles.insert(std::upper_bound(handles.begin(), handles.end(), player), player);
+	PublishMembers(std::move(handles));
+	return true;
+}
+bool Room::RemoveMember(PlayerHandle player)
+{
+	if (!IsPlayerInRoom(player))
+		return false;
+	auto handles = GetMembers().handles;
+	std::erase(handles, player);
+	PublishMembers(std::move(handles));
+	return true;
+}
+void Room::ForEachPlayerInRoom(std::function<void(Player*)> func)
+{
+	EpochReclaimer::ReadGuard guard{};
+	for (auto handle : GetMembers().handles)
 	{
-		auto p = *iter;
-		if (p->Expired())
+		auto p = PlayerMgr::Resolve(handle);
+		if (p == nullptr || p->Expired())
 			continue;
 		func(p);
-		iter++;
 	}
 }
 
 void Room::OnTick()
 {
 
-}
\ No newline at end of file
+}
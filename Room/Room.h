@@ -4,12 +4,15 @@
 #include "Player/Player.h"
 #include <thread>
 #include <mutex>
+#include <atomic>
 
 // todo: more room type
 
 class NetPack;
+class NetPackStream;
+struct RoomSummary;
 class RoomMgr;
-class Room
+class Room : public std::enable_shared_from_this<Room>
 {
 public:
 	enum RoomType : uint16_t
@@ -19,30 +22,55 @@ public:
 		POKER_ROOM = 2,
 	};
 protected:
-	std::unordered_set<std::shared_ptr<Player>> _members{};
+	// immutable, sorted member list; joins and exits publish a copy under _lock and retire the old one
+	// through EpochReclaimer, so broadcasts walk it without locking or allocating
+	struct MemberSnapshot
+	{
+		// bumped on every join and exit
+		uint64_t version = 0;
+		std::vector<PlayerHandle> handles{};
+	};
+
+	std::atomic<const MemberSnapshot*> _members{ new MemberSnapshot() };
 	ReadWriteLock _lock{};
 	RoomType _type;
 	int _roomId;
 	bool _roomExpired = false;
+	// set by rooms that parked their state, RoomMgr does not tick them
+	std::atomic<bool> _hibernating{ false };
 
 public:
+	virtual ~Room();
+
 int GetRoomID() const { return _roomId; }
 RoomType GetRoomType() const { return _type; }
+	bool IsHibernating() const { return _hibernating.load(); }
 
 	virtual void OnRoomCreated(int id);
 	virtual void OnRoomDestroy();
-	virtual void OnPlayerExit(std::shared_ptr<Player> player);
-	virtual RpcError OnRecvPlayerNetPack(std::shared_ptr<Player> player, NetPack& pack);
-	virtual void WriteRoom(NetPack& pack);
+	// player pointers passed to rooms are only valid for the duration of the call
+	virtual void OnPlayerExit(Player* player);
+	virtual RpcError OnRecvPlayerNetPack(Player* player, NetPack& pack);
+	virtual void WriteRoom(NetPackStream& pack);
+	// lobby row as of now, RoomMgr lists it in RoomDirectory on creation
+	virtual RoomSummary Summarize();
 
-	virtual bool IsPlayerInRoom(std::shared_ptr<Player> player);
+	virtual bool IsPlayerInRoom(PlayerHandle player);
 	virtual size_t GetPlayerCnt();
-	virtual void ForEachPlayerInRoom(std::function<void(std::shared_ptr<Player>)> func);
+	// skips players that are gone or expired
+	virtual void ForEachPlayerInRoom(std::function<void(Player*)> func);
 
 	virtual void OnTick();
 
 protected:
-	virtual RpcError OnPlayerJoin(std::shared_ptr<Player> player);
+	virtual RpcError OnPlayerJoin(Player* player);
+	// caller holds an EpochReclaimer::ReadGuard, the snapshot stays valid until it drops
+	const MemberSnapshot& GetMembers() const { return *_members.load(std::memory_order_acquire); }
+	// caller holds the write lock
+	void PublishMembers(std::vector<PlayerHandle>&& handles);
+	// caller holds the write lock, false if the player already was (or was not) a member
+	bool AddMember(PlayerHandle player);
+	bool RemoveMember(PlayerHandle player);
 
 	friend RoomMgr;
 };
\ No newline at end of file
@@ -0,0 +1,326 @@
+#include "pch.h"
+#include "RoomDirectory.h"
+#include "Net/NetPack.h"
+#include "Net/NetPackStream.h"
+#include "Const.h"
+#include <climits>
+
+void RoomSummary::Write(NetPackStream& pack) const
+{
+	pack.WriteInt32(roomId);
+	pack.WriteUInt16(type);
+	pack.WriteUInt32(memberCount);
+	pack.WriteInt32(smallBlind);
+	pack.WriteInt32(bigBlind);
+	pack.WriteUInt8(seatedCount);
+	pack.WriteUInt8(freeSeats);
+}
+
+void RoomDirectory::Query::Read(NetPack& pack)
+{
+	type = pack.ReadUInt16();
+	minBigBlind = pack.ReadInt32();
+	maxBigBlind = pack.ReadInt32();
+	minFreeSeats = pack.ReadUInt8();
+	sortBy = (SortBy)pack.ReadUInt8();
+	cursorKey = pack.ReadInt32();
+	cursorRoomId = pack.ReadInt32();
+	limit = pack.ReadUInt16();
+}
+
+void RoomDirectory::Index::Insert(const RoomSummary& row)
+{
+	byId.insert(row.roomId);
+	byBigBlind.insert({ row.bigBlind, row.roomId });
+	byFreeSeats.insert({ -(int)row.freeSeats, row.roomId });
+}
+void RoomDirectory::Index::Erase(const RoomSummary& row)
+{
+	byId.erase(row.roomId);
+	byBigBlind.erase({ row.bigBlind, row.roomId });
+	byFreeSeats.erase({ -(int)row.freeSeats, row.roomId });
+}
+
+RoomDirectory& RoomDirectory::Instance()
+{
+	static RoomDirectory instance;
+	return instance;
+}
+
+void RoomDirectory::Reindex(const RoomSummary& before, const RoomSummary& after)
+{
+	_all.Erase(before);
+	_byType[before.type].Erase(before);
+	_all.Insert(after);
+	_byType[after.type].Insert(after);
+}
+
+void RoomDirectory::RecordChange(int roomId, Room::RoomType type)
+{
+	_changes.push_back(Change{ ++_version, roomId, type });
+	while (_changes.size() > LOBBY_CHANGE_LOG_CAPACITY)
+		_changes.pop_front();
+}
+
+bool RoomDirectory::Matches(const RoomSummary& row, const Query& query)
+{
+	if (query.minBigBlind > 0 && row.bigBlind < query.minBigBlind)
+		return false;
+	if (query.maxBigBlind > 0 && row.bigBlind > query.maxBigBlind)
+		return false;
+	return row.freeSeats >= query.minFreeSeats;
+}
+
+void RoomDirectory::AddRoom(const RoomSummary& row)
+{
+	auto& dir = Instance();
+	auto wLock = dir._lock.OnWrite();
+	if (auto it = dir._rows.find(row.roomId); it != dir._rows.end())
+	{
+		dir._all.Erase(it->second);
+		dir._byType[it->second.type].Erase(it->second);
+	}
+	dir._rows[row.roomId] = row;
+	dir._all.Insert(row);
+	dir._byType[row.type].Insert(row);
+	dir.RecordChange(row.roomId, row.type);
+}
+void RoomDirectory::RemoveRoom(int roomId)
+{
+	auto& dir = Instance();
+	auto wLock = dir._lock.OnWrite();
+	auto it = dir._rows.find(roomId);
+	if (it == dir._rows.end())
+		return;
+	dir._all.Erase(it->second);
+	dir._byType[it->second.type].Erase(it->second);
+	dir.RecordChange(roomId, it->second.type);
+	dir._rows.erase(it);
+}
+void RoomDirectory::RemoveRoomsIf(const std::function<bool(int)>& pred)
+{
+	auto& dir = Instance();
+	auto wLock = dir._lock.OnWrite();
+	for (auto it = dir._rows.begin(); it != dir._rows.end();)
+	{
+		if (!pred(it->first))
+		{
+			++it;
+			continue;
+		}
+		dir._all.Erase(it->second);
+		dir._byType[it->second.type].Erase(it->second);
+		dir.RecordChange(it->first, it->second.type);
+		it = dir._rows.erase(it);
+	}
+}
+bool RoomDirectory::GetRoom(int roomId, RoomSummary& outRow)
+{
+	auto& dir = Instance();
+	auto rLock = dir._lock.OnRead();
+	auto it = dir._rows.find(roomId);
+	if (it == dir._rows.end())
+		return false;
+	outRow = it->second;
+	return true;
+}
+void RoomDirectory::SetMemberCount(int roomId, uint32_t memberCount)
+{
+	auto& dir = Instance();
+	auto wLock = dir._lock.OnWrite();
+	auto it = dir._rows.find(roomId);
+	if (it == dir._rows.end() || it->second.memberCount == memberCount)
+		return;
+	// member count is not an index key
+	it->second.memberCount = memberCount;
+	dir.RecordChange(roomId, it->second.type);
+}
+void RoomDirectory::SetTable(int roomId, int smallBlind, int bigBlind, int seatedCount, int seatCount)
+{
+	auto& dir = Instance();
+	auto wLock = dir._lock.OnWrite();
+	auto it = dir._rows.find(roomId);
+	if (it == dir._rows.end())
+		return;
+	RoomSummary after = it->second;
+	after.smallBlind = smallBlind;
+	after.bigBlind = bigBlind;
+	after.seatedCount = (uint8_t)seatedCount;
+	after.freeSeats = (uint8_t)std::max(0, seatCount - seatedCount);
+	if (after.smallBlind == it->second.smallBlind && after.bigBlind == it->second.bigBlind
+		&& after.seatedCount == it->second.seatedCount && after.freeSeats == it->second.freeSeats)
+		return;
+	dir.Reindex(it->second, after);
+	it->second = after;
+	dir.RecordChange(roomId, after.type);
+}
+
+void RoomDirectory::WriteQuery(NetPackStream& pack, const Query& query)
+{
+	auto& dir = Instance();
+	size_t pageSize = query.limit == 0 ? LISTING_DEFAULT_PAGE_SIZE : std::min((size_t)query.limit, (size_t)LISTING_MAX_PAGE_SIZE);
+	std::vector<RoomSummary> page{};
+	bool more = false;
+	{
+		auto rLock = dir._lock.OnRead();
+		const Index* index = &dir._all;
+		if (query.type != Query::ANY_TYPE)
+		{
+			auto typeIt = dir._byType.find(query.type);
+			index = typeIt == dir._byType.end() ? nullptr : &typeIt->second;
+		}
+		// false once the page is full, the row after it only tells there is more
+		auto take = [&dir, &query, &page, &more, pageSize](int roomId)
+			{
+				const auto& row = dir._rows.at(roomId);
+				if (!Matches(row, query))
+					return true;
+				if (page.size() == pageSize)
+				{
+					more = true;
+					return false;
+				}
+				page.push_back(row);
+				return true;
+			};
+		bool firstPage = query.cursorRoomId == 0;
+
+		// a type nobody created yet has no index and no rows
+		if (index != nullptr)
+		{
+			switch (query.sortBy)
+			{
+			case SortBy::BigBlind:
+			{
+				// the blind range bounds the scan, not just the result
+				auto it = !firstPage ? index->byBigBlind.upper_bound({ query.cursorKey, query.cursorRoomId })
+					: query.minBigBlind > 0 ? index->byBigBlind.lower_bound({ query.minBigBlind, INT_MIN })
+					: index->byBigBlind.begin();
+				for (; it != index->byBigBlind.end(); ++it)
+				{
+					if (query.maxBigBlind > 0 && it->first > query.maxBigBlind)
+						break;
+					if (!take(it->second))
+						break;
+				}
+				break;
+			}
+			case SortBy::FreeSeats:
+			{
+				auto it = firstPage ? index->byFreeSeats.begin() : index->byFreeSeats.upper_bound({ -query.cursorKey, query.cursorRoomId });
+				for (; it != index->byFreeSeats.end(); ++it)
+				{
+					if (-it->first < query.minFreeSeats)
+						break;
+					if (!take(it->second))
+						break;
+				}
+				break;
+			}
+			default:
+			{
+				for (auto it = index->byId.upper_bound(query.cursorRoomId); it != index->byId.end(); ++it)
+				{
+					if (!take(*it))
+						break;
+				}
+				break;
+			}
+			}
+		}
+	}
+
+	pack.WriteUInt32((uint32_t)page.size());
+	for (const auto& row : page)
+		row.Write(pack);
+	pack.WriteUInt8(more ? 1 : 0);
+	int nextKey = 0;
+	int nextRoomId = 0;
+	if (more)
+	{
+		const auto& last = page.back();
+		nextKey = query.sortBy == SortBy::BigBlind ? last.bigBlind : query.sortBy == SortBy::FreeSeats ? (int)last.freeSeats : 0;
+		nextRoomId = last.roomId;
+	}
+	pack.WriteInt32(nextKey);
+	pack.WriteInt32(nextRoomId);
+}
+
+std::vector<int> RoomDirectory::GetRoomIdsAfter(int afterRoomId, size_t limit)
+{
+	auto& dir = Instance();
+	std::vector<int> ids{};
+	auto rLock = dir._lock.OnRead();
+	for (auto it = dir._all.byId.upper_bound(afterRoomId); it != dir._all.byId.end() && ids.size() < limit; ++it)
+		ids.push_back(*it);
+	return ids;
+}
+
+uint32_t RoomDirectory::GetVersion()
+{
+	auto& dir = Instance();
+	auto rLock = dir._lock.OnRead();
+	return dir._version;
+}
+
+bool RoomDirectory::WriteChanges(NetPackStream& pack, uint16_t type, uint32_t sinceVersion, uint32_t& outVersion)
+{
+	auto& dir = Instance();
+	auto rLock = dir._lock.OnRead();
+	if (sinceVersion < dir._version && (dir._changes.empty() || dir._changes.front().version > sinceVersion + 1))
+		return false;
+
+	// coalesce, a room that changed ten times since then is sent once as it is now
+	std::set<int> touched{};
+	auto first = std::upper_bound(dir._changes.begin(), dir._changes.end(), sinceVersion,
+		[](uint32_t version, const Change& change) { return version < change.version; });
+	for (auto it = first; it != dir._changes.end(); ++it)
+	{
+		if (TypeMatches(type, it->type))
+			touched.insert(it->roomId);
+	}
+	std::vector<const RoomSummary*> rows{};
+	std::vector<int> removed{};
+	for (int roomId : touched)
+	{
+		auto rowIt = dir._rows.find(roomId);
+		if (rowIt != dir._rows.end() && TypeMatches(type, rowIt->second.type))
+			rows.push_back(&rowIt->second);
+		else
+			removed.push_back(roomId);
+	}
+
+	outVersion = dir._version;
+	pack.WriteUInt8(0);
+	pack.WriteUInt32(outVersion);
+	pack.WriteUInt32((uint32_t)rows.size());
+	for (auto row : rows)
+		row->Write(pack);
+	pack.WriteUInt32((uint32_t)removed.size());
+	for (int roomId : removed)
+		pack.WriteInt32(roomId);
+	return true;
+}
+
+void RoomDirectory::WriteSnapshot(NetPackStream& pack, uint16_t type, uint32_t& outVersion)
+{
+	auto& dir = Instance();
+	auto rLock = dir._lock.OnRead();
+	const Index* index = &dir._all;
+	if (type != Query::ANY_TYPE)
+	{
+		auto typeIt = dir._byType.find(type);
+		index = typeIt == dir._byType.end() ? nullptr : &typeIt->second;
+	}
+
+	outVersion = dir._version;
+	pack.WriteUInt8(1);
+	pack.WriteUInt32(outVersion);
+	pack.WriteUInt32(index == nullptr ? 0 : (uint32_t)index->byId.size());
+	if (index != nullptr)
+	{
+		for (int roomId : index->byId)
+			dir._rows.at(roomId).Write(pack);
+	}
+	pack.WriteUInt32(0);
+}
@@ -0,0 +1,119 @@
+#pragma once
+#include "Room.h"
+#include "Utils/ReadWriteLock.h"
+#include <set>
+#include <deque>
+#include <unordered_map>
+
+class NetPack;
+class NetPackStream;
+
+// one lobby row, all a client needs to pick a room
+struct RoomSummary
+{
+	int roomId = -1;
+	Room::RoomType type = Room::RoomType::HALL;
+	uint32_t memberCount = 0;
+	// -1 and 0 for rooms without a table
+	int smallBlind = -1;
+	int bigBlind = -1;
+	uint8_t seatedCount = 0;
+	uint8_t freeSeats = 0;
+
+	void Write(NetPackStream& pack) const;
+};
+
+// in-memory lobby index, kept up to date by RoomMgr (rooms, members) and PokerRoom (blinds, seats)
+// so a lobby query touches only the rows it returns instead of every room and member.
+// every room is indexed by id, big blind and free seats, once per type and once across all types.
+// every change also bumps a version and goes into a bounded change log, LobbyFeed pushes diffs from it.
+class RoomDirectory
+{
+public:
+	enum class SortBy : uint8_t
+	{
+		RoomId = 0,
+		BigBlind = 1,     // ascending
+		FreeSeats = 2,    // most free seats first
+	};
+
+	struct Query
+	{
+		static constexpr uint16_t ANY_TYPE = 0xFFFF;
+
+		uint16_t type = ANY_TYPE;
+		int minBigBlind = 0;
+		// 0 for no upper bound
+		int maxBigBlind = 0;
+		uint8_t minFreeSeats = 0;
+		SortBy sortBy = SortBy::RoomId;
+		// echo of the previous page's next cursor, cursorRoomId 0 for the first page
+		int cursorKey = 0;
+		int cursorRoomId = 0;
+		uint16_t limit = 0;
+
+		// rpc_server_query_rooms body
+		void Read(NetPack& pack);
+	};
+
+private:
+	struct Index
+	{
+		std::set<int> byId{};
+		std::set<std::pair<int, int>> byBigBlind{};
+		// (-free seats, room id) so the roomiest tables come first
+		std::set<std::pair<int, int>> byFreeSeats{};
+
+		void Insert(const RoomSummary& row);
+		void Erase(const RoomSummary& row);
+	};
+
+	// one entry per row change, a room may appear many times
+	struct Change
+	{
+		uint32_t version;
+		int roomId;
+		Room::RoomType type;
+	};
+
+	static RoomDirectory& Instance();
+
+	std::unordered_map<int, RoomSummary> _rows{};
+	std::deque<Change> _changes{};
+	uint32_t _version = 0;
+	std::unordered_map<uint16_t, Index> _byType{};
+	Index _all{};
+	ReadWriteLock _lock{};
+
+	// caller holds the write lock
+	void Reindex(const RoomSummary& before, const RoomSummary& after);
+	void RecordChange(int roomId, Room::RoomType type);
+	static bool TypeMatches(uint16_t filter, Room::RoomType type) { return filter == Query::ANY_TYPE || filter == type; }
+	static bool Matches(const RoomSummary& row, const Query& query);
+
+	RoomDirectory() = default;
+	RoomDirectory(const RoomDirectory&) = delete;
+	RoomDirectory& operator=(const RoomDirectory&) = delete;
+
+public:
+	static void AddRoom(const RoomSummary& row);
+	static void RemoveRoom(int roomId);
+	static void SetMemberCount(int roomId, uint32_t memberCount);
+	static void SetTable(int roomId, int smallBlind, int bigBlind, int seatedCount, int seatCount);
+	// drops every row whose id matches, ShardGateway uses it when a shard resets or goes away
+	static void RemoveRoomsIf(const std::function<bool(int)>& pred);
+	static bool GetRoom(int roomId, RoomSummary& outRow);
+
+	// rpc_client_query_rooms body: [count u32][rows][has more u8][next cursor key i32][next cursor room id i32]
+	static void WriteQuery(NetPackStream& pack, const Query& query);
+	// up to limit listed room ids above afterRoomId, ascending
+	static std::vector<int> GetRoomIdsAfter(int afterRoomId, size_t limit);
+
+	static uint32_t GetVersion();
+	// rpc_client_lobby_diff bodies: [reset u8][version u32][row count u32][rows][removed count u32][room ids i32]
+	// changes of rooms of the given type after sinceVersion, each room once with its current row or in the removed list.
+	// false and nothing written if the log no longer reaches back that far
+	static bool WriteChanges(NetPackStream& pack, uint16_t type, uint32_t sinceVersion, uint32_t& outVersion);
+	// every room of the given type, reset set
+	static void WriteSnapshot(NetPackStream& pack, uint16_t type, uint32_t& outVersion);
+};
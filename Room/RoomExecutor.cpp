@@ -0,0 +1,391 @@
+#include "pch.h"
+#include "RoomExecutor.h"
+#include "RoomMgr.h"
+#include "Utils/EpochReclaimer.h"
+
+namespace
+{
+	uint64_t ElapsedNs(std::chrono::steady_clock::time_point start)
+	{
+		return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+	}
+}
+
+RoomExecutor& RoomExecutor::Instance()
+{
+	static RoomExecutor instance;
+	return instance;
+}
+
+RoomExecutor::RoomExecutor()
+{
+	for (int i = 0; i < ROOM_EXECUTOR_COUNT; i++)
+		_threads.emplace_back(&RoomExecutor::ExecutorJob, this, i);
+}
+
+RoomExecutor::~RoomExecutor()
+{
+	for (auto& exec : _executors)
+	{
+		{
+			std::lock_guard<std::mutex> lock(exec.mutex);
+			_isDead.store(true);
+		}
+		exec.cond.notify_all();
+	}
+	for (auto& thread : _threads)
+	{
+		if (thread.joinable())
+			thread.join();
+	}
+	// whatever the dropped tasks hold goes with them, e.g. a teardown waiting for its exits
+	auto wLock = _lock.OnWrite();
+	for (auto& [roomId, state] : _states)
+	{
+		std::lock_guard<std::mutex> lock(state->mutex);
+		state->inbox.clear();
+	}
+}
+
+void RoomExecutor::AddRoom(int roomId)
+{
+	auto& ex = Instance();
+	auto state = std::make_shared<RoomState>();
+	state->roomId = roomId;
+
+	auto wLock = ex._lock.OnWrite();
+	int target = 0;
+	size_t fewest = SIZE_MAX;
+	for (int i = 0; i < ROOM_EXECUTOR_COUNT; i++)
+	{
+		std::lock_guard<std::mutex> lock(ex._executors[i].mutex);
+		if (ex._executors[i].rooms.size() < fewest)
+		{
+			fewest = ex._executors[i].rooms.size();
+			target = i;
+		}
+	}
+	state->owner = target;
+	{
+		std::lock_guard<std::mutex> lock(ex._executors[target].mutex);
+		ex._executors[target].rooms.push_back(state);
+	}
+	ex._states[roomId] = state;
+}
+
+void RoomExecutor::RemoveRoom(int roomId)
+{
+	auto& ex = Instance();
+	std::shared_ptr<RoomState> state{};
+	{
+		auto wLock = ex._lock.OnWrite();
+		auto it = ex._states.find(roomId);
+		if (it == ex._states.end())
+			return;
+		state = it->second;
+		ex._states.erase(it);
+	}
+	// the owner drops it from its list at its next tick
+	state->removed.store(true);
+	std::lock_guard<std::mutex> lock(state->mutex);
+	state->inbox.clear();
+}
+
+bool RoomExecutor::Post(int roomId, PlayerHandle owner, std::function<void(Player*)> run)
+{
+	return Instance().Enqueue(roomId, Task{ owner, std::move(run), false });
+}
+
+bool RoomExecutor::PostExit(int roomId, PlayerHandle owner, std::function<void(Player*)> run)
+{
+	return Instance().Enqueue(roomId, Task{ owner, std::move(run), true });
+}
+
+bool RoomExecutor::Enqueue(int roomId, Task&& task)
+{
+	if (_isDead.load())
+		return false;
+	std::shared_ptr<RoomState> state{};
+	{
+		auto rLock = _lock.OnRead();
+		auto it = _states.find(roomId);
+		if (it == _states.end())
+			return false;
+		state = it->second;
+	}
+	int target = -1;
+	{
+		std::lock_guard<std::mutex> lock(state->mutex);
+		state->inbox.push_back(std::move(task));
+		if (!state->scheduled)
+		{
+			state->scheduled = true;
+			target = state->owner;
+		}
+	}
+	// a handoff in between also schedules the room on its new owner, the old one skips the stale entry
+	if (target >= 0)
+	{
+		auto& exec = _executors[target];
+		{
+			std::lock_guard<std::mutex> lock(exec.mutex);
+			exec.ready.push_back(state);
+		}
+		exec.cond.notify_one();
+	}
+	return true;
+}
+
+void RoomExecutor::Sleep(int roomId)
+{
+	auto& ex = Instance();
+	std::shared_ptr<RoomState> state{};
+	{
+		auto rLock = ex._lock.OnRead();
+		auto it = ex._states.find(roomId);
+		if (it == ex._states.end())
+			return;
+		state = it->second;
+	}
+	// the owner only changes under the room's mutex, holding it keeps a Handoff or Wake from crossing this
+	std::lock_guard<std::mutex> lock(state->mutex);
+	if (state->sleeping)
+		return;
+	state->sleeping = true;
+	auto& exec = ex._executors[state->owner];
+	std::lock_guard<std::mutex> execLock(exec.mutex);
+	std::erase(exec.rooms, state);
+}
+
+void RoomExecutor::Wake(int roomId)
+{
+	auto& ex = Instance();
+	std::shared_ptr<RoomState> state{};
+	{
+		auto rLock = ex._lock.OnRead();
+		auto it = ex._states.find(roomId);
+		if (it == ex._states.end())
+			return;
+		state = it->second;
+	}
+	std::lock_guard<std::mutex> lock(state->mutex);
+	if (!state->sleeping)
+		return;
+	state->sleeping = false;
+	auto& exec = ex._executors[state->owner];
+	std::lock_guard<std::mutex> execLock(exec.mutex);
+	exec.rooms.push_back(state);
+}
+
+void RoomExecutor::ExecutorJob(int index)
+{
+	auto& exec = _executors[index];
+	uint64_t tickDone = 0;
+	while (true)
+	{
+		std::shared_ptr<RoomState> state{};
+		uint64_t tick = 0;
+		{
+			std::unique_lock<std::mutex> lock(exec.mutex);
+			exec.cond.wait(lock, [this, &exec, tickDone]() { return _isDead.load() || !exec.ready.empty() || exec.tickRequested != tickDone; });
+			if (_isDead.load())
+				return;
+			if (exec.tickRequested != tickDone)
+				tick = exec.tickRequested;
+			else
+			{
+				state = std::move(exec.ready.front());
+				exec.ready.pop_front();
+			}
+		}
+		if (tick != 0)
+		{
+			RunTick(index, tick);
+			tickDone = tick;
+			{
+				std::lock_guard<std::mutex> lock(_tickMutex);
+				_pendingTicks--;
+			}
+			_tickCond.notify_one();
+		}
+		else
+			exec.busyNs += Drain(index, *state);
+	}
+}
+
+uint64_t RoomExecutor::Drain(int index, RoomState& state)
+{
+	std::deque<Task> tasks{};
+	{
+		std::lock_guard<std::mutex> lock(state.mutex);
+		if (state.owner != index)
+			return 0;
+		state.scheduled = false;
+		tasks.swap(state.inbox);
+	}
+	if (tasks.empty())
+		return 0;
+	auto start = std::chrono::steady_clock::now();
+	for (auto& task : tasks)
+	{
+		EpochReclaimer::ReadGuard guard{};
+		Player* player = PlayerMgr::Resolve(task.owner);
+		if (player != nullptr && (task.runIfExpired || !player->Expired()))
+			task.run(player);
+	}
+	uint64_t cost = ElapsedNs(start);
+	state.costNs += cost;
+	return cost;
+}
+
+void RoomExecutor::RunTick(int index, uint64_t tick)
+{
+	auto& exec = _executors[index];
+	std::vector<std::shared_ptr<RoomState>> rooms{};
+	{
+		std::lock_guard<std::mutex> lock(exec.mutex);
+		std::erase_if(exec.rooms, [](const std::shared_ptr<RoomState>& state) { return state->removed.load(); });
+		rooms = exec.rooms;
+	}
+	auto start = std::chrono::steady_clock::now();
+	for (auto& state : rooms)
+	{
+		if (state->lastTick == tick || state->removed.load())
+			continue;
+		state->lastTick = tick;
+		// packets that came in before the tick are handled before it, as on the main thread
+		Drain(index, *state);
+		auto roomStart = std::chrono::steady_clock::now();
+		RoomMgr::TickRoom(state->roomId);
+		state->costNs += ElapsedNs(roomStart);
+	}
+	exec.busyNs += ElapsedNs(start);
+	// every room of this executor is ticked, whatever moves now is picked up by its new owner next tick
+	for (auto& state : rooms)
+	{
+		if (state->migrateTo.load() >= 0)
+			Handoff(index, state);
+	}
+}
+
+void RoomExecutor::Handoff(int from, const std::shared_ptr<RoomState>& state)
+{
+	int to = state->migrateTo.exchange(-1);
+	if (to < 0 || to == from || state->removed.load())
+		return;
+	auto& exec = _executors[to];
+	{
+		// under the room's mutex, so a Sleep or Wake meanwhile sees either the old owner or the new one
+		std::lock_guard<std::mutex> lock(state->mutex);
+		state->owner = to;
+		bool schedule = !state->inbox.empty();
+		state->scheduled = schedule;
+		{
+			std::lock_guard<std::mutex> fromLock(_executors[from].mutex);
+			std::erase(_executors[from].rooms, state);
+		}
+		std::lock_guard<std::mutex> toLock(exec.mutex);
+		if (!state->sleeping)
+			exec.rooms.push_back(state);
+		if (schedule)
+			exec.ready.push_back(state);
+	}
+	exec.cond.notify_one();
+	_migrations++;
+}
+
+void RoomExecutor::TickAll()
+{
+	auto& ex = Instance();
+	if (ex._isDead.load())
+		return;
+	uint64_t tick = ++ex._tick;
+	{
+		std::lock_guard<std::mutex> lock(ex._tickMutex);
+		ex._pendingTicks = ROOM_EXECUTOR_COUNT;
+	}
+	for (auto& exec : ex._executors)
+	{
+		{
+			std::lock_guard<std::mutex> lock(exec.mutex);
+			exec.tickRequested = tick;
+		}
+		exec.cond.notify_one();
+	}
+	{
+		std::unique_lock<std::mutex> lock(ex._tickMutex);
+		ex._tickCond.wait(lock, [&ex]() { return ex._pendingTicks == 0; });
+	}
+	if (++ex._ticksSinceRebalance >= ROOM_REBALANCE_INTERVAL_TICKS)
+	{
+		ex._ticksSinceRebalance = 0;
+		ex.Rebalance();
+	}
+}
+
+void RoomExecutor::Rebalance()
+{
+	std::array<uint64_t, ROOM_EXECUTOR_COUNT> load{};
+	std::array<std::vector<std::pair<uint64_t, std::shared_ptr<RoomState>>>, ROOM_EXECUTOR_COUNT> byExecutor{};
+	{
+		auto rLock = _lock.OnRead();
+		for (auto& [roomId, state] : _states)
+		{
+			uint64_t cost = state->costNs.exchange(0);
+			int owner = 0;
+			bool sleeping = false;
+			{
+				std::lock_guard<std::mutex> lock(state->mutex);
+				owner = state->owner;
+				sleeping = state->sleeping;
+			}
+			load[owner] += cost;
+			// a sleeping room is not ticked, so it would not be handed off either
+			if (cost > 0 && !sleeping)
+				byExecutor[owner].emplace_back(cost, state);
+		}
+	}
+
+	for (int move = 0; move < ROOM_REBALANCE_MAX_MOVES; move++)
+	{
+		int busiest = (int)(std::max_element(load.begin(), load.end()) - load.begin());
+		int idlest = (int)(std::min_element(load.begin(), load.end()) - load.begin());
+		uint64_t gap = load[busiest] - load[idlest];
+		if (load[busiest] == 0 || gap * 100 < load[busiest] * ROOM_REBALANCE_THRESHOLD_PERCENT)
+			return;
+		// the biggest room that still narrows the gap, a room worth more than half of it would only swap the roles
+		auto& candidates = byExecutor[busiest];
+		auto best = candidates.end();
+		for (auto it = candidates.begin(); it != candidates.end(); ++it)
+		{
+			if (it->first <= gap / 2 && (best == candidates.end() || it->first > best->first))
+				best = it;
+		}
+		if (best == candidates.end())
+			return;
+		best->second->migrateTo.store(idlest);
+		load[busiest] -= best->first;
+		load[idlest] += best->first;
+		byExecutor[idlest].push_back(*best);
+		candidates.erase(best);
+	}
+}
+
+void RoomExecutor::DebugPrint()
+{
+	auto& ex = Instance();
+	std::cout << "[ROOM EXECUTOR REPORT] migrations: " << ex._migrations.load() << std::endl;
+	for (int i = 0; i < ROOM_EXECUTOR_COUNT; i++)
+	{
+		auto& exec = ex._executors[i];
+		size_t roomCount = 0;
+		size_t readyCount = 0;
+		{
+			std::lock_guard<std::mutex> lock(exec.mutex);
+			roomCount = exec.rooms.size();
+			readyCount = exec.ready.size();
+		}
+		std::cout << "\texecutor " << i << ": rooms: " << roomCount << ", ready: " << readyCount
+			<< ", busy ms: " << exec.busyNs.load() / 1000000 << std::endl;
+	}
+}
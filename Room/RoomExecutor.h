@@ -0,0 +1,116 @@
+#pragma once
+#include "Const.h"
+#include "Utils/ReadWriteLock.h"
+#include "Player/PlayerHandle.h"
+#include <array>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <condition_variable>
+#include <unordered_map>
+
+class Player;
+
+// runs rooms on ROOM_EXECUTOR_COUNT threads instead of the main thread
+// every room is owned by one executor, which alone drains the room's inbox (room-routed packets and joins, in
+// arrival order) and ticks it. TickAll hands a tick to every executor and returns once all of them are done.
+// ownership only changes hands at the end of the owner's tick: the room's state is a plain object and its inbox is
+// per room, so the new owner picks up exactly where the old one stopped and nothing is dropped or reordered.
+// every ROOM_REBALANCE_INTERVAL_TICKS the time each room cost its executor decides which rooms move, see Rebalance.
+class RoomExecutor
+{
+	struct Task
+	{
+		PlayerHandle owner;
+		std::function<void(Player*)> run;
+		// exits of a player in teardown run too, it stays resolvable until PlayerTeardown reclaims it
+		bool runIfExpired = false;
+	};
+	struct RoomState
+	{
+		int roomId = 0;
+		std::mutex mutex;
+		// guarded by mutex
+		std::deque<Task> inbox{};
+		int owner = 0;
+		// in the owner's ready queue already
+		bool scheduled = false;
+		// hibernated, left out of the owner's rooms until it wakes; a post still schedules it, see Sleep
+		bool sleeping = false;
+
+		std::atomic<bool> removed{ false };
+		// set by Rebalance, carried out by the owner at the end of its next tick
+		std::atomic<int> migrateTo{ -1 };
+		// only touched by the owner, a room that arrives from an executor that already ticked it waits for the next tick
+		uint64_t lastTick = 0;
+		// spent on this room since the last rebalance
+		std::atomic<uint64_t> costNs{ 0 };
+	};
+	struct Executor
+	{
+		std::mutex mutex;
+		std::condition_variable cond;
+		// guarded by mutex, taken after a room's mutex when both are held
+		std::deque<std::shared_ptr<RoomState>> ready{};
+		// the rooms it ticks, sleeping ones are not in here
+		std::vector<std::shared_ptr<RoomState>> rooms{};
+		uint64_t tickRequested = 0;
+
+		std::atomic<uint64_t> busyNs{ 0 };
+	};
+
+	static RoomExecutor& Instance();
+
+	std::array<Executor, ROOM_EXECUTOR_COUNT> _executors{};
+	std::vector<std::thread> _threads{};
+	// set under every executor's mutex, so no executor misses the wakeup
+	std::atomic<bool> _isDead{ false };
+	std::unordered_map<int, std::shared_ptr<RoomState>> _states{};
+	ReadWriteLock _lock{};
+
+	// TickAll waits here for the executors
+	std::mutex _tickMutex;
+	std::condition_variable _tickCond;
+	int _pendingTicks = 0;
+	uint64_t _tick = 0;
+	uint64_t _ticksSinceRebalance = 0;
+
+	std::atomic<uint64_t> _migrations{ 0 };
+
+	void ExecutorJob(int index);
+	bool Enqueue(int roomId, Task&& task);
+	// runs the room's inbox, returns the time it took; does nothing unless index owns the room
+	uint64_t Drain(int index, RoomState& state);
+	void RunTick(int index, uint64_t tick);
+	void Handoff(int from, const std::shared_ptr<RoomState>& state);
+	// main thread, between two ticks
+	void Rebalance();
+
+	RoomExecutor();
+	RoomExecutor(const RoomExecutor&) = delete;
+	RoomExecutor& operator=(const RoomExecutor&) = delete;
+
+public:
+	// stops and joins the executors, tasks still queued are dropped
+	~RoomExecutor();
+
+	// a new room goes to the executor with the fewest rooms
+	static void AddRoom(int roomId);
+	// drops whatever is still in the room's inbox
+	static void RemoveRoom(int roomId);
+	// queues run for the room's executor, false if there is no such room; run is skipped if owner is gone by then
+	static bool Post(int roomId, PlayerHandle owner, std::function<void(Player*)> run);
+	// the same for leaving a room: run also goes ahead for an owner in teardown, as long as it was not reclaimed yet
+	static bool PostExit(int roomId, PlayerHandle owner, std::function<void(Player*)> run);
+	// a hibernated room costs its executor nothing per tick, it is only drained when something is posted to it.
+	// the room wakes itself from there (or from any other thread) once it is resident again
+	static void Sleep(int roomId);
+	static void Wake(int roomId);
+	// main thread, once per tick
+	static void TickAll();
+	static void DebugPrint();
+};
@@ -1,15 +1,17 @@
 #include "pch.h"
 #include "Net/NetPack.h"
+#include "Net/NetPackStream.h"
+#include "Const.h"
 #include "RoomMgr.h"
 #include "ChatRoom.h"
 #include "PokerRoom.h"
+#include "RoomDirectory.h"
+#include "RoomExecutor.h"
+#include "Utils/EpochReclaimer.h"
 
-std::unordered_map<int, std::shared_ptr<Room>> RoomMgr::_allRoomById =
-std::unordered_map<int, std::shared_ptr<Room>>();
-ReadWriteLock RoomMgr::_lock = ReadWriteLock();
-int RoomMgr::_roomIdInc = 0;
+RoomSlotTable RoomMgr::_rooms{};
 
-RpcError RoomMgr::AddPlayerToRoom(std::shared_ptr<Player> p, int roomId)
+RpcError RoomMgr::AddPlayerToRoom(Player* p, int roomId)
 {
 	if (p == nullptr) return RpcError::PLAYER_STATE_ERROR;
 	
@@ -17,29 +19,19 @@ RpcError RoomMgr::AddPlayerToRoom(std::shared_ptr<Player> p, int roomId)
 	if (p->IsInRoom(roomId))
 		return RpcError::ALREADY_IN_SELECTED_ROOM;
 	
-	std::shared_ptr<Room> roomToJoin = nullptr;
-	{
-		auto rLock = _lock.OnRead();
-		if (_allRoomById.contains(roomId))
-			roomToJoin = _allRoomById[roomId];
-	}
-	
+	EpochReclaimer::ReadGuard guard{};
+	Room* roomToJoin = _rooms.Resolve(roomId);
 	if (roomToJoin == nullptr)
 		return RpcError::ROOM_NOT_EXIST;
 	
 	return roomToJoin->OnPlayerJoin(p);
 }
-RpcError RoomMgr::RemovePlayerFromRoom(std::shared_ptr<Player> p, int roomId)
+RpcError RoomMgr::RemovePlayerFromRoom(Player* p, int roomId)
 {
 	if (p == nullptr) return RpcError::PLAYER_STATE_ERROR;
 	
-	std::shared_ptr<Room> room = nullptr;
-	{
-		auto rLock = _lock.OnRead();
-		if (_allRoomById.contains(roomId))
-			room = _allRoomById[roomId];
-	}
-	
+	EpochReclaimer::ReadGuard guard{};
+	Room* room = _rooms.Resolve(roomId);
 	if (room == nullptr)
 		return RpcError::ROOM_NOT_EXIST;
 	
@@ -48,69 +40,71 @@ RpcError RoomMgr::RemovePlayerFromRoom(std::shared_ptr<Player> p, int roomId)
 }
 RpcError RoomMgr::CreateRoom(Room::RoomType type, std::shared_ptr<Room>& newRoom)
 {
-	int roomId = -1;
-	{
-		auto wLock = _lock.OnWrite();
-		_roomIdInc = (_roomIdInc + 1) % 99999999;
-		roomId = _roomIdInc;
-	}
+	switch (type)
 	{
-		switch (type)
-		{
-		case Room::RoomType::CHAT_ROOM:
-			newRoom = std::make_shared<ChatRoom>();
-			break;
-		case Room::RoomType::POKER_ROOM:
-			newRoom = std::make_shared<PokerRoom>();
-			break;
-		default:
-			return RpcError::ROOM_TYPE_ERROR;
-		}
+	case Room::RoomType::CHAT_ROOM:
+		newRoom = std::make_shared<ChatRoom>();
+		break;
+	case Room::RoomType::POKER_ROOM:
+		newRoom = std::make_shared<PokerRoom>();
+		break;
+	default:
+		return RpcError::ROOM_TYPE_ERROR;
 	}
+	int roomId = _rooms.Reserve();
+	if (roomId == 0)
+		return RpcError::ROOM_ID_OVERFLOW;
 	newRoom->OnRoomCreated(roomId);
-	{
-		auto wLock = _lock.OnWrite();
-		if (_allRoomById.contains(roomId))
-			return RpcError::ROOM_ID_OVERFLOW;
-		_allRoomById[roomId] = newRoom;
-	}
+	// listed before anyone can look the room up, so no directory update can arrive ahead of its row
+	RoomDirectory::AddRoom(newRoom->Summarize());
+	_rooms.Publish(roomId, newRoom);
+	RoomExecutor::AddRoom(roomId);
 	return RpcError::SUCCESS;
 }
 void RoomMgr::RemoveRoom(int roomId)
 {
-	std::shared_ptr<Room> room = nullptr;
-	{
-		auto wLock = _lock.OnWrite();
-		if (!_allRoomById.contains(roomId))
-			return;
-		room = _allRoomById[roomId];
-		_allRoomById.erase(roomId);
-	}
+	auto room = _rooms.Release(roomId);
+	if (room == nullptr)
+		return;
+	RoomDirectory::RemoveRoom(roomId);
+	RoomExecutor::RemoveRoom(roomId);
 	room->OnRoomDestroy();
+	// readers that resolved the id before the release may still be inside the room
+	EpochReclaimer::Retire([room]() mutable { room.reset(); });
 }
-void RoomMgr::ForEachPlayerInRoom(int roomId, std::function<void(std::shared_ptr<Player>)> func)
+void RoomMgr::ForEachPlayerInRoom(int roomId, std::function<void(Player*)> func)
 {
-	std::shared_ptr<Room> room = nullptr;
-	{
-		auto rLock = _lock.OnRead();
-		if (!_allRoomById.contains(roomId))
-			return;
-		room = _allRoomById[roomId];
-	}
+	EpochReclaimer::ReadGuard guard{};
+	Room* room = _rooms.Resolve(roomId);
+	if (room == nullptr)
+		return;
 	room->ForEachPlayerInRoom(func);
 }
-void RoomMgr::WriteAllRoom(NetPack& pack)
+void RoomMgr::WriteRoomPage(NetPackStream& pack, uint32_t afterRoomId, uint16_t limit)
 {
-	std::unordered_map<int, std::shared_ptr<Room>> mapCopy{};
+	size_t pageSize = limit == 0 ? LISTING_DEFAULT_PAGE_SIZE : std::min((size_t)limit, (size_t)LISTING_MAX_PAGE_SIZE);
+	// the directory keeps ids in order, one extra tells whether there is a next page
+	auto ids = RoomDirectory::GetRoomIdsAfter((int)std::min(afterRoomId, (uint32_t)INT_MAX), pageSize + 1);
+	bool more = ids.size() > pageSize;
+	if (more)
+		ids.resize(pageSize);
+
+	EpochReclaimer::ReadGuard guard{};
+	std::vector<Room*> page{};
+	page.reserve(ids.size());
+	for (int roomId : ids)
 	{
-		auto rLock = _lock.OnRead();
-		mapCopy = std::unordered_map<int, std::shared_ptr<Room>>(_allRoomById);
+		// listed but not published yet, or removed since
+		if (Room* room = _rooms.Resolve(roomId))
+			page.push_back(room);
 	}
-	pack.WriteUInt32((uint32_t)mapCopy.size());
-	for (const auto& room : mapCopy)
-		room.second->WriteRoom(pack);
+
+	pack.WriteUInt32((uint32_t)page.size());
+	for (auto room : page)
+		room->WriteRoom(pack);
+	pack.WriteUInt32(more ? (uint32_t)ids.back() : 0);
 }
-void RoomMgr::WritePlayerRooms(std::shared_ptr<Player> p, NetPack& pack)
+void RoomMgr::WritePlayerRooms(Player* p, NetPack& pack)
 {
 	if (p == nullptr)
 	{
@@ -122,14 +116,14 @@ void RoomMgr::WritePlayerRooms(std::shared_ptr<Player> p, NetPack& pack)
 	std::vector<std::pair<int, Room::RoomType>> roomInfoList;
 	
 	{
-		auto rLock = _lock.OnRead();
+		EpochReclaimer::ReadGuard guard{};
 		for (int roomId : playerRooms)
 		{
-			if (_allRoomById.contains(roomId))
-			{
-				auto& room = _allRoomById[roomId];
+			if (Room* room = _rooms.Resolve(roomId))
 				roomInfoList.emplace_back(roomId, room->GetRoomType());
-			}
+			// rooms on another shard are only known through their lobby row
+			else if (RoomSummary row{}; RoomDirectory::GetRoom(roomId, row))
+				roomInfoList.emplace_back(roomId, row.type);
 		}
 	}
 	
@@ -140,33 +134,42 @@ void RoomMgr::WritePlayerRooms(std::shared_ptr<Player> p, NetPack& pack)
 		pack.WriteUInt16(roomType);
 	}
 }
-RpcError RoomMgr::HandleNetPack(std::shared_ptr<Player> player, NetPack& pack, int roomId)
+RpcError RoomMgr::HandleNetPack(Player* player, NetPack& pack, int roomId)
 {
 	if (player == nullptr) return RpcError::PLAYER_STATE_ERROR;
 	
-	std::shared_ptr<Room> room = nullptr;
-	{
-		auto rLock = _lock.OnRead();
-		if (_allRoomById.contains(roomId))
-			room = _allRoomById[roomId];
-	}
-	
+	EpochReclaimer::ReadGuard guard{};
+	Room* room = _rooms.Resolve(roomId);
 	if (room == nullptr)
 		return RpcError::ROOM_NOT_EXIST;
 	
 	return room->OnRecvPlayerNetPack(player, pack);
 }
-std::unordered_map<int, std::shared_ptr<Room>> RoomMgr::GetAllRoom()
+RpcError RoomMgr::PostToRoom(int roomId, PlayerHandle player, std::function<void(Player*)> func)
+{
+	return RoomExecutor::Post(roomId, player, std::move(func)) ? RpcError::SUCCESS : RpcError::ROOM_NOT_EXIST;
+}
+RpcError RoomMgr::PostExitToRoom(int roomId, PlayerHandle player, std::function<void(Player*)> func)
 {
-	return _allRoomById;
+	return RoomExecutor::PostExit(roomId, player, std::move(func)) ? RpcError::SUCCESS : RpcError::ROOM_NOT_EXIST;
+}
+void RoomMgr::TickRoom(int roomId)
+{
+	// a room removed during the tick stays valid until the guard drops
+	EpochReclaimer::ReadGuard guard{};
+	Room* room = _rooms.Resolve(roomId);
+	if (room != nullptr && !room->IsHibernating())
+		room->OnTick();
+}
+void RoomMgr::SleepRoom(int roomId)
+{
+	RoomExecutor::Sleep(roomId);
+}
+void RoomMgr::WakeRoom(int roomId)
+{
+	RoomExecutor::Wake(roomId);
 }
 void RoomMgr::TickAllRoom()
 {
-	std::unordered_map<int, std::shared_ptr<Room>> mapCopy{};
-	{
-		auto rLock = _lock.OnRead();
-		mapCopy = std::unordered_map<int, std::shared_ptr<Room>>(_allRoomById);
-	}
-	for (const auto& room : mapCopy)
-		room.second->OnTick();
+	RoomExecutor::TickAll();
 }
\ No newline at end of file
@@ -1,26 +1,39 @@
 #pragma once
 #include "Room.h"
-#include "Utils/ReadWriteLock.h"
+#include "RoomSlotTable.h"
 #include "Player/Player.h"
 #include "Net/RpcError.h"
 #include <thread>
 #include <mutex>
 
 class NetPack;
+class NetPackStream;
 class RoomMgr
 {
-	static std::unordered_map<int,std::shared_ptr<Room>> _allRoomById;
-	static ReadWriteLock _lock;
-	static int _roomIdInc;
+	// lookups take no lock, every path resolves under an EpochReclaimer::ReadGuard
+	static RoomSlotTable _rooms;
 public:
-	static RpcError AddPlayerToRoom(std::shared_ptr<Player> p, int roomId);
-	static RpcError RemovePlayerFromRoom(std::shared_ptr<Player> p, int roomId);
+	// see RoomShard::Init
+	static void SetSlotRange(uint32_t firstIndex, uint32_t endIndex) { _rooms.SetRange(firstIndex, endIndex); }
+	static RpcError AddPlayerToRoom(Player* p, int roomId);
+	static RpcError RemovePlayerFromRoom(Player* p, int roomId);
 	static RpcError CreateRoom(Room::RoomType type, std::shared_ptr<Room>& newRoom);
 	static void RemoveRoom(int roomId);
-	static void ForEachPlayerInRoom(int roomId, std::function<void(std::shared_ptr<Player>)> func);
-	static void WriteAllRoom(NetPack& pack);
-	static void WritePlayerRooms(std::shared_ptr<Player> p, NetPack& pack);
-	static RpcError HandleNetPack(std::shared_ptr<Player> player, NetPack& pack, int roomId);
-	static std::unordered_map<int, std::shared_ptr<Room>> GetAllRoom();
+	static void ForEachPlayerInRoom(int roomId, std::function<void(Player*)> func);
+	// rooms with an id above afterRoomId in id order, followed by the cursor of the next page (0 when done)
+	static void WriteRoomPage(NetPackStream& pack, uint32_t afterRoomId, uint16_t limit);
+	static void WritePlayerRooms(Player* p, NetPack& pack);
+	// runs on the room's executor, see PostToRoom
+	static RpcError HandleNetPack(Player* player, NetPack& pack, int roomId);
+	// queues func on the executor that owns the room, ROOM_NOT_EXIST if the room is not here
+	static RpcError PostToRoom(int roomId, PlayerHandle player, std::function<void(Player*)> func);
+	// the same for an exit, which still runs once the player is being torn down
+	static RpcError PostExitToRoom(int roomId, PlayerHandle player, std::function<void(Player*)> func);
+	// called by the room's executor
+	static void TickRoom(int roomId);
+	// a hibernated room is left out of its executor's ticks until it is resident again, see RoomExecutor::Sleep
+	static void SleepRoom(int roomId);
+	static void WakeRoom(int roomId);
+	// hands one tick to every RoomExecutor and waits for all of them
 	static void TickAllRoom();
 };
\ No newline at end of file
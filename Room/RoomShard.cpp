@@ -0,0 +1,55 @@
+#include "pch.h"
+#include "RoomShard.h"
+#include "RoomMgr.h"
+#include "Net/NetPackStream.h"
+
+int RoomShard::s_localShard = 0;
+std::atomic<uint32_t> RoomShard::s_nextCreateShard{ 0 };
+
+bool RoomShard::Init(int localShard)
+{
+	if (localShard < 0 || localShard >= ROOM_SHARD_COUNT)
+		return false;
+	s_localShard = localShard;
+	RoomMgr::SetSlotRange(localShard * SLOTS_PER_SHARD, (localShard + 1) * SLOTS_PER_SHARD);
+	NetPackStream::SetStreamIdBase((uint32_t)localShard << 24);
+	return true;
+}
+
+std::string RoomShard::GetSocketPath(int shard)
+{
+	return std::format(ROOM_SHARD_SOCKET_PATH, shard);
+}
+
+const std::string& RoomShard::GetSecret()
+{
+	static const std::string secret = []()
+		{
+			std::string value{};
+			char* buf = nullptr;
+			size_t len = 0;
+			if (_dupenv_s(&buf, &len, ROOM_SHARD_SECRET_ENV) == 0 && buf != nullptr)
+				value = buf;
+			free(buf);
+			return value;
+		}();
+	return secret;
+}
+
+bool RoomShard::CheckSecret(const uint8_t* data, size_t len)
+{
+	const std::string& secret = GetSecret();
+	if (secret.empty() || len != secret.size())
+		return false;
+	uint8_t diff = 0;
+	for (size_t i = 0; i < len; i++)
+		diff |= data[i] ^ (uint8_t)secret[i];
+	return diff == 0;
+}
+
+int RoomShard::PickShardForNewRoom()
+{
+	if (!IsGateway())
+		return s_localShard;
+	return (int)(s_nextCreateShard.fetch_add(1) % ROOM_SHARD_COUNT);
+}
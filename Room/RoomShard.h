@@ -0,0 +1,34 @@
+#pragma once
+#include "Const.h"
+#include "RoomSlotTable.h"
+#include <string>
+#include <atomic>
+
+// which process owns which rooms when the server runs as ROOM_SHARD_COUNT processes on one host
+// shard k owns RoomSlotTable slots [k * SLOTS_PER_SHARD, (k + 1) * SLOTS_PER_SHARD), so every room id names its shard.
+// shard 0 is the gateway: it owns the client sockets, logins and the lobby, and hosts its own range of rooms.
+// every other shard runs as "CppServer --room-shard <k>", listens on GetSocketPath(k) only and is reached
+// through ShardGateway. with ROOM_SHARD_COUNT 1 everything stays in one process.
+class RoomShard
+{
+	static int s_localShard;
+	static std::atomic<uint32_t> s_nextCreateShard;
+
+public:
+	static constexpr uint32_t SLOTS_PER_SHARD = ROOM_SLOT_CAPACITY / ROOM_SHARD_COUNT;
+	static_assert(ROOM_SHARD_COUNT > 0 && SLOTS_PER_SHARD > 0, "ROOM_SHARD_COUNT must be between 1 and ROOM_SLOT_CAPACITY");
+
+	// once, before the first room is created; false for a shard index out of range
+	static bool Init(int localShard);
+	static int GetLocalShard() { return s_localShard; }
+	static bool IsGateway() { return s_localShard == 0; }
+	static int ShardOf(int roomId) { return (int)(RoomSlotTable::IndexOf(roomId) / SLOTS_PER_SHARD); }
+	static bool IsLocal(int roomId) { return ShardOf(roomId) == s_localShard; }
+	static std::string GetSocketPath(int shard);
+	// from ROOM_SHARD_SECRET_ENV, read once, empty if it is not set
+	static const std::string& GetSecret();
+	// constant time, never true while the secret is empty
+	static bool CheckSecret(const uint8_t* data, size_t len);
+	// round robin over every shard on the gateway, the local shard anywhere else
+	static int PickShardForNewRoom();
+};
@@ -0,0 +1,117 @@
+#include "pch.h"
+#include "RoomSlotTable.h"
+#include "Room.h"
+#include <algorithm>
+
+RoomSlotTable::RoomSlotTable() : _slots(std::make_unique<Slot[]>(ROOM_SLOT_CAPACITY))
+{
+}
+
+uint32_t RoomSlotTable::PopFree()
+{
+	uint64_t head = _freeHead.load(std::memory_order_acquire);
+	while ((uint32_t)head != NO_SLOT)
+	{
+		uint32_t index = (uint32_t)head;
+		uint32_t next = _slots[index].nextFree.load(std::memory_order_relaxed);
+		uint64_t popped = (((head >> 32) + 1) << 32) | next;
+		if (_freeHead.compare_exchange_weak(head, popped, std::memory_order_acq_rel, std::memory_order_acquire))
+			return index;
+	}
+	return NO_SLOT;
+}
+
+void RoomSlotTable::PushFree(uint32_t index)
+{
+	uint64_t head = _freeHead.load(std::memory_order_relaxed);
+	uint64_t pushed = 0;
+	do
+	{
+		_slots[index].nextFree.store((uint32_t)head, std::memory_order_relaxed);
+		pushed = (head & 0xFFFFFFFF00000000ull) | index;
+	} while (!_freeHead.compare_exchange_weak(head, pushed, std::memory_order_release, std::memory_order_relaxed));
+}
+
+void RoomSlotTable::SetRange(uint32_t firstIndex, uint32_t endIndex)
+{
+	_firstIndex = std::min(firstIndex, (uint32_t)ROOM_SLOT_CAPACITY);
+	_endIndex = std::clamp(endIndex, _firstIndex, (uint32_t)ROOM_SLOT_CAPACITY);
+	_highWater.store(_firstIndex);
+}
+
+int RoomSlotTable::Reserve()
+{
+	uint32_t index = PopFree();
+	if (index == NO_SLOT)
+	{
+		index = _highWater.load(std::memory_order_relaxed);
+		do
+		{
+			if (index >= _endIndex)
+				return 0;
+		} while (!_highWater.compare_exchange_weak(index, index + 1, std::memory_order_relaxed));
+	}
+
+	auto& slot = _slots[index];
+	// generation 0 would make id 0 possible for slot 0, and the top bit is the sign
+	if (++slot.generation >= (1u << (31 - ROOM_ID_INDEX_BITS)))
+		slot.generation = 1;
+	return (int)((slot.generation << ROOM_ID_INDEX_BITS) | index);
+}
+
+void RoomSlotTable::Cancel(int roomId)
+{
+	if (roomId > 0)
+		PushFree(IndexOf(roomId));
+}
+
+void RoomSlotTable::Publish(int roomId, std::shared_ptr<Room> room)
+{
+	auto& slot = _slots[IndexOf(roomId)];
+	slot.room.store(room.get(), std::memory_order_relaxed);
+	slot.owner = std::move(room);
+	slot.roomId.store(roomId, std::memory_order_release);
+}
+
+std::shared_ptr<Room> RoomSlotTable::Release(int roomId)
+{
+	if (roomId <= 0)
+		return nullptr;
+	auto& slot = _slots[IndexOf(roomId)];
+	int expected = roomId;
+	// only one remover wins the slot
+	if (!slot.roomId.compare_exchange_strong(expected, 0, std::memory_order_acq_rel))
+		return nullptr;
+	slot.room.store(nullptr, std::memory_order_release);
+	auto owner = std::move(slot.owner);
+	PushFree(IndexOf(roomId));
+	return owner;
+}
+
+Room* RoomSlotTable::Resolve(int roomId) const
+{
+	if (roomId <= 0)
+		return nullptr;
+	auto& slot = _slots[IndexOf(roomId)];
+	if (slot.roomId.load(std::memory_order_acquire) != roomId)
+		return nullptr;
+	auto room = slot.room.load(std::memory_order_acquire);
+	// released (and maybe reused) between the two loads
+	if (slot.roomId.load(std::memory_order_acquire) != roomId)
+		return nullptr;
+	return room;
+}
+
+void RoomSlotTable::ForEach(const std::function<void(Room*)>& func) const
+{
+	uint32_t highWater = std::min(_highWater.load(std::memory_order_acquire), _endIndex);
+	for (uint32_t i = _firstIndex; i < highWater; i++)
+	{
+		auto& slot = _slots[i];
+		if (slot.roomId.load(std::memory_order_acquire) == 0)
+			continue;
+		auto room = slot.room.load(std::memory_order_acquire);
+		if (room != nullptr)
+			func(room);
+	}
+}
@@ -0,0 +1,62 @@
+#pragma once
+#include "Const.h"
+#include <atomic>
+#include <memory>
+#include <functional>
+
+class Room;
+
+// dense table of every live room, addressed by room id
+// a room id is (generation << ROOM_ID_INDEX_BITS) | slot index, the generation is bumped each time a slot is
+// handed out again, so an id that outlived its room resolves to nullptr instead of to the next room in the slot.
+// allocation is lock free: freed slots go on an atomic free list, fresh ones come from an atomic high water mark.
+// Resolve and ForEach are lock free, the returned pointers are only valid while the caller holds an EpochReclaimer::ReadGuard.
+class RoomSlotTable
+{
+	static constexpr uint32_t INDEX_MASK = ROOM_SLOT_CAPACITY - 1;
+	static constexpr uint32_t NO_SLOT = UINT32_MAX;
+
+	struct Slot
+	{
+		// full room id while the slot is live, 0 while it is free or reserved
+		std::atomic<int> roomId{ 0 };
+		std::atomic<Room*> room{ nullptr };
+		// owning reference, only touched by whoever holds the slot's id
+		std::shared_ptr<Room> owner{};
+		uint32_t generation = 0;
+		// free list link
+		std::atomic<uint32_t> nextFree{ NO_SLOT };
+	};
+
+	std::unique_ptr<Slot[]> _slots;
+	// (pop count << 32) | first free index, the count keeps a stale pop from succeeding
+	std::atomic<uint64_t> _freeHead{ NO_SLOT };
+	std::atomic<uint32_t> _highWater{ 0 };
+	// slots this table hands out, see RoomShard
+	uint32_t _firstIndex = 0;
+	uint32_t _endIndex = ROOM_SLOT_CAPACITY;
+
+	uint32_t PopFree();
+	void PushFree(uint32_t index);
+
+public:
+	RoomSlotTable();
+	RoomSlotTable(const RoomSlotTable&) = delete;
+	RoomSlotTable& operator=(const RoomSlotTable&) = delete;
+
+	// restricts Reserve to [firstIndex, endIndex), only before the first Reserve
+	void SetRange(uint32_t firstIndex, uint32_t endIndex);
+	// returns 0 when every slot is taken
+	int Reserve();
+	// gives a reserved id back without publishing it
+	void Cancel(int roomId);
+	// makes a reserved id resolvable
+	void Publish(int roomId, std::shared_ptr<Room> room);
+	// the id stops resolving right away, the caller retires the returned reference
+	std::shared_ptr<Room> Release(int roomId);
+	Room* Resolve(int roomId) const;
+	// every published room, in slot order
+	void ForEach(const std::function<void(Room*)>& func) const;
+
+	static uint32_t IndexOf(int roomId) { return (uint32_t)roomId & INDEX_MASK; }
+};
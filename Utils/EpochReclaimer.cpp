@@ -0,0 +1,100 @@
+#include "pch.h"
+#include "EpochReclaimer.h"
+
+EpochReclaimer& EpochReclaimer::Inst()
+{
+	static EpochReclaimer inst;
+	return inst;
+}
+
+EpochReclaimer::ThreadState& EpochReclaimer::State()
+{
+	thread_local ThreadState state{};
+	return state;
+}
+
+EpochReclaimer::ThreadState::~ThreadState()
+{
+	if (slot)
+	{
+		slot->epoch.store(IDLE);
+		slot->owned.store(false, std::memory_order_release);
+	}
+}
+
+EpochReclaimer::~EpochReclaimer()
+{
+	// process exit, nobody reads anymore
+	for (auto& r : _retired)
+		r.deleter();
+	_retired.clear();
+}
+
+EpochReclaimer::Slot* EpochReclaimer::ClaimSlot()
+{
+	while (true)
+	{
+		for (auto& slot : _slots)
+		{
+			bool expected = false;
+			if (!slot.owned.load(std::memory_order_relaxed) && slot.owned.compare_exchange_strong(expected, true))
+				return &slot;
+		}
+		// more live reader threads than slots, wait for one to exit
+		std::this_thread::yield();
+	}
+}
+
+uint64_t EpochReclaimer::MinActiveEpoch()
+{
+	uint64_t minEpoch = IDLE;
+	for (auto& slot : _slots)
+		minEpoch = std::min(minEpoch, slot.epoch.load());
+	return minEpoch;
+}
+
+EpochReclaimer::ReadGuard::ReadGuard()
+{
+	auto& state = State();
+	if (state.depth++ > 0)
+		return;
+	if (!state.slot)
+		state.slot = Inst().ClaimSlot();
+	// seq_cst: the announcement must be visible before the caller loads the published pointer
+	state.slot->epoch.store(Inst()._globalEpoch.load());
+}
+
+EpochReclaimer::ReadGuard::~ReadGuard()
+{
+	auto& state = State();
+	if (--state.depth > 0)
+		return;
+	state.slot->epoch.store(IDLE, std::memory_order_release);
+}
+
+void EpochReclaimer::Retire(std::function<void()> deleter)
+{
+	auto& inst = Inst();
+	std::vector<std::function<void()>> ready{};
+	{
+		std::unique_lock<std::mutex> lock(inst._retireMutex);
+		// readers that announced an epoch <= this one may still hold the old version
+		uint64_t epoch = inst._globalEpoch.fetch_add(1);
+		inst._retired.push_back(Retired{ epoch, std::move(deleter) });
+
+		uint64_t minActive = inst.MinActiveEpoch();
+		auto it = std::partition(inst._retired.begin(), inst._retired.end(), [minActive](const Retired& r) { return r.epoch >= minActive; });
+		for (auto freeIt = it; freeIt != inst._retired.end(); ++freeIt)
+			ready.push_back(std::move(freeIt->deleter));
+		inst._retired.erase(it, inst._retired.end());
+	}
+	for (auto& d : ready)
+		d();
+}
+
+size_t EpochReclaimer::GetPendingCount()
+{
+	auto& inst = Inst();
+	std::unique_lock<std::mutex> lock(inst._retireMutex);
+	return inst._retired.size();
+}
@@ -0,0 +1,73 @@
+#pragma once
+#include "CppServerAPI.h"
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+// epoch based reclamation for read-mostly data published through an atomic pointer
+// readers hold a ReadGuard while they use a pointer they loaded, which costs two atomic stores and no lock.
+// writers swap in a new version and Retire the old one, which is deleted once every reader that
+// could still see it has left its guard.
+// each thread that reads owns one slot while it lives, at most MAX_READER_THREADS at the same time.
+class CPPSERVER_API EpochReclaimer
+{
+public:
+	static constexpr size_t MAX_READER_THREADS = 256;
+
+private:
+	static constexpr uint64_t IDLE = UINT64_MAX;
+
+	struct alignas(64) Slot
+	{
+		std::atomic<uint64_t> epoch{ IDLE };
+		std::atomic<bool> owned{ false };
+	};
+
+	struct Retired
+	{
+		uint64_t epoch;
+		std::function<void()> deleter;
+	};
+
+	// the reading thread's slot and guard nesting depth, the slot is given back when the thread exits
+	struct ThreadState
+	{
+		Slot* slot = nullptr;
+		int depth = 0;
+		~ThreadState();
+	};
+
+	static EpochReclaimer& Inst();
+	static ThreadState& State();
+
+	Slot _slots[MAX_READER_THREADS];
+	std::atomic<uint64_t> _globalEpoch{ 0 };
+	std::vector<Retired> _retired{};
+	std::mutex _retireMutex;
+
+	Slot* ClaimSlot();
+	uint64_t MinActiveEpoch();
+
+	EpochReclaimer() = default;
+	EpochReclaimer(const EpochReclaimer&) = delete;
+	EpochReclaimer& operator=(const EpochReclaimer&) = delete;
+
+public:
+	~EpochReclaimer();
+
+	// guards may nest, only the outermost one announces the thread
+	class CPPSERVER_API ReadGuard
+	{
+	public:
+		ReadGuard();
+		~ReadGuard();
+		ReadGuard(const ReadGuard&) = delete;
+		ReadGuard& operator=(const ReadGuard&) = delete;
+	};
+
+	// call after the old version is unreachable from the published pointer
+	// deleter runs on whichever thread retires next once it is safe, never while the caller holds a guard on it
+	static void Retire(std::function<void()> deleter);
+	static size_t GetPendingCount();
+};
@@ -0,0 +1,455 @@
+#include "pch.h"
+#include "PasswordHasher.h"
+#include "Const.h"
+#include <array>
+#include <random>
+#include <cstring>
+
+namespace
+{
+	// ---- sha256 / hmac / pbkdf2, only what scrypt needs ----
+
+	const uint32_t SHA256_K[64] = {
+		0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+		0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+		0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+		0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+		0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+		0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+		0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+		0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+	};
+
+	inline uint32_t Rotr(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+	inline uint32_t Rotl(uint32_t x, int n) { return (x << n) | (x >> (32 - n)); }
+
+	class Sha256
+	{
+		uint32_t _h[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+		uint8_t _buf[64]{};
+		size_t _bufLen = 0;
+		uint64_t _totalLen = 0;
+
+		void Compress(const uint8_t* block)
+		{
+			uint32_t w[64];
+			for (int i = 0; i < 16; i++)
+				w[i] = (uint32_t)block[i * 4] << 24 | (uint32_t)block[i * 4 + 1] << 16 | (uint32_t)block[i * 4 + 2] << 8 | block[i * 4 + 3];
+			for (int i = 16; i < 64; i++)
+			{
+				uint32_t s0 = Rotr(w[i - 15], 7) ^ Rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+				uint32_t s1 = Rotr(w[i - 2], 17) ^ Rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+				w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+			}
+			uint32_t a = _h[0], b = _h[1], c = _h[2], d = _h[3], e = _h[4], f = _h[5], g = _h[6], h = _h[7];
+			for (int i = 0; i < 64; i++)
+			{
+				uint32_t t1 = h + (Rotr(e, 6) ^ Rotr(e, 11) ^ Rotr(e, 25)) + ((e & f) ^ (~e & g)) + SHA256_K[i] + w[i];
+				uint32_t t2 = (Rotr(a, 2) ^ Rotr(a, 13) ^ Rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+				h = g; g = f; f = e; e = d + t1;
+				d = c; c = b; b = a; a = t1 + t2;
+			}
+			_h[0] += a; _h[1] += b; _h[2] += c; _h[3] += d;
+			_h[4] += e; _h[5] += f; _h[6] += g; _h[7] += h;
+		}
+
+	public:
+		void Update(const uint8_t* data, size_t len)
+		{
+			_totalLen += len;
+			while (len > 0)
+			{
+				size_t n = std::min(len, 64 - _bufLen);
+				std::memcpy(_buf + _bufLen, data, n);
+				_bufLen += n;
+				data += n;
+				len -= n;
+				if (_bufLen == 64)
+				{
+					Compress(_buf);
+					_bufLen = 0;
+				}
+			}
+		}
+
+		void Final(uint8_t out[32])
+		{
+			uint64_t bitLen = _totalLen * 8;
+			uint8_t pad = 0x80;
+			Update(&pad, 1);
+			uint8_t zero = 0;
+			while (_bufLen != 56)
+				Update(&zero, 1);
+			uint8_t lenBytes[8];
+			for (int i = 0; i < 8; i++)
+				lenBytes[i] = (uint8_t)(bitLen >> (56 - i * 8));
+			Update(lenBytes, 8);
+			for (int i = 0; i < 8; i++)
+			{
+				out[i * 4] = (uint8_t)(_h[i] >> 24);
+				out[i * 4 + 1] = (uint8_t)(_h[i] >> 16);
+				out[i * 4 + 2] = (uint8_t)(_h[i] >> 8);
+				out[i * 4 + 3] = (uint8_t)_h[i];
+			}
+		}
+	};
+
+	class HmacSha256
+	{
+		Sha256 _inner{};
+		Sha256 _outer{};
+	public:
+		HmacSha256(const uint8_t* key, size_t keyLen)
+		{
+			uint8_t block[64]{};
+			if (keyLen > 64)
+			{
+				Sha256 k{};
+				k.Update(key, keyLen);
+				k.Final(block);
+			}
+			else
+				std::memcpy(block, key, keyLen);
+			uint8_t ipad[64], opad[64];
+			for (int i = 0; i < 64; i++)
+			{
+				ipad[i] = block[i] ^ 0x36;
+				opad[i] = block[i] ^ 0x5c;
+			}
+			_inner.Update(ipad, 64);
+			_outer.Update(opad, 64);
+		}
+		void Update(const uint8_t* data, size_t len) { _inner.Update(data, len); }
+		void Final(uint8_t out[32])
+		{
+			uint8_t innerHash[32];
+			_inner.Final(innerHash);
+			_outer.Update(innerHash, 32);
+			_outer.Final(out);
+		}
+	};
+
+	// pbkdf2-hmac-sha256 with a single iteration, which is all scrypt uses
+	void Pbkdf2Sha256(const uint8_t* pass, size_t passLen, const uint8_t* salt, size_t saltLen, uint8_t* out, size_t outLen)
+	{
+		HmacSha256 keyed(pass, passLen);
+		for (uint32_t block = 1; outLen > 0; block++)
+		{
+			HmacSha256 mac = keyed;
+			mac.Update(salt, saltLen);
+			uint8_t counter[4] = { (uint8_t)(block >> 24), (uint8_t)(block >> 16), (uint8_t)(block >> 8), (uint8_t)block };
+			mac.Update(counter, 4);
+			uint8_t digest[32];
+			mac.Final(digest);
+			size_t n = std::min(outLen, (size_t)32);
+			std::memcpy(out, digest, n);
+			out += n;
+			outLen -= n;
+		}
+	}
+
+	// ---- scrypt (rfc 7914) ----
+
+	void Salsa20_8(uint32_t b[16])
+	{
+		uint32_t x[16];
+		std::memcpy(x, b, sizeof(x));
+		for (int i = 0; i < 8; i += 2)
+		{
+			x[4] ^= Rotl(x[0] + x[12], 7);  x[8] ^= Rotl(x[4] + x[0], 9);
+			x[12] ^= Rotl(x[8] + x[4], 13); x[0] ^= Rotl(x[12] + x[8], 18);
+			x[9] ^= Rotl(x[5] + x[1], 7);   x[13] ^= Rotl(x[9] + x[5], 9);
+			x[1] ^= Rotl(x[13] + x[9], 13); x[5] ^= Rotl(x[1] + x[13], 18);
+			x[14] ^= Rotl(x[10] + x[6], 7); x[2] ^= Rotl(x[14] + x[10], 9);
+			x[6] ^= Rotl(x[2] + x[14], 13); x[10] ^= Rotl(x[6] + x[2], 18);
+			x[3] ^= Rotl(x[15] + x[11], 7); x[7] ^= Rotl(x[3] + x[15], 9);
+			x[11] ^= Rotl(x[7] + x[3], 13); x[15] ^= Rotl(x[11] + x[7], 18);
+			x[1] ^= Rotl(x[0] + x[3], 7);   x[2] ^= Rotl(x[1] + x[0], 9);
+			x[3] ^= Rotl(x[2] + x[1], 13);  x[0] ^= Rotl(x[3] + x[2], 18);
+			x[6] ^= Rotl(x[5] + x[4], 7);   x[7] ^= Rotl(x[6] + x[5], 9);
+			x[4] ^= Rotl(x[7] + x[6], 13);  x[5] ^= Rotl(x[4] + x[7], 18);
+			x[11] ^= Rotl(x[10] + x[9], 7); x[8] ^= Rotl(x[11] + x[10], 9);
+			x[9] ^= Rotl(x[8] + x[11], 13); x[10] ^= Rotl(x[9] + x[8], 18);
+			x[12] ^= Rotl(x[15] + x[14], 7); x[13] ^= Rotl(x[12] + x[15], 9);
+			x[14] ^= Rotl(x[13] + x[12], 13); x[15] ^= Rotl(x[14] + x[13], 18);
+		}
+		for (int i = 0; i < 16; i++)
+			b[i] += x[i];
+	}
+
+	// b and y are 32 * r words
+	void BlockMix(uint32_t* b, uint32_t* y, uint32_t r)
+	{
+		uint32_t x[16];
+		std::memcpy(x, &b[(2 * r - 1) * 16], 64);
+		for (uint32_t i = 0; i < 2 * r; i++)
+		{
+			for (int j = 0; j < 16; j++)
+				x[j] ^= b[i * 16 + j];
+			Salsa20_8(x);
+			// even blocks go to the first half, odd blocks to the second
+			std::memcpy(&y[((i & 1) * r + i / 2) * 16], x, 64);
+		}
+		std::memcpy(b, y, 128 * r);
+	}
+
+	void RoMix(uint8_t* block, uint32_t r, uint64_t n, std::vector<uint32_t>& v, std::vector<uint32_t>& x, std::vector<uint32_t>& y)
+	{
+		size_t words = 32 * r;
+		for (size_t i = 0; i < words; i++)
+			x[i] = (uint32_t)block[i * 4] | (uint32_t)block[i * 4 + 1] << 8 | (uint32_t)block[i * 4 + 2] << 16 | (uint32_t)block[i * 4 + 3] << 24;
+		for (uint64_t i = 0; i < n; i++)
+		{
+			std::memcpy(&v[i * words], x.data(), words * 4);
+			BlockMix(x.data(), y.data(), r);
+		}
+		for (uint64_t i = 0; i < n; i++)
+		{
+			uint64_t j = x[(2 * r - 1) * 16] & (n - 1);
+			for (size_t k = 0; k < words; k++)
+				x[k] ^= v[j * words + k];
+			BlockMix(x.data(), y.data(), r);
+		}
+		for (size_t i = 0; i < words; i++)
+		{
+			block[i * 4] = (uint8_t)x[i];
+			block[i * 4 + 1] = (uint8_t)(x[i] >> 8);
+			block[i * 4 + 2] = (uint8_t)(x[i] >> 16);
+			block[i * 4 + 3] = (uint8_t)(x[i] >> 24);
+		}
+	}
+
+	std::vector<uint8_t> Scrypt(const std::string& password, const std::vector<uint8_t>& salt, int logN, uint32_t r, uint32_t p, size_t dkLen)
+	{
+		auto pass = reinterpret_cast<const uint8_t*>(password.data());
+		std::vector<uint8_t> b(128 * r * p);
+		Pbkdf2Sha256(pass, password.size(), salt.data(), salt.size(), b.data(), b.size());
+
+		uint64_t n = 1ull << logN;
+		std::vector<uint32_t> v(32 * r * n);
+		std::vector<uint32_t> x(32 * r);
+		std::vector<uint32_t> y(32 * r);
+		for (uint32_t i = 0; i < p; i++)
+			RoMix(&b[128 * r * i], r, n, v, x, y);
+
+		std::vector<uint8_t> out(dkLen);
+		Pbkdf2Sha256(pass, password.size(), b.data(), b.size(), out.data(), out.size());
+		return out;
+	}
+
+	std::string ToHex(const std::vector<uint8_t>& bytes)
+	{
+		static const char digits[] = "0123456789abcdef";
+		std::string out;
+		out.reserve(bytes.size() * 2);
+		for (auto c : bytes)
+		{
+			out += digits[c >> 4];
+			out += digits[c & 0xf];
+		}
+		return out;
+	}
+
+	int HexNibble(char c)
+	{
+		if (c >= '0' && c <= '9') return c - '0';
+		if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+		if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+		return -1;
+	}
+
+	bool FromHex(const std::string& hex, std::vector<uint8_t>& out)
+	{
+		if (hex.size() % 2 != 0) return false;
+		out.clear();
+		for (size_t i = 0; i < hex.size(); i += 2)
+		{
+			int hi = HexNibble(hex[i]);
+			int lo = HexNibble(hex[i + 1]);
+			if (hi < 0 || lo < 0) return false;
+			out.push_back((uint8_t)(hi << 4 | lo));
+		}
+		return true;
+	}
+
+	struct ParsedHash
+	{
+		int logN = 0;
+		uint32_t r = 0;
+		uint32_t p = 0;
+		std::vector<uint8_t> salt{};
+		std::vector<uint8_t> hash{};
+	};
+
+	bool ParseHash(const std::string& stored, ParsedHash& out)
+	{
+		std::vector<std::string> parts{};
+		size_t start = 0;
+		while (true)
+		{
+			size_t pos = stored.find('$', start);
+			parts.push_back(stored.substr(start, pos - start));
+			if (pos == std::string::npos) break;
+			start = pos + 1;
+		}
+		if (parts.size() != 6 || parts[0] != "scrypt") return false;
+		try
+		{
+			out.logN = std::stoi(parts[1]);
+			out.r = (uint32_t)std::stoul(parts[2]);
+			out.p = (uint32_t)std::stoul(parts[3]);
+		}
+		catch (const std::exception&)
+		{
+			return false;
+		}
+		// refuse parameters that would let a bad row eat the server's memory
+		if (out.logN < 1 || out.logN > 20 || out.r < 1 || out.r > 32 || out.p < 1 || out.p > 16) return false;
+		return FromHex(parts[4], out.salt) && FromHex(parts[5], out.hash) && !out.hash.empty();
+	}
+
+	bool ConstantTimeEquals(const uint8_t* a, const uint8_t* b, size_t len)
+	{
+		uint8_t diff = 0;
+		for (size_t i = 0; i < len; i++)
+			diff |= a[i] ^ b[i];
+		return diff == 0;
+	}
+}
+
+PasswordHasher::PasswordHasher(size_t workerCount)
+{
+	for (size_t i = 0; i < workerCount; i++)
+		_workers.emplace_back(std::thread(&PasswordHasher::WorkerJob, this));
+}
+
+PasswordHasher::~PasswordHasher()
+{
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		_isDead = true;
+	}
+	_cond.notify_all();
+	for (auto& t : _workers) t.join();
+}
+
+PasswordHasher& PasswordHasher::Instance()
+{
+	static PasswordHasher instance(PASSWORD_HASH_WORKER_COUNT);
+	return instance;
+}
+
+void PasswordHasher::WorkerJob()
+{
+	while (true)
+	{
+		std::function<void()> job;
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_cond.wait(lock, [this]() { return _isDead || !_jobs.empty(); });
+			if (_isDead && _jobs.empty()) return;
+			job = std::move(_jobs.front());
+			_jobs.pop_front();
+		}
+		try
+		{
+			job();
+		}
+		catch (const std::exception& e)
+		{
+			std::cout << "STD ERROR: " << e.what() << std::endl;
+		}
+	}
+}
+
+bool PasswordHasher::Enqueue(std::function<void()> job)
+{
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		if (_isDead || _jobs.size() >= PASSWORD_HASH_QUEUE_CAPACITY)
+		{
+			_rejected++;
+			return false;
+		}
+		_jobs.push_back(std::move(job));
+	}
+	_cond.notify_one();
+	return true;
+}
+
+std::string PasswordHasher::Hash(const std::string& password)
+{
+	std::random_device rd;
+	std::vector<uint8_t> salt(PASSWORD_SALT_BYTES);
+	for (auto& b : salt)
+		b = (uint8_t)rd();
+	auto hash = Scrypt(password, salt, PASSWORD_SCRYPT_LOG_N, PASSWORD_SCRYPT_R, PASSWORD_SCRYPT_P, 32);
+	return "scrypt$" + std::to_string(PASSWORD_SCRYPT_LOG_N) + "$" + std::to_string(PASSWORD_SCRYPT_R) + "$"
+		+ std::to_string(PASSWORD_SCRYPT_P) + "$" + ToHex(salt) + "$" + ToHex(hash);
+}
+
+bool PasswordHasher::Verify(const std::string& password, const std::string& stored)
+{
+	ParsedHash parsed{};
+	if (!ParseHash(stored, parsed))
+	{
+		// legacy plain text row, upgraded by the caller after a successful login
+		if (stored.rfind("scrypt$", 0) == 0)
+			return false;
+		return password.size() == stored.size()
+			&& ::ConstantTimeEquals(reinterpret_cast<const uint8_t*>(password.data()), reinterpret_cast<const uint8_t*>(stored.data()), stored.size());
+	}
+	auto hash = Scrypt(password, parsed.salt, parsed.logN, parsed.r, parsed.p, parsed.hash.size());
+	return ::ConstantTimeEquals(hash.data(), parsed.hash.data(), hash.size());
+}
+
+bool PasswordHasher::NeedsRehash(const std::string& stored)
+{
+	ParsedHash parsed{};
+	if (!ParseHash(stored, parsed))
+		return true;
+	return parsed.logN != PASSWORD_SCRYPT_LOG_N || parsed.r != PASSWORD_SCRYPT_R || parsed.p != PASSWORD_SCRYPT_P;
+}
+
+bool PasswordHasher::HashAsync(const std::string& password, std::function<void(std::string&&)> done)
+{
+	return Instance().Enqueue([password, done]()
+		{
+			done(Hash(password));
+		});
+}
+
+bool PasswordHasher::VerifyAsync(const std::string& password, const std::string& stored, std::function<void(bool)> done)
+{
+	return Instance().Enqueue([password, stored, done]()
+		{
+			done(Verify(password, stored));
+		});
+}
+
+std::string PasswordHasher::HmacSha256Hex(const std::string& key, const std::string& message)
+{
+	HmacSha256 mac(reinterpret_cast<const uint8_t*>(key.data()), key.size());
+	mac.Update(reinterpret_cast<const uint8_t*>(message.data()), message.size());
+	std::vector<uint8_t> out(32);
+	mac.Final(out.data());
+	return ToHex(out);
+}
+
+bool PasswordHasher::ConstantTimeEquals(const std::string& a, const std::string& b)
+{
+	return a.size() == b.size()
+		&& ::ConstantTimeEquals(reinterpret_cast<const uint8_t*>(a.data()), reinterpret_cast<const uint8_t*>(b.data()), a.size());
+}
+
+void PasswordHasher::DebugPrint()
+{
+	auto& hasher = Instance();
+	size_t queued = 0;
+	{
+		std::unique_lock<std::mutex> lock(hasher._mutex);
+		queued = hasher._jobs.size();
+	}
+	std::cout << "[PASSWORD HASHER REPORT] queued: " << queued << "/" << PASSWORD_HASH_QUEUE_CAPACITY
+		<< "; rejected: " << hasher._rejected.load() << std::endl;
+}
@@ -0,0 +1,54 @@
+#pragma once
+#include "CppServerAPI.h"
+#include <string>
+#include <vector>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+
+// salted scrypt password hashing
+// stored format: scrypt$<log2 N>$<r>$<p>$<salt hex>$<hash hex>
+// hashing costs PASSWORD_SCRYPT_LOG_N / _R / _P worth of cpu and memory, so the async calls run it
+// on a small dedicated pool, never on the tick or db threads. the pool has a fixed number of workers
+// and a bounded queue, a request that does not fit is rejected right away.
+class CPPSERVER_API PasswordHasher
+{
+	static PasswordHasher& Instance();
+
+	std::deque<std::function<void()>> _jobs{};
+	std::vector<std::thread> _workers{};
+	std::mutex _mutex;
+	std::condition_variable _cond;
+	bool _isDead = false;
+
+	std::atomic<uint64_t> _rejected{ 0 };
+
+	void WorkerJob();
+	bool Enqueue(std::function<void()> job);
+
+	PasswordHasher(size_t workerCount);
+	PasswordHasher(const PasswordHasher&) = delete;
+	PasswordHasher& operator=(const PasswordHasher&) = delete;
+
+public:
+	~PasswordHasher();
+
+	// blocking
+	static std::string Hash(const std::string& password);
+	static bool Verify(const std::string& password, const std::string& stored);
+	// true for rows written before hashing was introduced (plain text) or with older cost parameters
+	static bool NeedsRehash(const std::string& stored);
+
+	// async, done runs on a hasher thread; returns false and never calls done if the pool is full
+	static bool HashAsync(const std::string& password, std::function<void(std::string&&)> done);
+	static bool VerifyAsync(const std::string& password, const std::string& stored, std::function<void(bool)> done);
+
+	// the same primitives, for other things the server signs (see SessionToken)
+	static std::string HmacSha256Hex(const std::string& key, const std::string& message);
+	static bool ConstantTimeEquals(const std::string& a, const std::string& b);
+
+	static void DebugPrint();
+};
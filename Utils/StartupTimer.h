@@ -0,0 +1,58 @@
+#pragma once
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <iostream>
+
+// records how long each startup phase took, phases may run on different threads
+class StartupTimer
+{
+	struct PhaseRecord
+	{
+		std::string name;
+		long long startMs;
+		long long durationMs;
+	};
+
+	std::chrono::steady_clock::time_point _processStart = std::chrono::steady_clock::now();
+	std::vector<PhaseRecord> _phases{};
+	std::mutex _mutex;
+
+	static StartupTimer& Inst() { static StartupTimer inst; return inst; }
+
+	long long SinceStart(std::chrono::steady_clock::time_point t)
+	{
+		return std::chrono::duration_cast<std::chrono::milliseconds>(t - _processStart).count();
+	}
+
+public:
+	// pins time zero of the report, first thing in main
+	static void Begin() { Inst(); }
+
+	// times the enclosing scope
+	class Phase
+	{
+		std::string _name;
+		std::chrono::steady_clock::time_point _start;
+	public:
+		// Inst() first, so time zero is never later than the start of a phase even without Begin()
+		Phase(const std::string& name) : _name(name) { Inst(); _start = std::chrono::steady_clock::now(); }
+		~Phase()
+		{
+			auto end = std::chrono::steady_clock::now();
+			auto& timer = Inst();
+			std::lock_guard<std::mutex> lock(timer._mutex);
+			timer._phases.push_back({ _name, timer.SinceStart(_start), timer.SinceStart(end) - timer.SinceStart(_start) });
+		}
+	};
+
+	static void Report(const std::string& title)
+	{
+		auto& timer = Inst();
+		std::lock_guard<std::mutex> lock(timer._mutex);
+		std::cout << "[STARTUP REPORT] " << title << " after " << timer.SinceStart(std::chrono::steady_clock::now()) << "ms" << std::endl;
+		for (const auto& phase : timer._phases)
+			std::cout << "\t" << phase.name << ": +" << phase.startMs << "ms, took " << phase.durationMs << "ms" << std::endl;
+	}
+};
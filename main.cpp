@@ -1,16 +1,85 @@
 #include "pch.h"
+#include "Const.h"
+#include "Database/StorageMgr.h"
+#include "Database/DbRequestQueue.h"
+#include "Database/ChipSettlementMgr.h"
+#include "Database/MySqlStorage.h"
+#include "Database/SqliteStorage.h"
+#include "Database/PostgreSqlStorage.h"
+#include "Utils/StartupTimer.h"
+#include "Utils/PasswordHasher.h"
+#include "Player/PlayerTeardown.h"
+#include "Room/LobbyFeed.h"
+#include "Room/RoomShard.h"
+#include "Room/RoomExecutor.h"
+#include "Net/ShardGateway.h"
+#include "Net/ShardHost.h"
+#include "Net/FrontLink.h"
+#include "Net/FrontProcess.h"
+#include <afunix.h>
+#include <filesystem>
 
-int main(int* args)
+// room shards take no clients, only the gateway's links on their local socket
+static SOCKET ListenOnShardSocket(int shard)
 {
+	std::string path = RoomShard::GetSocketPath(shard);
+	// left behind by an earlier run, bind fails on an existing file
+	std::error_code ec;
+	std::filesystem::remove(path, ec);
+
+	SOCKET listenSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listenSocket == INVALID_SOCKET)
+		return INVALID_SOCKET;
+	sockaddr_un addr{};
+	addr.sun_family = AF_UNIX;
+	path.copy(addr.sun_path, sizeof(addr.sun_path) - 1);
+	if (bind(listenSocket, (sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR || listen(listenSocket, SOMAXCONN) == SOCKET_ERROR)
+	{
+		printf("shard socket %s failed with error: %d\n", path.c_str(), WSAGetLastError());
+		closesocket(listenSocket);
+		return INVALID_SOCKET;
+	}
+	return listenSocket;
+}
+
+int main(int argc, char** argv)
+{
+	StartupTimer::Begin();
 	std::cout << "cpp server project start" << std::endl;
 	system("chcp 936");
 
-	auto sqlErrorCode = MySqlMgr::Init("127.0.0.1", 33060, "root", "1QAZ2wsx", "wkr_server_schema");
-	if (sqlErrorCode != EXIT_SUCCESS)
-		std::cerr << "MySQL init failed!" << std::endl;
-	else
-		std::cout << "MySQL init succeded!" << std::endl;
+	// "--room-shard <k>" runs room shard k behind the gateway, no arguments runs the gateway (shard 0)
+	// "--front" only owns the client sockets and hands their packs to "--logic", which runs the gateway without a listener
+	int shardIndex = 0;
+	bool frontMode = false;
+	bool logicMode = false;
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		if (arg == "--room-shard" && i + 1 < argc)
+			shardIndex = std::atoi(argv[i + 1]);
+		else if (arg == "--front")
+			frontMode = true;
+		else if (arg == "--logic")
+			logicMode = true;
+		else if (arg == "--bench-ipc")
+			return FrontLink::RunBenchmark();
+		else if (arg == "--bench-ipc-echo" && i + 1 < argc)
+			return FrontLink::RunBenchmarkEcho((uint32_t)std::strtoul(argv[i + 1], nullptr, 10));
+#ifdef ENABLE_POSTGRESQL_STORAGE
+		else if (arg == "--pg-check")
+			return PostgreSqlMgr::RunPipelineCheck(POSTGRESQL_CONN_INFO);
+#endif
+	}
+	if (!RoomShard::Init(shardIndex))
+	{
+		printf("room shard %d out of range, ROOM_SHARD_COUNT is %d\n", shardIndex, ROOM_SHARD_COUNT);
+		return 1;
+	}
 
+	// the listener goes up first, storage comes up in the background and
+	// DbRequestQueue holds any login that arrives before it is ready
+	auto listenerPhase = std::make_unique<StartupTimer::Phase>("network listener");
 	WSADATA wsaData;
 	int iResult;
 	// Initialize Winsock
@@ -21,49 +90,68 @@ int main(int* args)
 		return 1;
 	}
 
-	const std::string serverPort = "4242";
-	struct addrinfo* result = NULL, * ptr = NULL, hints;
-	ZeroMemory(&hints, sizeof(hints));
-	hints.ai_family = AF_INET;
-	hints.ai_socktype = SOCK_STREAM;
-	hints.ai_protocol = IPPROTO_TCP;
-	hints.ai_flags = AI_PASSIVE;
-	// Resolve the local address and port to be used by the server
-	iResult = getaddrinfo(NULL, serverPort.c_str(), &hints, &result);
-	if (iResult != 0) {
-		printf("getaddrinfo failed: %d\n", iResult);
-		WSACleanup();
-		return 1;
-	}
-
 	SOCKET ListenSocket = INVALID_SOCKET;
-	// Create a SOCKET for the server to listen for client connections
-	ListenSocket = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
-	if (ListenSocket == INVALID_SOCKET)
+	const std::string serverPort = "4242";
+	if (!RoomShard::IsGateway())
 	{
-		printf("Error at socket(): %ld\n", WSAGetLastError());
-		freeaddrinfo(result);
-		WSACleanup();
-		return 1;
+		ListenSocket = ListenOnShardSocket(shardIndex);
+		if (ListenSocket == INVALID_SOCKET)
+		{
+			WSACleanup();
+			return 1;
+		}
 	}
+	else if (!logicMode)
+	{
+		struct addrinfo* result = NULL, * ptr = NULL, hints;
+		ZeroMemory(&hints, sizeof(hints));
+		hints.ai_family = AF_INET;
+		hints.ai_socktype = SOCK_STREAM;
+		hints.ai_protocol = IPPROTO_TCP;
+		hints.ai_flags = AI_PASSIVE;
+		// Resolve the local address and port to be used by the server
+		iResult = getaddrinfo(NULL, serverPort.c_str(), &hints, &result);
+		if (iResult != 0) {
+			printf("getaddrinfo failed: %d\n", iResult);
+			WSACleanup();
+			return 1;
+		}
 
-	// Setup the TCP listening socket
-	iResult = bind(ListenSocket, result->ai_addr, (int)result->ai_addrlen);
-	if (iResult == SOCKET_ERROR) {
-		printf("bind failed with error: %d\n", WSAGetLastError());
+		// Create a SOCKET for the server to listen for client connections
+		ListenSocket = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+		if (ListenSocket == INVALID_SOCKET)
+		{
+			printf("Error at socket(): %ld\n", WSAGetLastError());
+			freeaddrinfo(result);
+			WSACleanup();
+			return 1;
+		}
+
+		// Setup the TCP listening socket
+		iResult = bind(ListenSocket, result->ai_addr, (int)result->ai_addrlen);
+		if (iResult == SOCKET_ERROR) {
+			printf("bind failed with error: %d\n", WSAGetLastError());
+			freeaddrinfo(result);
+			closesocket(ListenSocket);
+			WSACleanup();
+			return 1;
+		}
 		freeaddrinfo(result);
-		closesocket(ListenSocket);
-		WSACleanup();
-		return 1;
+
+		if (listen(ListenSocket, SOMAXCONN) == SOCKET_ERROR)
+		{
+			printf("Listen failed with error: %ld\n", WSAGetLastError());
+			closesocket(ListenSocket);
+			WSACleanup();
+			return 1;
+		}
 	}
-	freeaddrinfo(result);
 
-	if (listen(ListenSocket, SOMAXCONN) == SOCKET_ERROR)
+	if (frontMode)
 	{
-		printf("Listen failed with error: %ld\n", WSAGetLastError());
-		closesocket(ListenSocket);
-		WSACleanup();
-		return 1;
+		listenerPhase.reset();
+		std::cout << "Front process listening on port " << serverPort << std::endl;
+		return FrontProcess::Run(ListenSocket);
 	}
 
 	std::function<int(void)> listenJob = [ListenSocket]() -> int
@@ -74,7 +162,11 @@ int main(int* args)
 		std::vector<std::thread> clientThreads{};
 		while (clientSocket != INVALID_SOCKET)
 		{
-			PlayerMgr::OnPlayerConnected(std::move(clientSocket));
+			// a shard's listener is only ever reached by the gateway's link
+			if (RoomShard::IsGateway())
+				PlayerMgr::OnPlayerConnected(std::move(clientSocket));
+			else
+				ShardHost::Accept(std::move(clientSocket));
 			clientSocket = accept(ListenSocket, NULL, NULL);
 		}
 		printf("accept failed: %d\n", WSAGetLastError());
@@ -83,11 +175,66 @@ int main(int* args)
 		for (auto& t : clientThreads) t.join();
 		return 1;
 	};
-	std::thread netThread = std::thread(listenJob);
+	std::thread netThread{};
+	if (logicMode)
+	{
+		if (!FrontLink::Start())
+		{
+			WSACleanup();
+			return 1;
+		}
+	}
+	else
+		netThread = std::thread(listenJob);
+	listenerPhase.reset();
+	if (logicMode)
+		std::cout << "Logic process, clients connect through the front process" << std::endl;
+	else if (RoomShard::IsGateway())
+		std::cout << "Listening on port " << serverPort << std::endl;
+	else
+		std::cout << "Room shard " << shardIndex << " listening on " << RoomShard::GetSocketPath(shardIndex) << std::endl;
+	ShardGateway::Start();
 
+#if defined(ENABLE_SQLITE_STORAGE)
+	auto storage = std::make_unique<SqliteStorage>(SQLITE_STORAGE_PATH);
+#elif defined(ENABLE_POSTGRESQL_STORAGE)
+	auto storage = std::make_unique<PostgreSqlStorage>(POSTGRESQL_CONN_INFO);
+#else
+	// add read replicas here, e.g. { "127.0.0.1", 33061 }
+	std::vector<MySqlEndpoint> readReplicas{};
+	auto storage = std::make_unique<MySqlStorage>("127.0.0.1", 33060, "root", "1QAZ2wsx", "wkr_server_schema", readReplicas);
+#endif
+	auto storageReady = StorageMgr::InitAsync(std::move(storage));
+
+
+#ifdef ENABLE_DEBUG_REPORT
+	uint64_t tickCount = 0;
+#endif
 	while (true)
 	{
 		const auto start{ std::chrono::steady_clock::now() };
+		if (storageReady.valid() && storageReady.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+		{
+			if (storageReady.get() != EXIT_SUCCESS)
+				std::cerr << "Storage init failed!" << std::endl;
+			else
+				std::cout << "Storage init succeded!" << std::endl;
+			StartupTimer::Report("storage ready");
+		}
+#ifdef ENABLE_DEBUG_REPORT
+		// roughly once a minute
+		if (++tickCount % 300 == 0)
+		{
+			DbRequestQueue::DebugPrint();
+			ChipSettlementMgr::DebugPrint();
+			PasswordHasher::DebugPrint();
+			PlayerTeardown::DebugPrint();
+			ShardGateway::DebugPrint();
+			ShardHost::DebugPrint();
+			FrontLink::DebugPrint();
+			RoomExecutor::DebugPrint();
+		}
+#endif
 		long long duration = 0;
 		while (duration < FIXED_TIME_STEP)
 		{
@@ -103,12 +250,15 @@ int main(int* args)
 		}
 		if (duration < FIXED_TIME_STEP)
 			std::this_thread::sleep_for(std::chrono::milliseconds(FIXED_TIME_STEP - duration));
-		std::unordered_set<std::shared_ptr<Player>> pToDelete = std::unordered_set<std::shared_ptr<Player>>();
-		PlayerMgr::ForAllPlayer([&pToDelete](auto p)
+		// whatever the tick sends a connection leaves in one write at the end of it
+		PlayerMgr::BeginSendBatch();
+		std::vector<PlayerHandle> pToDelete{};
+		PlayerMgr::ForAllPlayer([&pToDelete](Player* p)
 			{
 				if (p->Expired())
-					pToDelete.insert(p);
-				else if (p)
+					pToDelete.push_back(p->GetHandle());
+				// on a shard every player is a gateway tunnel, the gateway ticks the client itself
+				else if (RoomShard::IsGateway())
 				{
 					if (p->GetRooms().empty())
 					{
@@ -119,6 +269,8 @@ int main(int* args)
 				}
 			});
 		RoomMgr::TickAllRoom();
+		LobbyFeed::Tick();
+		PlayerMgr::FlushSendBatch();
 		PlayerMgr::RemovePlayers(pToDelete);
 	}
 }
\ No newline at end of file